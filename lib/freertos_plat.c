@@ -8,13 +8,49 @@
 
 #include "common.h"
 #include "task.h"
+#include "freertos_plat.h"
+#include "stm32/dwt.h"
+
+/* CPU load is worked out over windows this long, in milliseconds */
+#define LOAD_WINDOW         10000
 
 static uint64_t milliseconds;
+static uint64_t load_start;
+static uint32_t load_last, load_cycles, load_idle;
+static uint16_t cpu_load;
+
+
+void
+cpu_load_start(void) {
+    dwt_start();
+    load_last = DWT_CYCCNT;
+}
 
 
 void
 vApplicationIdleHook(void) {
+    /* Sleep with interrupts masked, so the one that wakes us only runs after
+     * the cycle count is taken and is counted as busy. Whether the counter
+     * stops during sleep depends on the debug setup, so busy time is what
+     * the counter saw minus the time spent in here, against the tick count
+     * for the wall clock. */
+    uint32_t start, end, busy, elapsed;
+    __disable_irq();
+    start = DWT_CYCCNT;
     __WFI();
+    end = DWT_CYCCNT;
+    load_cycles += end - load_last;
+    load_idle += end - start;
+    load_last = end;
+    elapsed = milliseconds - load_start;
+    if (elapsed >= LOAD_WINDOW) {
+        busy = load_cycles - load_idle;
+        cpu_load = MIN(1000, 1000ULL * busy
+                / ((uint64_t)elapsed * (system_frequency / 1000)));
+        load_cycles = load_idle = 0;
+        load_start = milliseconds;
+    }
+    __enable_irq();
 }
 
 
@@ -38,3 +74,11 @@ milliseconds_get(void) {
     taskEXIT_CRITICAL();
     return ret;
 }
+
+
+uint16_t
+cpu_load_get(void) {
+    /* Fraction of time spent outside the idle task over the last window, in
+     * tenths of a percent. Not updated while the load is 100%. */
+    return cpu_load;
+}
@@ -10,5 +10,7 @@
 #define _FREERTOS_PLAT_H
 
 uint64_t milliseconds_get(void);
+void cpu_load_start(void);
+uint16_t cpu_load_get(void);
 
 #endif
@@ -46,6 +46,8 @@
 #define MEMP_NUM_TCP_PCB_LISTEN         2
 #define MEMP_NUM_TCP_SEG                16
 #define PBUF_POOL_SIZE                  4
+/* Received frames are passed up in the MAC's own buffers */
+#define LWIP_SUPPORT_CUSTOM_PBUF        1
 
 /*
    ---------------------------------
@@ -21,5 +21,7 @@
 
 #define HALT()              while(1) {}
 #define ASSERT(x)           if (!(x)) { HALT(); }
+/* Stop the compiler from moving memory accesses across this point */
+#define BARRIER()           asm volatile("" ::: "memory")
 
 #endif
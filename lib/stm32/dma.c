@@ -101,29 +101,29 @@ DMA1_Channel7_IRQHandler(void) {
 
 void
 DMA2_Channel1_IRQHandler(void) {
-    dma_service_irq(DMA1, &dma_streams[7]);
+    dma_service_irq(DMA2, &dma_streams[7]);
 }
 
 
 void
 DMA2_Channel2_IRQHandler(void) {
-    dma_service_irq(DMA1, &dma_streams[8]);
+    dma_service_irq(DMA2, &dma_streams[8]);
 }
 
 
 void
 DMA2_Channel3_IRQHandler(void) {
-    dma_service_irq(DMA1, &dma_streams[9]);
+    dma_service_irq(DMA2, &dma_streams[9]);
 }
 
 
 void
 DMA2_Channel4_IRQHandler(void) {
-    dma_service_irq(DMA1, &dma_streams[10]);
+    dma_service_irq(DMA2, &dma_streams[10]);
 }
 
 
 void
 DMA2_Channel5_IRQHandler(void) {
-    dma_service_irq(DMA1, &dma_streams[11]);
+    dma_service_irq(DMA2, &dma_streams[11]);
 }
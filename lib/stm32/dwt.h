@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _DWT_H
+#define _DWT_H
+
+/* Cycle counter, which the CMSIS headers here don't cover */
+#define DWT_CTRL            (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT          (*(volatile uint32_t *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA  1
+
+
+static inline void
+dwt_start(void) {
+    /* Start the cycle counter, if it isn't already running */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+#endif
@@ -12,28 +12,28 @@
 #include "task.h"
 
 #include "net/tcpqueue.h"
+#include "ppscapture.h"
 #include "stm32/eth_mac.h"
+#include "stm32/eth_ptp.h"
 #include "mii.h"
+#include <stddef.h>
 #include <string.h>
 
-#define RX_BUFS 4
 #define TX_BUFS 4
-#define BUF_WORDS ((((MAC_BUF_SIZE - 1) | 3) + 1) / 4)
 
 #define MFL_INIT    1
 #define MFL_RUN     2
 #define MFL_LINK    4
 
 static SemaphoreHandle_t ethmac_tx_sem;
-static uint32_t ethmac_queue_full_events;
-
-static mac_desc_t rx_descs[RX_BUFS];
-static mac_desc_t *rx_ptr;
-static uint32_t rx_bufs[RX_BUFS][BUF_WORDS];
 
 static mac_tdes_t tx_descs[TX_BUFS];
 static mac_tdes_t *tx_ptr, *tx_active;
+static mac_tx_func tx_next_func;
+static void *tx_next_arg;
 static uint8_t mac_flags;
+/* Monotonic time when the PTP clock read zero */
+static uint64_t ptp_mono_offset;
 
 
 void
@@ -177,8 +177,41 @@ mac_set_hwaddr(const uint8_t *hwaddr) {
 }
 
 
+static void
+mac_ptp_start(void) {
+    /* Run the PTP clock straight from HCLK, which also drives the monotonic
+     * timer. The two then differ only by a constant offset. */
+    uint32_t sec, subsec;
+    uint64_t mono;
+    ETH->MACIMR |= ETH_MACIMR_TSTIM;
+    ETH->PTPTSCR = ETH_PTPTSCR_TSE;
+    ETH->PTPSSIR = STM32_PTP_SSINC;
+    ETH->PTPTSHUR = 0;
+    ETH->PTPTSLUR = 0;
+    ETH->PTPTSCR |= ETH_PTPTSCR_TSSTI;
+    while (ETH->PTPTSCR & ETH_PTPTSCR_TSSTI) {}
+
+    DISABLE_IRQ();
+    do {
+        sec = ETH->PTPTSHR;
+        subsec = ETH->PTPTSLR;
+        mono = monotonic_now();
+    } while (sec != ETH->PTPTSHR);
+    ENABLE_IRQ();
+    ptp_mono_offset = mono - ptp_ticks(sec, subsec);
+}
+
+
+uint64_t
+mac_ptp_to_mono(uint32_t sec, uint32_t subsec) {
+    /* Convert a PTP timestamp to monotonic time */
+    return ptp_mono_offset + ptp_ticks(sec, subsec);
+}
+
+
 void
 mac_start(void) {
+    mac_desc_t *rx_ring;
     int i;
     if (mac_flags & MFL_RUN) {
         HALT();
@@ -194,24 +227,20 @@ mac_start(void) {
         | RCC_AHBENR_ETHMACRXEN;
 
     /* Configure DMA */
-    for (i = 0; i < RX_BUFS; i++) {
-        rx_descs[i].des0 = STM32_RDES0_OWN;
-        rx_descs[i].des1 = STM32_RDES1_RCH | MAC_BUF_SIZE;
-        rx_descs[i].des_buf = (uint8_t*)rx_bufs[i];
-        rx_descs[i].des_next = &rx_descs[(i+1) % RX_BUFS];
-    }
+    rx_ring = mac_rx_reset();
     for (i = 0; i < TX_BUFS; i++) {
         tx_descs[i].des0 = STM32_TDES0_TCH;
         tx_descs[i].des1 = 0;
         tx_descs[i].des_buf = NULL;
-        tx_descs[i].des_next = &tx_descs[(i+1) % TX_BUFS];
+        tx_descs[i].des_next = tx_descs[i].next = &tx_descs[(i+1) % TX_BUFS];
+        tx_descs[i].pbuf = NULL;
+        tx_descs[i].tx_func = NULL;
     }
-    rx_ptr = &rx_descs[0];
     tx_ptr = &tx_descs[0];
     tx_active = NULL;
     ETH->DMABMR |= ETH_DMABMR_SR;
     while (ETH->DMABMR & ETH_DMABMR_SR) {}
-    ETH->DMARDLAR = (uint32_t)rx_ptr;
+    ETH->DMARDLAR = (uint32_t)rx_ring;
     ETH->DMATDLAR = (uint32_t)tx_ptr;
 
     /* MAC configuration */
@@ -266,6 +295,8 @@ mac_start(void) {
         | ETH_DMAOMR_SR
         ;
 
+    mac_ptp_start();
+
     mac_flags |= MFL_RUN;
     NVIC_SetPriority(ETH_IRQn, IRQ_PRIO_ETH);
     NVIC_EnableIRQ(ETH_IRQn);
@@ -295,10 +326,7 @@ ETH_IRQHandler(void) {
     dmasr = ETH->DMASR;
     ETH->DMASR = dmasr;
     if (dmasr & ETH_DMASR_RS) {
-        void *qmsg = NULL;
-        if (!xQueueSendFromISR(tcpip_queue, &qmsg, &wakeup)) {
-            ethmac_queue_full_events++;
-        }
+        xSemaphoreGiveFromISR(tcpip_wake, &wakeup);
     }
     if (dmasr & ETH_DMASR_TS) {
         xSemaphoreGiveFromISR(ethmac_tx_sem, &wakeup);
@@ -307,14 +335,24 @@ ETH_IRQHandler(void) {
 }
 
 
-static void
+void
 maczero_housekeeping(void) {
     /* Free pbufs after DMA has released the related transmit descriptor */
     while (tx_active && !(tx_active->des0 & STM32_TDES0_OWN)) {
+        if (tx_active->tx_func) {
+            uint64_t timestamp = 0;
+            if (tx_active->des0 & STM32_TDES0_TTSS) {
+                timestamp = mac_ptp_to_mono((uint32_t)tx_active->des_next,
+                        (uint32_t)tx_active->des_buf);
+            }
+            tx_active->tx_func(tx_active->tx_arg, timestamp);
+            tx_active->tx_func = NULL;
+        }
+        tx_active->des_next = tx_active->next;
         if (tx_active->pbuf) {
             pbuf_free(tx_active->pbuf);
         }
-        tx_active = tx_active->des_next;
+        tx_active = tx_active->next;
         if (tx_active == tx_ptr) {
             /* Caught up with the head of the chain */
             tx_active = NULL;
@@ -323,6 +361,15 @@ maczero_housekeeping(void) {
 }
 
 
+void
+mac_set_tx_callback(mac_tx_func func, void *arg) {
+    /* Request a transmit timestamp for the next frame passed to
+     * maczero_transmit. Pass NULL to cancel. */
+    tx_next_func = func;
+    tx_next_arg = arg;
+}
+
+
 err_t
 maczero_transmit(struct pbuf *p, uint32_t timeout) {
     struct pbuf *q;
@@ -332,34 +379,43 @@ maczero_transmit(struct pbuf *p, uint32_t timeout) {
         while (1) {
             if (!(mac_flags & MFL_LINK)
                     || (timeout && (xTaskGetTickCount() - start) >= timeout)) {
+                tx_next_func = NULL;
                 return ERR_TIMEOUT;
             }
             maczero_housekeeping();
             if (!(tdes->des0 & STM32_TDES0_OWN)) {
-                tx_ptr = tdes->des_next;
+                tx_ptr = tdes->next;
                 break;
             }
             xSemaphoreTake(ethmac_tx_sem, timeout ? timeout : portMAX_DELAY);
         }
         tdes->des1 = q->len;
         tdes->des_buf = q->payload;
+        tdes->des_next = tdes->next;
         tdes->des0 = 0
             | STM32_TDES0_CIC(STM32_IP_CHECKSUM_OFFLOAD)
             | STM32_TDES0_IC
             | STM32_TDES0_TCH
             ;
         tdes->pbuf = NULL;
+        tdes->tx_func = NULL;
         if (q == p) {
             /* First */
             tdes->pbuf = p;
             tdes_first = tdes;
+            if (tx_next_func) {
+                tdes->des0 |= STM32_TDES0_TTSE;
+            }
         } else {
             /* Subsequent */
             tdes->des0 |= STM32_TDES0_OWN;
         }
         if (q->next == NULL) {
-            /* Last */
+            /* Last, timestamp status is reported here */
             tdes->des0 |= STM32_TDES0_LS;
+            tdes->tx_func = tx_next_func;
+            tdes->tx_arg = tx_next_arg;
+            tx_next_func = NULL;
         }
     }
     tdes_first->des0 |= STM32_TDES0_OWN | STM32_TDES0_FS;
@@ -378,48 +434,13 @@ mac_get_rx_descriptor(void) {
     if (!(mac_flags & MFL_RUN)) {
         return NULL;
     }
-    while (1) {
-        uint32_t des0 = rx_ptr->des0;
-        if (des0 & STM32_RDES0_OWN) {
-            break;
-        }
-        if (!(des0 & (STM32_RDES0_AFM | STM32_RDES0_ES)) /* Filter match, no error */
-#if STM32_IP_CHECKSUM_OFFLOAD
-                && ( !(des0 & STM32_RDES0_FT) /* Not ethernet */
-                    || !(des0 & (STM32_RDES0_IPHCE | STM32_RDES0_PCE)) ) /* FCS ok */
-#endif
-                && (des0 & STM32_RDES0_FS) && (des0 & STM32_RDES0_LS)) {
-            /* Valid frame */
-            mac_desc_t *ret = rx_ptr;
-            rx_ptr = rx_ptr->des_next;
-            ret->size = ((des0 & STM32_RDES0_FL_MASK) >> 16) - 4;
-            ret->offset = 0;
-            return ret;
-        }
-        /* Invalid frame, release it now */
-        rx_ptr->des0 = STM32_RDES0_OWN;
-        rx_ptr = rx_ptr->des_next;
-    }
-    return NULL;
-}
-
-
-uint16_t
-mac_read_rx_descriptor(mac_desc_t *rdes, uint8_t *buf, uint16_t size) {
-    if (size > rdes->size - rdes->offset) {
-        size = rdes->size - rdes->offset;
-    }
-    if (size > 0) {
-        memcpy(buf, rdes->des_buf + rdes->offset, size);
-        rdes->offset += size;
-    }
-    return size;
+    return mac_rx_poll();
 }
 
 
 void
-mac_release_rx_descriptor(mac_desc_t *rdes) {
-    rdes->des0 = STM32_RDES0_OWN;
+mac_rx_resume(void) {
+    /* Restart reception if the DMA ran out of descriptors */
     if ((ETH->DMASR & ETH_DMASR_RPS) == ETH_DMASR_RPS_Suspended) {
         ETH->DMASR   = ETH_DMASR_RBUS;
         ETH->DMARPDR = ETH_DMASR_RBUS;
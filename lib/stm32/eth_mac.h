@@ -18,21 +18,37 @@
 typedef struct mac_desc {
     volatile uint32_t des0;
     volatile uint32_t des1;
-    uint8_t *des_buf;
-    struct mac_desc *des_next;
+    /* DMA overwrites these two with the PTP timestamp of the frame */
+    uint8_t * volatile des_buf;
+    struct mac_desc * volatile des_next;
 
     uint32_t size;
     uint32_t offset;
+    /* Monotonic time at which the frame was received, or 0 if unknown */
+    uint64_t timestamp;
+    /* Nonzero if the MAC verified the IP header and UDP/TCP checksums */
+    uint8_t checked;
+    /* Saved copies of des_buf and des_next */
+    uint8_t *buf;
+    struct mac_desc *next;
 } mac_desc_t;
 
 
+typedef void (*mac_tx_func)(void *arg, uint64_t timestamp);
+
 typedef struct mac_tdes {
     volatile uint32_t des0;
     volatile uint32_t des1;
-    const void *des_buf;
-    struct mac_tdes *des_next;
+    /* DMA overwrites these two with the PTP timestamp of the frame */
+    const void * volatile des_buf;
+    struct mac_tdes * volatile des_next;
 
     struct pbuf *pbuf;
+    /* Saved copy of des_next */
+    struct mac_tdes *next;
+    /* Called with the monotonic transmit time once the frame is sent */
+    mac_tx_func tx_func;
+    void *tx_arg;
 } mac_tdes_t;
 
 void smi_write(uint32_t reg, uint32_t value);
@@ -44,9 +60,18 @@ void mac_start(void);
 void mac_stop(void);
 void mac_set_hwaddr(const uint8_t *hwaddr);
 err_t maczero_transmit(struct pbuf *p, uint32_t timeout);
+void maczero_housekeeping(void);
+void mac_set_tx_callback(mac_tx_func func, void *arg);
 mac_desc_t *mac_get_rx_descriptor(void);
 uint16_t mac_read_rx_descriptor(mac_desc_t *rdes, uint8_t *buf, uint16_t size);
+struct pbuf *mac_lend_rx_descriptor(mac_desc_t *rdes);
 void mac_release_rx_descriptor(mac_desc_t *rdes);
+uint64_t mac_ptp_to_mono(uint32_t sec, uint32_t subsec);
+
+/* Receive ring, in eth_rx.c */
+mac_desc_t *mac_rx_reset(void);
+mac_desc_t *mac_rx_poll(void);
+void mac_rx_resume(void);
 
 #define STM32_RDES0_OWN             0x80000000
 #define STM32_RDES0_AFM             0x40000000
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _ETH_PTP_H
+#define _ETH_PTP_H
+
+#include <stdint.h>
+
+/* PTP subsecond increment applied every HCLK cycle. The subsecond register
+ * rolls over into seconds at 2^31, so seconds:subseconds counts in units of
+ * 2^-31 and advances by exactly this much per cycle. */
+#define STM32_PTP_SSINC             30
+
+
+static inline uint64_t
+ptp_ticks(uint32_t sec, uint32_t subsec) {
+    /* Number of HCLK cycles represented by a PTP timestamp */
+    uint64_t units = ((uint64_t)sec << 31) | (subsec & 0x7FFFFFFF);
+    return units / STM32_PTP_SSINC;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Ethernet receive descriptor ring and buffer lending. Nothing in here touches
+ * the MAC registers; eth_mac.c provides mac_rx_resume() for that. */
+
+#include "common.h"
+#include "stm32/eth_mac.h"
+#include <stddef.h>
+#include <string.h>
+
+/* Receive buffers can be lent to the network stack as zero-copy pbufs, in
+ * which case a spare buffer takes their place in the descriptor ring. Any
+ * buffers beyond the ring size are spares. */
+#define RX_DESCS 4
+#ifndef RX_BUFS
+# define RX_BUFS 6
+#endif
+#if RX_BUFS < RX_DESCS
+# error "RX_BUFS must be at least RX_DESCS"
+#endif
+/* Frames are received ETH_PAD_SIZE bytes into the buffer, as lwIP expects */
+#define BUF_WORDS ((((MAC_BUF_SIZE + ETH_PAD_SIZE - 1) | 3) + 1) / 4)
+
+typedef struct mac_rx_buf {
+    /* Must come first, and before the data so that lwIP can restore headers */
+    struct pbuf_custom pc;
+    uint32_t data[BUF_WORDS];
+} mac_rx_buf_t;
+
+static mac_desc_t rx_descs[RX_DESCS];
+static mac_desc_t *rx_ptr;
+static mac_rx_buf_t rx_bufs[RX_BUFS];
+static mac_rx_buf_t *rx_spares[RX_BUFS - RX_DESCS + 1];
+static uint8_t rx_num_spares;
+static uint8_t rx_init;
+
+static void mac_rx_buf_free(struct pbuf *p);
+
+
+mac_desc_t *
+mac_rx_reset(void) {
+    /* Give every descriptor to the DMA and return the head of the ring */
+    int i;
+    if (!rx_init) {
+        /* Buffers stay with their descriptor across restarts since they
+         * might be lent out */
+        for (i = 0; i < RX_BUFS; i++) {
+            rx_bufs[i].pc.custom_free_function = mac_rx_buf_free;
+            if (i < RX_DESCS) {
+                rx_descs[i].buf = (uint8_t*)rx_bufs[i].data + ETH_PAD_SIZE;
+            } else {
+                rx_spares[rx_num_spares++] = &rx_bufs[i];
+            }
+        }
+        rx_init = 1;
+    }
+    for (i = 0; i < RX_DESCS; i++) {
+        rx_descs[i].des0 = STM32_RDES0_OWN;
+        rx_descs[i].des1 = STM32_RDES1_RCH | MAC_BUF_SIZE;
+        rx_descs[i].des_buf = rx_descs[i].buf;
+        rx_descs[i].des_next = rx_descs[i].next = &rx_descs[(i+1) % RX_DESCS];
+    }
+    rx_ptr = &rx_descs[0];
+    return rx_ptr;
+}
+
+
+mac_desc_t *
+mac_rx_poll(void) {
+    /* Return the next good frame from the ring, if any. Bad frames are given
+     * straight back to the DMA. */
+    while (1) {
+        uint32_t des0 = rx_ptr->des0;
+        uint32_t ts_lo, ts_hi;
+        if (des0 & STM32_RDES0_OWN) {
+            break;
+        }
+        /* Pick up the timestamp and put back the pointers it replaced */
+        ts_lo = (uint32_t)(uintptr_t)rx_ptr->des_buf;
+        ts_hi = (uint32_t)(uintptr_t)rx_ptr->des_next;
+        rx_ptr->des_buf = rx_ptr->buf;
+        rx_ptr->des_next = rx_ptr->next;
+        if (!(des0 & (STM32_RDES0_AFM | STM32_RDES0_ES)) /* Filter match, no error */
+#if STM32_IP_CHECKSUM_OFFLOAD
+                && ( !(des0 & STM32_RDES0_FT) /* Not ethernet */
+                    || !(des0 & (STM32_RDES0_IPHCE | STM32_RDES0_PCE)) ) /* FCS ok */
+#endif
+                && (des0 & STM32_RDES0_FS) && (des0 & STM32_RDES0_LS)) {
+            /* Valid frame */
+            mac_desc_t *ret = rx_ptr;
+            rx_ptr = rx_ptr->des_next;
+            ret->size = ((des0 & STM32_RDES0_FL_MASK) >> 16) - 4;
+            ret->offset = 0;
+#if STM32_IP_CHECKSUM_OFFLOAD
+            /* Frames where the MAC skipped the payload check have FT clear */
+            ret->checked = (des0 & (STM32_RDES0_FT | STM32_RDES0_IPHCE
+                        | STM32_RDES0_PCE)) == STM32_RDES0_FT;
+#else
+            ret->checked = 0;
+#endif
+            if (ts_lo == (uint32_t)(uintptr_t)ret->buf
+                    && ts_hi == (uint32_t)(uintptr_t)ret->next) {
+                /* Not timestamped */
+                ret->timestamp = 0;
+            } else {
+                ret->timestamp = mac_ptp_to_mono(ts_hi, ts_lo);
+            }
+            return ret;
+        }
+        /* Invalid frame, release it now. The DMA may have stopped for want
+         * of a descriptor, in which case this restarts it. */
+        mac_release_rx_descriptor(rx_ptr);
+        rx_ptr = rx_ptr->des_next;
+    }
+    return NULL;
+}
+
+
+uint16_t
+mac_read_rx_descriptor(mac_desc_t *rdes, uint8_t *buf, uint16_t size) {
+    if (size > rdes->size - rdes->offset) {
+        size = rdes->size - rdes->offset;
+    }
+    if (size > 0) {
+        memcpy(buf, rdes->des_buf + rdes->offset, size);
+        rdes->offset += size;
+    }
+    return size;
+}
+
+
+struct pbuf *
+mac_lend_rx_descriptor(mac_desc_t *rdes) {
+    /* Wrap the received frame in a pbuf that points directly at the DMA
+     * buffer, and give the descriptor back to the MAC with a spare buffer in
+     * its place. Returns NULL if there are no spares, in which case the
+     * descriptor still belongs to the caller. */
+    mac_rx_buf_t *rbuf, *spare = NULL;
+    uint16_t len = rdes->size + ETH_PAD_SIZE;
+    DISABLE_IRQ();
+    if (rx_num_spares > 0) {
+        spare = rx_spares[--rx_num_spares];
+    }
+    ENABLE_IRQ();
+    if (spare == NULL) {
+        return NULL;
+    }
+    rbuf = (mac_rx_buf_t*)(rdes->buf - ETH_PAD_SIZE
+            - offsetof(mac_rx_buf_t, data));
+    rdes->des_buf = rdes->buf = (uint8_t*)spare->data + ETH_PAD_SIZE;
+    mac_release_rx_descriptor(rdes);
+    return pbuf_alloced_custom(PBUF_RAW, len,
+            PBUF_POOL, &rbuf->pc, rbuf->data, sizeof(rbuf->data));
+}
+
+
+static void
+mac_rx_buf_free(struct pbuf *p) {
+    /* A lent buffer came back, keep it as a spare */
+    DISABLE_IRQ();
+    rx_spares[rx_num_spares++] = (mac_rx_buf_t*)p;
+    ENABLE_IRQ();
+}
+
+
+void
+mac_release_rx_descriptor(mac_desc_t *rdes) {
+    rdes->des0 = STM32_RDES0_OWN;
+    mac_rx_resume();
+}
@@ -29,7 +29,12 @@ serial_t Serial5;
     serial->usart->CR1 |= USART_CR1_TXEIE;
 
 
+#if USE_SERIAL_UART4
+static uint8_t uart4_rx_buf[SERIAL_DMA_RX_SIZE];
+#endif
+
 static void usart_tcie(void *param, uint32_t flags);
+static void usart_rx_dma(void *param, uint32_t flags);
 
 
 void
@@ -39,16 +44,10 @@ serial_start(serial_t *serial, int speed
 #endif
         ) {
     IRQn_Type irqn = 0;
-    ASSERT((serial->rx_q = xQueueCreate(SERIAL_RX_SIZE, 1)));
     ASSERT((serial->mutex = xSemaphoreCreateMutex()));
-#if configUSE_QUEUE_SETS
-    if (queue_set) {
-        /* Must be added to set while it's still empty */
-        xQueueAddToSet(serial->rx_q, queue_set);
-    }
-#endif
     serial->speed = speed;
     serial->tx_dma = NULL;
+    serial->rx_dma = NULL;
 #ifdef USE_SERIAL_USART1
     if (serial == &Serial1) {
         RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
@@ -63,6 +62,8 @@ serial_start(serial_t *serial, int speed
         irqn = UART4_IRQn;
         serial->usart = UART4;
         serial->tx_dma = &dma_streams[11];
+        serial->rx_dma = &dma_streams[9];
+        serial->rx_buf = uart4_rx_buf;
     } else
 #endif
 #if USE_SERIAL_UART5
@@ -75,6 +76,19 @@ serial_start(serial_t *serial, int speed
     {
         HALT();
     }
+    if (serial->rx_dma) {
+        serial->rx_q = NULL;
+        ASSERT((serial->rx_sem = xSemaphoreCreateBinary()));
+    } else {
+        ASSERT((serial->rx_q = xQueueCreate(SERIAL_RX_SIZE, 1)));
+        serial->rx_sem = NULL;
+    }
+#if configUSE_QUEUE_SETS
+    if (queue_set) {
+        /* Must be added to set while it's still empty */
+        xQueueAddToSet(serial_rx_handle(serial), queue_set);
+    }
+#endif
     NVIC_SetPriority(irqn, IRQ_PRIO_USART);
     NVIC_EnableIRQ(irqn);
     serial_set_speed(serial);
@@ -89,12 +103,38 @@ serial_start(serial_t *serial, int speed
         ASSERT((serial->tx_q = xQueueCreate(SERIAL_TX_SIZE, 1)));
         serial->tcie_sem = NULL;
     }
-    serial->usart->CR1 = 0
-        | USART_CR1_UE
-        | USART_CR1_TE
-        | USART_CR1_RE
-        | USART_CR1_RXNEIE
-        ;
+    if (serial->rx_dma) {
+        /* Receive continuously into the ring. The consumer is woken when the
+         * line goes idle after a burst, or when half the ring has filled. */
+        dma_allocate(serial->rx_dma, IRQ_PRIO_USART, usart_rx_dma, serial);
+        serial->rx_dma->ch->CPAR = (uint32_t)&serial->usart->DR;
+        serial->rx_dma->ch->CMAR = (uint32_t)serial->rx_buf;
+        serial->rx_dma->ch->CNDTR = SERIAL_DMA_RX_SIZE;
+        serial->rx_dma->ch->CCR = 0
+            | DMA_CCR1_MINC
+            | DMA_CCR1_CIRC
+            | DMA_CCR1_HTIE
+            | DMA_CCR1_TCIE
+            ;
+        serial->rx_halves = serial->rx_read = serial->rx_overruns = 0;
+        serial->rx_mark_head = serial->rx_mark_tail = serial->rx_burst = 0;
+        serial->rx_quiet = 0;
+        dma_enable(serial->rx_dma);
+        serial->usart->CR3 |= USART_CR3_DMAR;
+        serial->usart->CR1 = 0
+            | USART_CR1_UE
+            | USART_CR1_TE
+            | USART_CR1_RE
+            | USART_CR1_IDLEIE
+            ;
+    } else {
+        serial->usart->CR1 = 0
+            | USART_CR1_UE
+            | USART_CR1_TE
+            | USART_CR1_RE
+            | USART_CR1_RXNEIE
+            ;
+    }
 }
 
 
@@ -174,9 +214,50 @@ serial_drain(serial_t *serial) {
 }
 
 
+static uint32_t
+rx_written(serial_t *serial) {
+    /* Bytes written by the DMA since it started. The count of halves is read
+     * first, so the position can only be ahead of it, and it is at most one
+     * interrupt behind. */
+    uint32_t halves = serial->rx_halves;
+    uint16_t pos = SERIAL_DMA_RX_SIZE - serial->rx_dma->ch->CNDTR;
+    pos -= (halves & 1) * (SERIAL_DMA_RX_SIZE / 2);
+    return halves * (SERIAL_DMA_RX_SIZE / 2) + (pos % SERIAL_DMA_RX_SIZE);
+}
+
+
+static int
+rx_check_overrun(serial_t *serial, uint32_t written) {
+    /* If the DMA has lapped the consumer, drop everything received so far
+     * and count it */
+    if (written - serial->rx_read <= SERIAL_DMA_RX_SIZE) {
+        return 0;
+    }
+    serial->rx_read = written;
+    serial->rx_overruns++;
+    return 1;
+}
+
+
 int16_t
 serial_get(serial_t *serial, TickType_t timeout) {
     uint8_t val;
+    uint32_t written;
+    if (serial->rx_dma) {
+        while (1) {
+            written = rx_written(serial);
+            rx_check_overrun(serial, written);
+            if (written != serial->rx_read) {
+                break;
+            }
+            if (!xSemaphoreTake(serial->rx_sem, timeout)) {
+                return EERR_TIMEOUT;
+            }
+        }
+        val = serial->rx_buf[serial->rx_read % SERIAL_DMA_RX_SIZE];
+        serial_rx_consume(serial, 1);
+        return val;
+    }
     if (xQueueReceive(serial->rx_q, &val, timeout)) {
         return val;
     } else {
@@ -185,17 +266,115 @@ serial_get(serial_t *serial, TickType_t timeout) {
 }
 
 
+static void
+rx_find_burst(serial_t *serial, uint32_t *end, TickType_t *end_ticks) {
+    /* Find where the burst holding the next unread byte ends, and when. One
+     * that is still arriving ends at the present. */
+    struct serial_mark *mark;
+    DISABLE_IRQ();
+    if (serial->rx_mark_head - serial->rx_mark_tail > SERIAL_RX_MARKS) {
+        serial->rx_mark_tail = serial->rx_mark_head - SERIAL_RX_MARKS;
+    }
+    while (serial->rx_mark_tail != serial->rx_mark_head) {
+        mark = &serial->rx_marks[serial->rx_mark_tail % SERIAL_RX_MARKS];
+        if ((int32_t)(mark->end - serial->rx_read) > 0) {
+            *end = mark->end;
+            *end_ticks = mark->ticks;
+            break;
+        }
+        /* All handed out, the next byte starts a new burst */
+        serial->rx_burst = mark->end;
+        serial->rx_quiet = mark->ticks;
+        serial->rx_mark_tail++;
+    }
+    ENABLE_IRQ();
+}
+
+
+uint16_t
+serial_rx_span(serial_t *serial, const uint8_t **data, TickType_t *idle) {
+    /* Return the longest contiguous run of received bytes without blocking.
+     * The caller must pass the length to serial_rx_consume() when done. A
+     * port without receive DMA hands out one byte at a time. If data was lost
+     * since the last call, rx_overruns will have gone up.
+     *
+     * A span never crosses the end of a burst. idle is how long the line was
+     * quiet before the span, or 0 if it carries on from the previous one. */
+    uint32_t written, end;
+    TickType_t now, end_ticks, start;
+    uint16_t tail;
+    now = xTaskGetTickCount();
+    if (!serial->rx_dma) {
+        if (!xQueueReceive(serial->rx_q, &serial->rx_byte, 0)) {
+            return 0;
+        }
+        *data = &serial->rx_byte;
+        *idle = now - serial->rx_quiet;
+        serial->rx_quiet = now;
+        return 1;
+    }
+    written = rx_written(serial);
+    if (written == serial->rx_read) {
+        /* Drained. Take the wakeup before looking one last time, so anything
+         * arriving after this gives it again. */
+        xSemaphoreTake(serial->rx_sem, 0);
+        written = rx_written(serial);
+    }
+    rx_check_overrun(serial, written);
+    end = written;
+    end_ticks = now;
+    rx_find_burst(serial, &end, &end_ticks);
+    *idle = 0;
+    if (serial->rx_read == serial->rx_burst && end != serial->rx_read) {
+        /* Work back from the end of the burst to when it started */
+        start = end_ticks - (end - serial->rx_burst) * 10 * configTICK_RATE_HZ
+            / serial->speed;
+        if ((int32_t)(start - serial->rx_quiet) > 0) {
+            *idle = start - serial->rx_quiet;
+        }
+    }
+    tail = serial->rx_read % SERIAL_DMA_RX_SIZE;
+    *data = &serial->rx_buf[tail];
+    /* If it wraps, the rest comes on the next call */
+    return MIN(end - serial->rx_read, SERIAL_DMA_RX_SIZE - tail);
+}
+
+
+void
+serial_rx_consume(serial_t *serial, uint16_t len) {
+    if (serial->rx_dma) {
+        /* Check the span wasn't overwritten while it was being used */
+        if (!rx_check_overrun(serial, rx_written(serial))) {
+            serial->rx_read += len;
+        }
+    }
+}
+
+
 static void
 usart_irq(serial_t *serial) {
     USART_TypeDef *u = serial->usart;
+    struct serial_mark *mark;
     uint16_t sr, dr;
     uint8_t val;
     BaseType_t wakeup = 0;
     sr = u->SR;
-    dr = u->DR;
-
-    if ((sr & USART_SR_RXNE) && serial->rx_q) {
-        xQueueSendFromISR(serial->rx_q, &dr, &wakeup);
+    if (serial->rx_dma) {
+        /* DR belongs to the DMA, only read it to clear the idle flag */
+        if (sr & USART_SR_IDLE) {
+            dr = u->DR;
+            (void)dr;
+            mark = &serial->rx_marks[serial->rx_mark_head % SERIAL_RX_MARKS];
+            mark->end = rx_written(serial);
+            mark->ticks = xTaskGetTickCountFromISR();
+            serial->rx_mark_head++;
+            xSemaphoreGiveFromISR(serial->rx_sem, &wakeup);
+        }
+    } else {
+        dr = u->DR;
+        if ((sr & USART_SR_RXNE) && serial->rx_q) {
+            xQueueSendFromISR(serial->rx_q, &dr, &wakeup);
+        }
     }
     if (sr & USART_SR_TXE) {
         if (serial->tx_q && xQueueReceiveFromISR(serial->tx_q, &val, &wakeup)) {
@@ -219,6 +398,22 @@ usart_tcie(void *param, uint32_t flags) {
 }
 
 
+static void
+usart_rx_dma(void *param, uint32_t flags) {
+    /* Half or all of the ring has filled without the line going idle */
+    serial_t *serial = (serial_t*)param;
+    BaseType_t wakeup = 0;
+    if (flags & DMA_ISR_HTIF1) {
+        serial->rx_halves++;
+    }
+    if (flags & DMA_ISR_TCIF1) {
+        serial->rx_halves++;
+    }
+    xSemaphoreGiveFromISR(serial->rx_sem, &wakeup);
+    portEND_SWITCHING_ISR(wakeup);
+}
+
+
 #if USE_SERIAL_USART1
 void
 USART1_IRQHandler(void) {
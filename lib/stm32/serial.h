@@ -17,6 +17,17 @@
 
 #define SERIAL_TX_SIZE  16
 #define SERIAL_RX_SIZE  16
+/* Receive ring for ports that have an RX DMA channel, must be a power of 2 */
+#define SERIAL_DMA_RX_SIZE  256
+/* Ends of received bursts remembered, must be a power of 2 */
+#define SERIAL_RX_MARKS     8
+
+
+/* Where the line went idle after a burst, and when */
+struct serial_mark {
+    uint32_t            end;
+    TickType_t          ticks;
+};
 
 
 typedef struct {
@@ -26,9 +37,28 @@ typedef struct {
     /* non-DMA */
     QueueHandle_t       tx_q;
     QueueHandle_t       rx_q;
+    uint8_t             rx_byte;
     /* DMA */
     SemaphoreHandle_t   tcie_sem;
     const dma_ch_t      *tx_dma;
+    /* DMA receive: given on idle line and at each half of the ring */
+    SemaphoreHandle_t   rx_sem;
+    const dma_ch_t      *rx_dma;
+    uint8_t             *rx_buf;
+    /* Halves of the ring filled, counted by the DMA interrupt, and bytes
+     * consumed. Together with the DMA position they tell how far ahead the
+     * writer is. */
+    volatile uint32_t   rx_halves;
+    uint32_t            rx_read;
+    /* Times received data was overwritten before it was consumed */
+    uint32_t            rx_overruns;
+    /* Bursts marked by the idle line interrupt and not yet handed out, where
+     * the current one started, and when the line went quiet before it */
+    struct serial_mark  rx_marks[SERIAL_RX_MARKS];
+    volatile uint32_t   rx_mark_head;
+    uint32_t            rx_mark_tail;
+    uint32_t            rx_burst;
+    TickType_t          rx_quiet;
 } serial_t;
 
 #if USE_SERIAL_USART1
@@ -53,5 +83,11 @@ void serial_write(serial_t *serial, const char *value, uint16_t size);
 void serial_printf(serial_t *serial, const char *fmt, ...);
 void serial_drain(serial_t *serial);
 int16_t serial_get(serial_t *serial, TickType_t timeout);
+uint16_t serial_rx_span(serial_t *serial, const uint8_t **data,
+        TickType_t *idle);
+void serial_rx_consume(serial_t *serial, uint16_t len);
+/* Queue set member that signals received data */
+#define serial_rx_handle(serial) \
+    ((serial)->rx_dma ? (serial)->rx_sem : (serial)->rx_q)
 
 #endif
@@ -18,10 +18,15 @@
 #include "mii.h"
 #include "info_table.h"
 #include "init.h"
+#include "main.h"
 #include "lwip/def.h"
 #include "eeprom.h"
+#include "freertos_plat.h"
+#include "gps/ublox.h"
+#include "net/ntpauth.h"
 #include "net/tcpip.h"
 #include "uptime.h"
+#include "vtimer.h"
 #include "version.h"
 #include "util/parse.h"
 #include "cmdline/cmdline.h"
@@ -30,7 +35,9 @@
 
 static void cliDefaults(char *cmdline);
 static void cliInfo(char *cmdline);
+static void cliNtpKeys(char *cmdline);
 static void cliSave(char *cmdline);
+static void cliSurvey(char *cmdline);
 static void cliUptime(char *cmdline);
 static void cliVersion(char *cmdline);
 static void cli_cmd_fsnum(char *cmdline);
@@ -46,8 +53,10 @@ const clicmd_t cmd_table[] = {
     { "fsnum", NULL, cli_cmd_fsnum },
     { "help", "", cli_cmd_help },
     { "info", "show runtime information", cliInfo },
+    { "ntpkeys", "show keys for the NTP key ID table", cliNtpKeys },
     { "save", "save changes and reboot", cliSave },
     { "set", "name=value or blank or * for list", cli_cmd_set },
+    { "survey", "show GPS survey, or 'survey restart' to redo it", cliSurvey },
     { "uptime", "show the system uptime", cliUptime },
     { "version", "show version", cliVersion },
     { NULL },
@@ -60,6 +69,7 @@ const clivalue_t value_table[] = {
     { "gps_ext_in", VAR_FLAG, &cfg.flags, FLAG_GPSEXT },
     { "gps_ext_out", VAR_FLAG, &cfg.flags, FLAG_GPSOUT },
     { "gps_listen_port", VAR_UINT16, &cfg.gps_listen_port, 0 },
+    { "gps_survey", VAR_FLAG, &cfg.flags, FLAG_GPS_SURVEY },
     { "holdover_test", VAR_FLAG, &cfg.flags, FLAG_HOLDOVER_TEST },
     { "holdover_time", VAR_UINT32, &cfg.holdover, 0 },
 #if LWIP_IPV6
@@ -70,10 +80,21 @@ const clivalue_t value_table[] = {
     { "ip_manycast", VAR_IP4, &cfg.ip_manycast, 0 },
     { "ip_netmask", VAR_IP4, &cfg.ip_netmask, 0 },
     { "loopstats_interval", VAR_UINT16, &cfg.loopstats_interval, 0},
+    { "ntp_key1_id", VAR_UINT16, &cfg.ntp_key_ids[0], 0 },
+    { "ntp_key1_is_sha1", VAR_FLAG, &cfg.flags, FLAG_NTPKEY1_SHA1 },
+    { "ntp_key2_id", VAR_UINT16, &cfg.ntp_key_ids[1], 0 },
+    { "ntp_key2_is_sha1", VAR_FLAG, &cfg.flags, FLAG_NTPKEY2_SHA1 },
+    { "ntp_key3_id", VAR_UINT16, &cfg.ntp_key_ids[2], 0 },
+    { "ntp_key3_is_sha1", VAR_FLAG, &cfg.flags, FLAG_NTPKEY3_SHA1 },
+    { "ntp_key4_id", VAR_UINT16, &cfg.ntp_key_ids[3], 0 },
+    { "ntp_key4_is_sha1", VAR_FLAG, &cfg.flags, FLAG_NTPKEY4_SHA1 },
     { "ntp_key_is_md5", VAR_FLAG, &cfg.flags, FLAG_NTPKEY_MD5 },
     { "ntp_key_is_sha1", VAR_FLAG, &cfg.flags, FLAG_NTPKEY_SHA1 },
     { "ntp_key", VAR_HEX, &cfg.ntp_key, 20 },
+    { "pps_gen", VAR_FLAG, &cfg.flags, FLAG_PPSGEN },
     { "pps_out", VAR_FLAG, &cfg.flags, FLAG_PPSEN },
+    { "survey_accuracy", VAR_UINT16, &cfg.survey_accuracy, 0 },
+    { "survey_time", VAR_UINT16, &cfg.survey_time, 0 },
     { "syslog_ip", VAR_IP4, &cfg.syslog_ip, 0 },
     { "timescale_gps", VAR_FLAG, &cfg.flags, FLAG_TIMESCALE_GPS },
     { NULL },
@@ -108,6 +129,10 @@ cliWriteConfig(void) {
         cli_puts("WARNING: gps_ext_in and gps_ext_out are mutually exclusive.\r\n");
         cfg.flags &= ~FLAG_GPSOUT;
     }
+    if ((cfg.flags & FLAG_PPSGEN) && (cfg.flags & (FLAG_GPSEXT | FLAG_PPSEN))) {
+        cli_puts("WARNING: pps_gen can't be used with gps_ext_in or pps_out.\r\n");
+        cfg.flags &= ~FLAG_PPSGEN;
+    }
     /* Check for more than one ntpkey type */
     result = 0;
     if (cfg.flags & FLAG_NTPKEY_MD5) {
@@ -126,6 +151,7 @@ cliWriteConfig(void) {
         cli_puts("OK\r\n");
         serial_drain(cl_out);
         vTaskDelay(pdMS_TO_TICKS(1000));
+        vtimer_checkpoint_reset();
         NVIC_SystemReset();
     } else {
         show_eeprom_error(result);
@@ -143,6 +169,7 @@ cliDefaults(char *cmdline) {
 
 static void
 cliInfo(char *cmdline) {
+    unsigned load;
     cliVersion(NULL);
     cli_print_serial();
     cli_print_hwaddr();
@@ -150,6 +177,36 @@ cliInfo(char *cmdline) {
     cli_print_netif();
     cliUptime(NULL);
     cli_printf("System clock:   %d Hz (nominal)\r\n", (int)system_frequency);
+    load = cpu_load_get();
+    cli_printf("CPU load:       %u.%u%%\r\n", load / 10, load % 10);
+    cli_printf("IRQs masked:    %u %u %u %u cycles max "
+            "(second, quant, gps, save)\r\n",
+            (unsigned)vtimer_masked_max[VT_MASKED_SECOND],
+            (unsigned)vtimer_masked_max[VT_MASKED_QUANT],
+            (unsigned)vtimer_masked_max[VT_MASKED_GPS],
+            (unsigned)vtimer_masked_max[VT_MASKED_SAVE]);
+    if (gps_serial && gps_serial->rx_dma) {
+        cli_printf("GPS overruns:   %u\r\n", (unsigned)gps_serial->rx_overruns);
+    }
+}
+
+
+static void
+cliNtpKeys(char *cmdline) {
+    uint8_t secret[20];
+    int i, j;
+    for (i = 0; i < NTP_KEYS; i++) {
+        if (cfg.ntp_key_ids[i] == 0) {
+            continue;
+        }
+        ntp_key_derive(cfg.ntp_key_ids[i], secret);
+        cli_printf("%5u %s ", cfg.ntp_key_ids[i],
+                (cfg.flags & FLAG_NTPKEYn_SHA1(i)) ? "SHA1" : "MD5 ");
+        for (j = 0; j < 20; j++) {
+            cli_printf("%02x", secret[j]);
+        }
+        cli_puts("\r\n");
+    }
 }
 
 
@@ -159,6 +216,30 @@ cliSave(char *cmdline) {
 }
 
 
+static void
+cliSurvey(char *cmdline) {
+    static const char *const states[] = { "off", "surveying", "fixed" };
+    if (strcasecmp(cmdline, "restart") == 0) {
+        if (!(cfg.flags & FLAG_GPS_SURVEY) || (cfg.flags & FLAG_GPSEXT)) {
+            cli_puts("ERR: gps_survey is not enabled\r\n");
+            return;
+        }
+        ublox_survey_restart();
+    }
+    cli_printf("Survey:         %s\r\n", states[ublox_survey.state]);
+    if (ublox_survey.state == SURVEY_RUNNING) {
+        cli_printf("Duration:       %u s, %u observations\r\n",
+                (unsigned)ublox_survey.dur, (unsigned)ublox_survey.obs);
+        cli_printf("Accuracy:       %u mm\r\n", (unsigned)ublox_survey.acc);
+    }
+    if (cfg.survey_pos.acc != 0) {
+        cli_printf("Position:       %ld %ld %ld cm (ECEF), %u mm\r\n",
+                (long)cfg.survey_pos.x, (long)cfg.survey_pos.y,
+                (long)cfg.survey_pos.z, (unsigned)cfg.survey_pos.acc);
+    }
+}
+
+
 static void
 cliUptime(char *cmdline) {
     cli_puts("Uptime:         ");
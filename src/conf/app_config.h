@@ -19,6 +19,17 @@
 #define USE_SPI1                0
 #define USE_SPI3                0
 
+/* Run the PLL in fixed point instead of soft-float double (see pllfixed.c).
+ * The host tests build each variant by setting these on the command line. */
+#ifndef USE_PLL_FIXED
+#define USE_PLL_FIXED           0
+#endif
+/* Discipline the clock with a Kalman filter instead of the PLL (see
+ * pllkalman.c). Overrides USE_PLL_FIXED. */
+#ifndef USE_PLL_KALMAN
+#define USE_PLL_KALMAN          0
+#endif
+
 /* Highest priority (highest number) */
 #define THREAD_PRIO_VTIMER      4
 #define THREAD_PRIO_MAIN        3
@@ -9,6 +9,7 @@
 #include <string.h>
 #include "common.h"
 #include "task.h"
+#include "semphr.h"
 
 #include "eeprom.h"
 #include "lwip/inet_chksum.h"
@@ -18,6 +19,26 @@
 snumv2_t snum;
 cfgv2_t cfg;
 static uint8_t * const cfg_bytes = (uint8_t * const)&cfg;
+/* Serializes whole-config writes against partial updates */
+static SemaphoreHandle_t cfg_mutex;
+
+
+void
+eeprom_start(void) {
+    ASSERT((cfg_mutex = xSemaphoreCreateMutex()));
+}
+
+
+static void
+cfg_lock(void) {
+    xSemaphoreTake(cfg_mutex, portMAX_DELAY);
+}
+
+
+static void
+cfg_unlock(void) {
+    xSemaphoreGive(cfg_mutex);
+}
 
 
 static int16_t
@@ -111,6 +132,29 @@ cleanup:
     return status;
 }
 
+static uint8_t
+pllsave_check(const pllsave_t *rec) {
+    uint16_t sum = inet_chksum((void*)rec, offsetof(pllsave_t, check));
+    return ~(sum ^ (sum >> 8));
+}
+
+
+static int16_t
+eeprom_upgrade_cfg(void) {
+    /* Version 2 kept its CRC at the end and had nothing but zeroes after
+     * loopstats_interval, so it only needs the new CRC and version */
+    uint16_t crc;
+    memcpy(&crc, &cfg_bytes[CFG_V2_CRC_OFFSET], sizeof(crc));
+    if (cfg.version != 2 || inet_chksum(&cfg, CFG_V2_CRC_OFFSET) != crc) {
+        return EERR_CRCFAIL;
+    }
+    memset(&cfg_bytes[offsetof(cfgv2_t, loopstats_interval) + 2], 0,
+            CFG_SIZE - offsetof(cfgv2_t, loopstats_interval) - 2);
+    cfg.version = CFG_VERSION;
+    return eeprom_write_cfg();
+}
+
+
 int16_t
 eeprom_read_cfg(void) {
     uint8_t i;
@@ -127,8 +171,11 @@ eeprom_read_cfg(void) {
     }
     i2c_stop(EEPROM_I2C);
     /* Validate checksum of user data */
-    if (inet_chksum(&cfg, sizeof(cfg) - 2) != cfg.crc) {
-        return EERR_CRCFAIL;
+    if (inet_chksum(&cfg, CFG_CRC_SIZE) != cfg.crc) {
+        return eeprom_upgrade_cfg();
+    }
+    if (pllsave_check(&cfg.pll_save) != cfg.pll_save.check) {
+        memset(&cfg.pll_save, 0, sizeof(cfg.pll_save));
     }
     return EERR_OK;
 }
@@ -137,13 +184,93 @@ eeprom_read_cfg(void) {
 int16_t
 eeprom_write_cfg(void) {
     uint8_t addr;
-    int16_t status;
-    cfg.crc = inet_chksum(&cfg, sizeof(cfg) - 2);
-    for (addr = EEPROM_CFG_OFFSET; addr < EEPROM_SIZE; addr += EEPROM_PAGE_SIZE) {
+    int16_t status = EERR_OK;
+    cfg_lock();
+    cfg.crc = inet_chksum(&cfg, CFG_CRC_SIZE);
+    for (addr = EEPROM_CFG_OFFSET; addr < EEPROM_PLLSAVE_ADDR;
+            addr += EEPROM_PAGE_SIZE) {
         status = eeprom_write_page(addr, &cfg_bytes[addr - EEPROM_CFG_OFFSET]);
         if (status != EERR_OK) {
-            return status;
+            break;
         }
     }
-    return EERR_OK;
+    cfg_unlock();
+    return status;
+}
+
+
+int16_t
+eeprom_update_cfg(uint8_t offset, const void *data, uint8_t len) {
+    /* Replace part of the stored config. The rest is taken from the EEPROM
+     * rather than from RAM, so that unsaved changes made at the command line
+     * don't get written behind the user's back. Only pages whose contents
+     * actually change are written, to spare the EEPROM. */
+    static cfgv2_t tmp;
+    uint8_t *tmp_bytes = (uint8_t*)&tmp;
+    const uint8_t *src = data;
+    uint16_t crc, dirty = 0;
+    uint8_t i, addr;
+    int16_t status;
+    ASSERT(offset + len <= CFG_CRC_SIZE);
+    cfg_lock();
+    for (addr = EEPROM_CFG_OFFSET; addr < EEPROM_PLLSAVE_ADDR;
+            addr += EEPROM_PAGE_SIZE) {
+        status = eeprom_read(addr, &tmp_bytes[addr - EEPROM_CFG_OFFSET],
+                EEPROM_PAGE_SIZE);
+        if (status != EERR_OK) {
+            goto cleanup;
+        }
+    }
+    if (inet_chksum(&tmp, CFG_CRC_SIZE) != tmp.crc) {
+        /* Don't make a bad config look good */
+        status = EERR_CRCFAIL;
+        goto cleanup;
+    }
+    for (i = 0; i < len; i++) {
+        if (tmp_bytes[offset + i] != src[i]) {
+            tmp_bytes[offset + i] = src[i];
+            dirty |= 1 << ((EEPROM_CFG_OFFSET + offset + i) / EEPROM_PAGE_SIZE);
+        }
+    }
+    if (!dirty) {
+        status = EERR_OK;
+        goto cleanup;
+    }
+    crc = inet_chksum(&tmp, CFG_CRC_SIZE);
+    if (crc != tmp.crc) {
+        tmp.crc = crc;
+        dirty |= 1 << ((EEPROM_CFG_OFFSET + CFG_CRC_SIZE) / EEPROM_PAGE_SIZE);
+    }
+    status = EERR_OK;
+    for (addr = EEPROM_CFG_OFFSET; addr < EEPROM_PLLSAVE_ADDR;
+            addr += EEPROM_PAGE_SIZE) {
+        if (!(dirty & (1 << (addr / EEPROM_PAGE_SIZE)))) {
+            continue;
+        }
+        status = eeprom_write_page(addr, &tmp_bytes[addr - EEPROM_CFG_OFFSET]);
+        if (status != EERR_OK) {
+            break;
+        }
+    }
+cleanup:
+    cfg_unlock();
+    return status;
+}
+
+
+int16_t
+eeprom_write_pllsave(const pllsave_t *rec) {
+    /* Store the PLL state in its own page. A write torn by a power loss
+     * fails the check byte and is treated as never saved, without touching
+     * the rest of the config. */
+    pllsave_t tmp = *rec;
+    int16_t status;
+    tmp.check = pllsave_check(&tmp);
+    cfg_lock();
+    status = eeprom_write_page(EEPROM_PLLSAVE_ADDR, (const uint8_t*)&tmp);
+    if (status == EERR_OK) {
+        cfg.pll_save = tmp;
+    }
+    cfg_unlock();
+    return status;
 }
@@ -9,6 +9,7 @@
 #ifndef _EEPROM_H
 #define _EEPROM_H
 
+#include <stddef.h>
 #include "lwip/ip_addr.h"
 
 #define EEPROM_ADDR         0b1010000
@@ -18,7 +19,7 @@
 #define EEPROM_PAGES        16
 #define EEPROM_SIZE         (EEPROM_PAGES * EEPROM_PAGE_SIZE)
 
-#define CFG_VERSION         2
+#define CFG_VERSION         3
 
 #define EERR_BLANK          -20
 #define EERR_UPGRADE        -21
@@ -30,6 +31,16 @@
 #define FLAG_NTPKEY_SHA1    (1 << 4)
 #define FLAG_HOLDOVER_TEST  (1 << 5)
 #define FLAG_TIMESCALE_GPS  (1 << 6)
+#define FLAG_NTPKEY1_SHA1   (1 << 7)
+#define FLAG_NTPKEY2_SHA1   (1 << 8)
+#define FLAG_NTPKEY3_SHA1   (1 << 9)
+#define FLAG_NTPKEY4_SHA1   (1 << 10)
+#define FLAG_NTPKEYn_SHA1(n) (FLAG_NTPKEY1_SHA1 << (n))
+#define FLAG_PPSGEN         (1 << 11)
+#define FLAG_GPS_SURVEY     (1 << 12)
+
+/* Number of entries in the NTP key ID table */
+#define NTP_KEYS            4
 
 
 #pragma pack(push, 1)
@@ -41,6 +52,29 @@ typedef struct {
 } snumv2_t;
 #define EEPROM_CFG_OFFSET sizeof(snumv2_t)
 
+/* Learned PLL state, saved periodically so that a restart can re-lock quickly.
+ * It has the last page of the EEPROM to itself and its own check byte, so
+ * that saving it never rewrites the rest of the config or its CRC. */
+typedef struct {
+    /* Frequency correction in units of 2^-40 */
+    int32_t freq;
+    /* NTP seconds / 2^16 when it was saved, 0 if never */
+    uint16_t saved;
+    /* Number of times the loop had been tightened */
+    uint8_t tightened;
+    uint8_t check;
+} pllsave_t;
+#define PLLSAVE_SCALE       1099511627776.0 /* 2^40 */
+#define EEPROM_PLLSAVE_ADDR (EEPROM_SIZE - EEPROM_PAGE_SIZE)
+
+/* Antenna position found by a GPS survey-in, for fixed-position timing mode */
+typedef struct {
+    /* ECEF, cm */
+    int32_t x, y, z;
+    /* mm, 0 if no survey has completed */
+    uint16_t acc;
+} surveypos_t;
+
 /* Remainder is user-modifiable configuration */
 typedef struct {
     uint16_t version;
@@ -61,10 +95,24 @@ typedef struct {
     uint32_t ip6_manycast[4];
 #endif
     uint16_t loopstats_interval;
-    uint8_t _reserved[36];
+    /* Key IDs whose secrets are derived from ntp_key, 0 if unused */
+    uint16_t ntp_key_ids[NTP_KEYS];
+    /* Survey-in: minimum duration in seconds and target accuracy in mm, 0 for
+     * the defaults */
+    uint16_t survey_time;
+    uint16_t survey_accuracy;
+    /* Written by ublox.c with eeprom_update_cfg() when a survey completes */
+    surveypos_t survey_pos;
+    uint8_t _reserved[2];
     uint16_t crc;
+    /* Not covered by crc, see eeprom_write_pllsave() */
+    pllsave_t pll_save;
 } cfgv2_t;
 #define CFG_SIZE sizeof(cfgv2_t)
+/* Bytes covered by the config CRC */
+#define CFG_CRC_SIZE offsetof(cfgv2_t, crc)
+/* Where the CRC was in version 2, when it covered everything before it */
+#define CFG_V2_CRC_OFFSET   118
 
 #pragma pack(pop)
 
@@ -73,9 +121,12 @@ extern snumv2_t snum;
 extern cfgv2_t cfg;
 
 
+void eeprom_start(void);
 int16_t eeprom_read(const uint8_t addr, uint8_t *buf, const uint8_t len);
 int16_t eeprom_read_cfg(void);
 int16_t eeprom_write_page(uint8_t addr, const uint8_t *buf);
 int16_t eeprom_write_cfg(void);
+int16_t eeprom_update_cfg(uint8_t offset, const void *data, uint8_t len);
+int16_t eeprom_write_pllsave(const pllsave_t *rec);
 
 #endif
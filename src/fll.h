@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _FLL_H
+#define _FLL_H
+
+#include <stdint.h>
+
+/* PPS intervals averaged by the FLL before the PLL takes over */
+#define FLL_INTERVALS       8
+/* Intervals further than this from one second are not from a good PPS */
+#define FLL_MAX_ERR         500e-6
+
+/* Frequency-locked acquisition: measure the oscillator frequency from the
+ * spacing of the first few PPS captures, to seed the PLL with. Otherwise the
+ * PLL only finds the frequency from the phase, which takes minutes if it is
+ * far off. */
+struct fll {
+    uint64_t first, last;
+    /* Captures so far, or -1 when done */
+    int8_t count;
+};
+
+
+static inline void
+fll_restart(struct fll *fll) {
+    /* Measure again, e.g. after the clock was stepped */
+    if (fll->count < 0) {
+        fll->count = 0;
+    }
+}
+
+
+static inline int
+fll_feed(struct fll *fll, uint64_t capture, double ticks_per_sec,
+        double *freq) {
+    /* Take a PPS capture in monotonic ticks. Returns nonzero while still
+     * measuring. On the capture that completes the measurement, *freq is set
+     * to the frequency correction to seed the PLL with, otherwise it is left
+     * alone. */
+    double interval;
+    if (fll->count < 0) {
+        return 0;
+    }
+    if (fll->count > 0) {
+        interval = (double)(capture - fll->last) / ticks_per_sec;
+        if (interval - 1.0 > FLL_MAX_ERR || 1.0 - interval > FLL_MAX_ERR) {
+            /* Missed or extra pulse, start over */
+            fll->count = 0;
+        }
+    }
+    if (fll->count == 0) {
+        fll->first = capture;
+    }
+    fll->last = capture;
+    if (++fll->count <= FLL_INTERVALS) {
+        return 1;
+    }
+    fll->count = -1;
+    *freq = (double)FLL_INTERVALS * ticks_per_sec
+        / (double)(capture - fll->first) - 1.0;
+    return 0;
+}
+
+#endif
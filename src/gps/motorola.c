@@ -6,23 +6,14 @@
  * be found at http://opensource.org/licenses/MIT
  */
 
-#include "common.h"
+/* No RTOS or hardware headers, so that the decoders can also be built on a
+ * host against stub vtimer_set_* functions */
+#include <stdint.h>
 #include "vtimer.h"
 #include "gps/parser.h"
+#include "gps/motorola.h"
 
 
-enum mstate_e {
-    waiting = 0,
-    at1,
-    at2,
-    cmd1,
-    copying
-} mstate;
-uint8_t mremaining, mcsum;
-#define pbufSIZE        72
-uint16_t mcmd;
-uint8_t *mptr;
-
 #define MCMD_Ea         0x4561
 
 
@@ -30,69 +21,32 @@ static const char wakeup[] = "@@Ea\1\x25\r\n"
                                 "@@En\0\1\x04\x00\x02\0\0\0\0\0\0\0\0\0\0\x2c\r\n";
 
 
-uint8_t
-motorola_feed(uint8_t data) {
-    switch (mstate) {
-    case waiting:
-        if (data == '@') {
-            mstate = at1;
-            return FEED_CONTINUE;
-        }
-        return 0;
-    case at1:
-        if (data == '@') {
-            mstate = at2;
-        } else {
-            mstate = waiting;
-        }
-        return FEED_CONTINUE;
-    case at2:
-        mcmd = data;
-        mcsum = data;
-        mstate = cmd1;
-        return FEED_CONTINUE;
-    case cmd1:
-        mcmd = (mcmd << 8) | data;
-        mcsum ^= data;
-        switch (mcmd) {
-        case MCMD_Ea: mremaining = 70; break;
-        default:
-            /* Unknown command */
-            mstate = waiting;
-            return FEED_UNKNOWN;
-        }
-        if (mremaining > PBUF_SIZE) {
-            /* Packet too big */
-            mstate = waiting;
-            return FEED_UNKNOWN;
-        }
-        mstate = copying;
-        mptr = &pbuf[0];
-        return FEED_CONTINUE;
-    case copying:
-        *mptr++ = data;
-        mcsum ^= data;
-        if (--mremaining != 0) {
-            /* Still copying */
-            return FEED_CONTINUE;
-        }
-        mstate = waiting;
-        if (mcsum != 0) {
-            /* Bad checksum */
-            return FEED_UNKNOWN;
-        }
-        switch (mcmd) {
-        case MCMD_Ea:
-            /* FIXME: leap second */
-            vtimer_set_utc(
-                    (pbuf[2] << 8) | pbuf[3],   /* year */
-                    pbuf[0],                    /* month */
-                    pbuf[1],                    /* day */
-                    pbuf[4],                    /* hour */
-                    pbuf[5],                    /* minute */
-                    pbuf[6]);                   /* second */
-        }
-        return FEED_COMPLETE;
+uint16_t
+motorola_length(uint16_t cmd) {
+    /* Length of the body following the command, including the checksum, or 0
+     * if it isn't one that is used */
+    switch (cmd) {
+    case MCMD_Ea: return 70;
+    default: return 0;
+    }
+}
+
+
+void
+motorola_decode(uint8_t *frame, uint16_t len) {
+    /* frame is the command followed by its body */
+    uint16_t cmd = (frame[0] << 8) | frame[1];
+    uint8_t *body = frame + 2;
+    (void)len;
+    switch (cmd) {
+    case MCMD_Ea:
+        /* FIXME: leap second */
+        vtimer_set_utc(
+                (body[2] << 8) | body[3],   /* year */
+                body[0],                    /* month */
+                body[1],                    /* day */
+                body[4],                    /* hour */
+                body[5],                    /* minute */
+                body[6]);                   /* second */
     }
-    return FEED_UNKNOWN;
 }
@@ -9,6 +9,9 @@
 #ifndef _MOTOROLA_H
 #define _MOTOROLA_H
 
-uint8_t motorola_feed(uint8_t data);
+#include <stdint.h>
+
+uint16_t motorola_length(uint16_t cmd);
+void motorola_decode(uint8_t *frame, uint16_t len);
 
 #endif
@@ -6,22 +6,15 @@
  * be found at http://opensource.org/licenses/MIT
  */
 
-#include "common.h"
-#include "task.h"
-
+/* No RTOS or hardware headers, so that the decoders can also be built on a
+ * host against stub vtimer_set_* functions */
+#include <stdint.h>
 #include "vtimer.h"
 #include "gps/parser.h"
+#include "gps/nmea.h"
 #include "util/parse.h"
 #include <string.h>
 
-static uint8_t rx_count, rx_cksum;
-static enum {
-    WAITING,
-    COPYING,
-    CHECKSUM1,
-    CHECKSUM2
-} rx_state;
-
 /* In order of least to most preferred */
 typedef enum {
     NONE,
@@ -30,88 +23,50 @@ typedef enum {
     GPZDA
 } stype_t;
 static stype_t seen_type;
-static TickType_t seen_time;
+static uint32_t seen_time;
 
 
 static uint8_t
 use_sentence(stype_t type) {
     /* Ignore RMC if a ZDA was seen recently */
     if (type < seen_type &&
-            (xTaskGetTickCount() - seen_time) < PARSER_TIMEOUT) {
+            gps_rx_ms - seen_time < PARSER_TIMEOUT_MS) {
         return 0;
     }
     seen_type = type;
-    seen_time = xTaskGetTickCount();
+    seen_time = gps_rx_ms;
     return 1;
 }
 
 
-uint8_t
-nmea_feed(uint8_t val) {
+void
+nmea_decode(uint8_t *frame, uint16_t len) {
+    /* frame is the sentence between '$' and the checksum, terminated */
     int16_t year;
     uint8_t hour, minute, second, day, month;
     char *ptr;
-    if (val == '$') {
-        rx_state = COPYING;
-        rx_count = 0;
-        rx_cksum = 0;
-        return FEED_CONTINUE;
-    }
-    switch (rx_state) {
-    case WAITING:
-        return FEED_UNKNOWN;
-    case COPYING:
-        if (val == '*') {
-            rx_state = CHECKSUM1;
-            return FEED_CONTINUE;
-        } else if (val == '\r' || val == '\n') {
-            /* Sentence complete (no checksum) */
-            break;
-        } else {
-            if (rx_count >= sizeof(pbuf) - 1) {
-                rx_state = WAITING;
-                return FEED_UNKNOWN;
-            }
-            pbuf[rx_count++] = val;
-            rx_cksum ^= val;
-            return FEED_CONTINUE;
-        }
-    case CHECKSUM1:
-        rx_cksum ^= (parse_hex(val) << 4);
-        rx_state = CHECKSUM2;
-        return FEED_CONTINUE;
-    case CHECKSUM2:
-        rx_cksum ^= parse_hex(val);
-        rx_state = WAITING;
-        if (rx_cksum != 0) {
-            return FEED_UNKNOWN;
-        }
-        /* Sentence complete (checksum valid) */
-        break;
-    }
-    pbuf[rx_count] = 0;
-
+    (void)len;
     /* Parse the finished sentence */
     /* Type */
-    if ((ptr = strtok_s((char*)pbuf, ',')) == NULL) {
-        return FEED_COMPLETE;
+    if ((ptr = strtok_s((char*)frame, ',')) == NULL) {
+        return;
     }
 
     if (strcmp(ptr, "GPZDA") == 0 && use_sentence(GPZDA)) {
         /* Time of day */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if (strlen(ptr) < 6) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if (strlen(ptr) < 6) { return; }
         hour = atoi_2dig(&ptr[0]);
         minute = atoi_2dig(&ptr[2]);
         second = atoi_2dig(&ptr[4]);
         /* Day */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
         day = atoi_decimal(ptr);
         /* Month */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
         month = atoi_decimal(ptr);
         /* Year */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
         year = atoi_decimal(ptr);
         /* Leap second support for NMEA will never be feasible :( */
         vtimer_set_utc(
@@ -124,22 +79,22 @@ nmea_feed(uint8_t val) {
 
     } else if (strcmp(ptr, "GPRMC") == 0 && use_sentence(GPRMC)) {
         /* Time of day */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if (strlen(ptr) < 6) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if (strlen(ptr) < 6) { return; }
         hour = atoi_2dig(&ptr[0]);
         minute = atoi_2dig(&ptr[2]);
         second = atoi_2dig(&ptr[4]);
         /* Skip some stuff */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
         /* Datestamp */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if (strlen(ptr) < 6) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if (strlen(ptr) < 6) { return; }
         day = atoi_2dig(&ptr[0]);
         month = atoi_2dig(&ptr[2]);
         year = atoi_2dig(&ptr[4]);
@@ -159,11 +114,11 @@ nmea_feed(uint8_t val) {
 
     } else if (strcmp(ptr, "PGRMF") == 0 && use_sentence(PGRMF)) {
         /* Skip some stuff */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
         /* Datestamp */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if (strlen(ptr) < 6) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if (strlen(ptr) < 6) { return; }
         day = atoi_2dig(&ptr[0]);
         month = atoi_2dig(&ptr[2]);
         year = atoi_2dig(&ptr[4]);
@@ -173,8 +128,8 @@ nmea_feed(uint8_t val) {
             year += 2100;
         }
         /* Time of day */
-        if ((ptr = strtok_s(NULL, ',')) == NULL) { return FEED_COMPLETE; }
-        if (strlen(ptr) < 6) { return FEED_COMPLETE; }
+        if ((ptr = strtok_s(NULL, ',')) == NULL) { return; }
+        if (strlen(ptr) < 6) { return; }
         hour = atoi_2dig(&ptr[0]);
         minute = atoi_2dig(&ptr[2]);
         second = atoi_2dig(&ptr[4]);
@@ -186,6 +141,4 @@ nmea_feed(uint8_t val) {
                 minute,     /* minute */
                 second);    /* second */
     }
-    return FEED_COMPLETE;
 }
-
@@ -9,6 +9,8 @@
 #ifndef _NMEA_H
 #define _NMEA_H
 
-uint8_t nmea_feed(uint8_t data);
+#include <stdint.h>
+
+void nmea_decode(uint8_t *frame, uint16_t len);
 
 #endif
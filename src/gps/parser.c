@@ -6,71 +6,397 @@
  * be found at http://opensource.org/licenses/MIT
  */
 
+/* Framing for every protocol the GPS might speak. Received spans are scanned
+ * for the start of a packet, whole packets are collected in pbuf with their
+ * framing and checksums checked, and each one is handed to its protocol's
+ * decoder. The first protocol to start a packet locks out the others until a
+ * packet completes or the line goes quiet. */
+
 #include "common.h"
 #include "task.h"
 
 #include "net/relay.h"
-#include "ppscapture.h"
 #include "gps/motorola.h"
 #include "gps/nmea.h"
 #include "gps/parser.h"
 #include "gps/tsip.h"
 #include "gps/ublox.h"
+#include "util/parse.h"
+#include <string.h>
+
+#define DLE     0x10
+#define ETX     0x03
+/* Longest u-blox payload believed, anything longer is taken as noise */
+#define UBX_MAX_LEN     2048
 
 uint8_t pbuf[PBUF_SIZE];
 int gps_fix_svs;
+uint32_t gps_rx_ms;
 
+static TickType_t time_last_packet;
 static uint8_t current_proto, last_proto;
-static uint64_t time_last_byte, time_last_packet;
-static const struct parserdecl *parser;
 
-const struct parserdecl {
+/* Packet being collected. count is how much of it is in pbuf and need how
+ * much is still to come, where the protocol says. */
+static const struct protocol *framing;
+static uint8_t fstate, fck1, fck2;
+static uint16_t fcount, fneed;
+
+/* Return values of the framers */
+#define FRAME_MORE      0
+#define FRAME_DONE      1
+#define FRAME_BAD       2
+
+struct protocol {
     uint8_t proto;
-    uint8_t (*func)(uint8_t);
-} parsers[] = {
-    {PROTO_UBLOX, ublox_feed},
-    {PROTO_TSIP, tsip_feed},
-    {PROTO_ONCORE, motorola_feed},
-    {PROTO_NMEA, nmea_feed},
-    {0, NULL}};
+    /* Takes bytes following the sync byte, returns how many it used */
+    uint16_t (*frame)(const uint8_t *data, uint16_t len, uint8_t *rc);
+    void (*decode)(uint8_t *frame, uint16_t len);
+};
 
+static uint16_t frame_ubx(const uint8_t *data, uint16_t len, uint8_t *rc);
+static uint16_t frame_tsip(const uint8_t *data, uint16_t len, uint8_t *rc);
+static uint16_t frame_oncore(const uint8_t *data, uint16_t len, uint8_t *rc);
+static uint16_t frame_nmea(const uint8_t *data, uint16_t len, uint8_t *rc);
 
-void
-gps_byte_received(uint8_t data) {
-    uint8_t rc;
-    if (xTaskGetTickCount() - time_last_byte >= PACKET_TIMEOUT) {
+static const struct protocol protocols[] = {
+    [PROTO_UBLOX] = {PROTO_UBLOX, frame_ubx, ublox_decode},
+    [PROTO_TSIP] = {PROTO_TSIP, frame_tsip, tsip_decode},
+    [PROTO_ONCORE] = {PROTO_ONCORE, frame_oncore, motorola_decode},
+    [PROTO_NMEA] = {PROTO_NMEA, frame_nmea, nmea_decode},
+};
+
+/* The protocol whose packets start with each byte value. Between packets
+ * anything else is skipped. */
+static const uint8_t sync_table[256] = {
+    [0xB5] = PROTO_UBLOX,
+    [DLE] = PROTO_TSIP,
+    ['@'] = PROTO_ONCORE,
+    ['$'] = PROTO_NMEA,
+};
+
+
+/* u-blox: 0xB5 0x62, class, ID, 16-bit length, payload, two checksum bytes.
+ * pbuf gets class through payload. A packet too big for pbuf is still
+ * followed to its end so that its payload isn't mistaken for a new one. */
+enum { UBX_SYNC2, UBX_HEADER, UBX_PAYLOAD, UBX_CK1, UBX_CK2 };
+
+static uint16_t
+frame_ubx(const uint8_t *data, uint16_t len, uint8_t *rc) {
+    const uint8_t *p = data, *end = data + len;
+    uint8_t ck1 = fck1, ck2 = fck2, val;
+    uint16_t n;
+    *rc = FRAME_MORE;
+    while (p < end) {
+        switch (fstate) {
+        case UBX_SYNC2:
+            if (*p++ != 0x62) {
+                *rc = FRAME_BAD;
+                return p - data;
+            }
+            ck1 = ck2 = 0;
+            fcount = 0;
+            fstate = UBX_HEADER;
+            break;
+        case UBX_HEADER:
+            val = pbuf[fcount++] = *p++;
+            ck1 += val;
+            ck2 += ck1;
+            if (fcount == 4) {
+                fneed = (pbuf[3] << 8) | pbuf[2];
+                if (fneed > UBX_MAX_LEN) {
+                    *rc = FRAME_BAD;
+                    return p - data;
+                }
+                fstate = fneed ? UBX_PAYLOAD : UBX_CK1;
+            }
+            break;
+        case UBX_PAYLOAD:
+            n = MIN(fneed, end - p);
+            fneed -= n;
+            while (n--) {
+                val = *p++;
+                if (fcount < PBUF_SIZE) {
+                    pbuf[fcount++] = val;
+                } else {
+                    /* Too big to keep, remember that it was */
+                    fcount = PBUF_SIZE + 1;
+                }
+                ck1 += val;
+                ck2 += ck1;
+            }
+            if (!fneed) {
+                fstate = UBX_CK1;
+            }
+            break;
+        case UBX_CK1:
+            if (*p++ != ck1) {
+                *rc = FRAME_BAD;
+                return p - data;
+            }
+            fstate = UBX_CK2;
+            break;
+        case UBX_CK2:
+            *rc = *p++ == ck2 ? FRAME_DONE : FRAME_BAD;
+            return p - data;
+        }
+    }
+    fck1 = ck1;
+    fck2 = ck2;
+    return p - data;
+}
+
+
+/* TSIP: DLE, ID, data with any DLE doubled, DLE, ETX. pbuf gets all of it
+ * except the doubling. fneed counts DLEs, so it is odd inside the data and
+ * even right after a DLE that isn't doubled. */
+static uint16_t
+frame_tsip(const uint8_t *data, uint16_t len, uint8_t *rc) {
+    const uint8_t *p = data, *end = data + len, *dle;
+    uint16_t n;
+    uint8_t val;
+    *rc = FRAME_MORE;
+    if (fstate == 0) {
+        pbuf[0] = DLE;
+        fcount = fneed = 1;
+        fstate = 1;
+    }
+    while (p < end) {
+        if (fneed % 2) {
+            /* Inside the data, copy up to the next DLE */
+            dle = memchr(p, DLE, end - p);
+            n = (dle ? dle : end) - p;
+            if (n > PBUF_SIZE - fcount) {
+                /* Too big, give up at the first byte that doesn't fit */
+                *rc = FRAME_BAD;
+                return p - data + PBUF_SIZE - fcount + 1;
+            }
+            memcpy(&pbuf[fcount], p, n);
+            fcount += n;
+            p += n;
+            if (p == end) {
+                break;
+            }
+        }
+        val = *p++;
+        if (val == DLE && ++fneed > 2 && fneed % 2) {
+            /* Second of a doubled DLE */
+            continue;
+        }
+        if (fcount >= PBUF_SIZE) {
+            *rc = FRAME_BAD;
+            return p - data;
+        }
+        pbuf[fcount++] = val;
+        if (val == ETX && fneed % 2 == 0) {
+            *rc = FRAME_DONE;
+            return p - data;
+        }
+    }
+    return p - data;
+}
+
+
+/* Oncore: "@@", two command letters, a fixed length body for that command
+ * ending in an XOR checksum, CR LF. pbuf gets the command and body. The
+ * CR LF is left for the search to skip. */
+enum { ONC_AT2 = 0, ONC_CMD1, ONC_CMD2, ONC_BODY };
+
+static uint16_t
+frame_oncore(const uint8_t *data, uint16_t len, uint8_t *rc) {
+    const uint8_t *p = data, *end = data + len;
+    uint16_t n;
+    *rc = FRAME_MORE;
+    while (p < end) {
+        switch (fstate) {
+        case ONC_AT2:
+            if (*p++ != '@') {
+                *rc = FRAME_BAD;
+                return p - data;
+            }
+            fstate = ONC_CMD1;
+            break;
+        case ONC_CMD1:
+            pbuf[0] = fck1 = *p++;
+            fstate = ONC_CMD2;
+            break;
+        case ONC_CMD2:
+            pbuf[1] = *p++;
+            fck1 ^= pbuf[1];
+            fneed = motorola_length((pbuf[0] << 8) | pbuf[1]);
+            if (fneed == 0 || fneed > PBUF_SIZE - 2) {
+                /* Unknown command, or too big */
+                *rc = FRAME_BAD;
+                return p - data;
+            }
+            fcount = 2;
+            fstate = ONC_BODY;
+            break;
+        case ONC_BODY:
+            n = MIN(fneed, end - p);
+            memcpy(&pbuf[fcount], p, n);
+            fcount += n;
+            fneed -= n;
+            while (n--) {
+                fck1 ^= *p++;
+            }
+            if (!fneed) {
+                *rc = fck1 == 0 ? FRAME_DONE : FRAME_BAD;
+                return p - data;
+            }
+            break;
+        }
+    }
+    return p - data;
+}
+
+
+/* NMEA: '$', the sentence, optionally '*' and two hex digits of XOR
+ * checksum, CR LF. A '$' anywhere starts over. pbuf gets the sentence,
+ * terminated. */
+enum { NMEA_COPY = 0, NMEA_CK1, NMEA_CK2 };
+
+static uint16_t
+frame_nmea(const uint8_t *data, uint16_t len, uint8_t *rc) {
+    const uint8_t *p = data, *end = data + len;
+    uint8_t val, ck = fck1;
+    *rc = FRAME_MORE;
+    while (p < end) {
+        if (fstate == NMEA_COPY) {
+            /* Copy up to the next character that means something */
+            while (p < end && *p != '$' && *p != '*' && *p != '\r'
+                    && *p != '\n') {
+                if (fcount >= PBUF_SIZE - 1) {
+                    *rc = FRAME_BAD;
+                    return p - data + 1;
+                }
+                ck ^= pbuf[fcount++] = *p++;
+            }
+            if (p == end) {
+                break;
+            }
+        }
+        val = *p++;
+        if (val == '$') {
+            fstate = NMEA_COPY;
+            fcount = 0;
+            ck = 0;
+            continue;
+        }
+        switch (fstate) {
+        case NMEA_COPY:
+            if (val == '*') {
+                fstate = NMEA_CK1;
+                continue;
+            }
+            /* No checksum */
+            *rc = FRAME_DONE;
+            break;
+        case NMEA_CK1:
+            ck ^= parse_hex(val) << 4;
+            fstate = NMEA_CK2;
+            continue;
+        case NMEA_CK2:
+            ck ^= parse_hex(val);
+            *rc = ck == 0 ? FRAME_DONE : FRAME_BAD;
+            break;
+        }
+        pbuf[fcount] = 0;
+        return p - data;
+    }
+    fck1 = ck;
+    return p - data;
+}
+
+
+static void
+gps_reset_parsers(void) {
+    framing = NULL;
+    current_proto = PROTO_NONE;
+}
+
+
+static void
+gps_check_timeouts(TickType_t idle) {
+    TickType_t now = xTaskGetTickCount();
+    gps_rx_ms = now * portTICK_PERIOD_MS;
+    if (idle >= pdMS_TO_TICKS(PACKET_TIMEOUT_MS)) {
         /* Clear the current parser if there is an interpacket gap. */
-        current_proto = PROTO_NONE;
+        gps_reset_parsers();
         /* Flush the broadcast buffer */
         relay_flush();
     }
-    time_last_byte = xTaskGetTickCount();
-    relay_push(data);
 
-    if (xTaskGetTickCount() - time_last_packet > PARSER_TIMEOUT) {
+    if (now - time_last_packet > pdMS_TO_TICKS(PARSER_TIMEOUT_MS)) {
         /* Clear out the parser state if nothing is recognized for
-         * a few seconds
+         * a few seconds. A packet already started is left to finish.
          */
-        current_proto = PROTO_NONE;
+        if (!framing) {
+            current_proto = PROTO_NONE;
+        }
         last_proto = PROTO_NONE;
         gps_fix_svs = 0;
     }
-    for (parser = &parsers[0]; parser->func; parser++) {
-        if (current_proto != PROTO_NONE && current_proto != parser->proto) {
+}
+
+
+void
+gps_rx_lost(void) {
+    /* Received data was dropped, so whatever packet was in progress can't be
+     * trusted. Start looking for the next one. */
+    gps_reset_parsers();
+    relay_flush();
+}
+
+
+void
+gps_bytes_received(const uint8_t *data, uint16_t len, uint32_t idle) {
+    uint16_t n;
+    uint8_t proto, rc;
+    if (len == 0) {
+        return;
+    }
+    gps_check_timeouts(idle);
+    while (len) {
+        if (!framing) {
+            /* Between packets, skip to the next byte that could start one.
+             * Once a protocol has been seen, only it is looked for. */
+            for (n = 0; n < len; n++) {
+                proto = sync_table[data[n]];
+                if (proto && (current_proto == PROTO_NONE
+                            || current_proto == proto)) {
+                    break;
+                }
+            }
+            if (n < len) {
+                current_proto = proto;
+                framing = &protocols[proto];
+                fstate = fck1 = fck2 = 0;
+                fcount = 0;
+                n++;
+            }
+            relay_write(data, n);
+            data += n;
+            len -= n;
             continue;
         }
-        rc = parser->func(data);
-        if (rc == FEED_CONTINUE) {
-            /* Lock out all other parsers */
-            current_proto = parser->proto;
-            break;
-        } else if (rc == FEED_COMPLETE) {
+        n = framing->frame(data, len, &rc);
+        relay_write(data, n);
+        data += n;
+        len -= n;
+        if (rc == FRAME_DONE) {
+            if (fcount <= PBUF_SIZE) {
+                framing->decode(pbuf, fcount);
+            }
             /* Go back to search mode */
+            last_proto = current_proto;
             current_proto = PROTO_NONE;
-            last_proto = parser->proto;
+            framing = NULL;
             time_last_packet = xTaskGetTickCount();
             relay_flush();
-            break;
+        } else if (rc == FRAME_BAD) {
+            /* Keep to the same protocol */
+            framing = NULL;
         }
     }
 }
@@ -9,8 +9,11 @@
 #ifndef _GPS_PARSER_H
 #define _GPS_PARSER_H
 
-#define PACKET_TIMEOUT      pdMS_TO_TICKS(50)
-#define PARSER_TIMEOUT      pdMS_TO_TICKS(5000)
+#include <stdint.h>
+
+/* In milliseconds, so that the decoders don't need the RTOS headers */
+#define PACKET_TIMEOUT_MS   50
+#define PARSER_TIMEOUT_MS   5000
 
 /* Protocols that might be detected */
 #define PROTO_NONE      0
@@ -20,16 +23,15 @@
 #define PROTO_ONCORE    4
 #define PROTO_UBLOX     5
 
-/* Status codes for feed_* return */
-#define FEED_UNKNOWN        0
-#define FEED_CONTINUE       1
-#define FEED_COMPLETE       2
-
 #define PBUF_SIZE           128
 extern uint8_t pbuf[PBUF_SIZE];
 
 extern int gps_fix_svs;
+/* Milliseconds clock when the data being parsed arrived */
+extern uint32_t gps_rx_ms;
 
-void gps_byte_received(uint8_t data);
+/* idle is how many ticks the line was quiet before the data arrived */
+void gps_bytes_received(const uint8_t *data, uint16_t len, uint32_t idle);
+void gps_rx_lost(void);
 
 #endif
@@ -6,15 +6,12 @@
  * be found at http://opensource.org/licenses/MIT
  */
 
-#include "common.h"
-#include "task.h"
-
+/* No RTOS or hardware headers, so that the decoders can also be built on a
+ * host against stub vtimer_set_* functions */
+#include <stdint.h>
 #include "vtimer.h"
 #include "gps/parser.h"
-
-static uint8_t rx_count;
-static uint8_t rx_dle_count;
-static uint64_t rx_last_tick;
+#include "gps/tsip.h"
 
 /* Packet 0x8F-AB */
 #define TFLAG_UTC           0x01
@@ -39,51 +36,23 @@ set_quant(uint8_t *qf) {
 }
 
 
-uint8_t
-tsip_feed(uint8_t val) {
-    if (xTaskGetTickCount() - rx_last_tick > PACKET_TIMEOUT) {
-        // No bytes for 50ms, assume synchronization was lost somehow
-        rx_count = rx_dle_count = 0;
-    }
-    rx_last_tick = xTaskGetTickCount();
-
-    if (val == 0x10) {
-        // "DLE" token
-        rx_dle_count++;
-        if (rx_dle_count > 2 && rx_dle_count % 2 == 1) {
-            // Doubled-up (stuffed) DLE in the data part
-            return FEED_CONTINUE;
+void
+tsip_decode(uint8_t *frame, uint16_t len) {
+    /* frame is the whole packet with the DLE stuffing removed */
+    if (len >= 19 && frame[1] == 0x8f && frame[2] == 0xab) {
+        if (frame[11] & (TFLAG_NO_TIME | TFLAG_NO_UTC)) {
+            /* Time is incomplete */
+            return;
         }
-    } else if (rx_dle_count == 0) {
-        // No start of packet seen yet, wait for DLE
-        return FEED_UNKNOWN;
+        /* FIXME: leap second */
+        vtimer_set_utc(
+                (frame[17] << 8) | frame[18],   /* year */
+                frame[16],                      /* month */
+                frame[15],                      /* day */
+                frame[14],                      /* hour */
+                frame[13],                      /* minute */
+                frame[12]);                     /* second */
+    } else if (len > 65 && frame[1] == 0x8f && frame[2] == 0xac) {
+        set_quant(&frame[62]);
     }
-    if (rx_count >= sizeof(pbuf)) {
-        rx_count = rx_dle_count = 0;
-        return FEED_UNKNOWN;
-    }
-    pbuf[rx_count++] = val;
-    if (val == 0x03 && rx_dle_count % 2 == 0) {
-        // End of packet
-        if (rx_count >= 19 && pbuf[1] == 0x8f && pbuf[2] == 0xab) {
-            if (pbuf[11] & (TFLAG_NO_TIME | TFLAG_NO_UTC)) {
-                /* Time is incomplete */
-                return FEED_COMPLETE;
-            }
-            /* FIXME: leap second */
-            vtimer_set_utc(
-                    (pbuf[17] << 8) | pbuf[18], /* year */
-                    pbuf[16],                       /* month */
-                    pbuf[15],                       /* day */
-                    pbuf[14],                       /* hour */
-                    pbuf[13],                       /* minute */
-                    pbuf[12]);                      /* second */
-        } else if (rx_count > 65 && pbuf[1] == 0x8f && pbuf[2] == 0xac) {
-            set_quant(&pbuf[62]);
-        }
-        rx_count = rx_dle_count = 0;
-        return FEED_COMPLETE;
-    }
-    return FEED_CONTINUE;
 }
-
@@ -9,6 +9,8 @@
 #ifndef _TSIP_H
 #define _TSIP_H
 
-uint8_t tsip_feed(uint8_t data);
+#include <stdint.h>
+
+void tsip_decode(uint8_t *frame, uint16_t len);
 
 #endif
@@ -10,35 +10,25 @@
 #include "task.h"
 
 #include "gps/ublox.h"
-#include "cmdline.h"
 #include "eeprom.h"
 #include "logging.h"
 #include "main.h"
 #include "vtimer.h"
 #include "gps/parser.h"
 #include "stm32/serial.h"
+#include <math.h>
+#include <stddef.h>
 #include <string.h>
 
-#define FEED_UNKNOWN 0
-#define FEED_CONTINUE 1
-#define FEED_COMPLETE 2
-
-static enum {
-    WAITING,
-    SYNC,
-    HEADER,
-    COPYING,
-    CHECKSUM1,
-    CHECKSUM2
-} ustate;
-
 static const uint8_t ublox_cfg[] = {
     /*  msg   | interval */
     0x01, 0x06, 0x01, /* NAV-SOL */
+    0x01, 0x07, 0x01, /* NAV-PVT */
     0x01, 0x12, 0x00, /* NAV-VELNED */
     0x01, 0x20, 0x05, /* NAV-TIMEGPS */
     0x01, 0x21, 0x01, /* NAV-TIMEUTC */
     0x0D, 0x01, 0x01, /* TIM-TP */
+    0x0D, 0x04, 0x01, /* TIM-SVIN */
 };
 
 
@@ -48,6 +38,44 @@ static const uint8_t ublox_startup[] = {
 static const uint8_t ublox_hui_req[] = {
     0xB5, 0x62, 0x0B, 0x02, 0x00, 0x00, 0x0D, 0x32,
 };
+/* CFG-VALSET for receivers that no longer take the legacy messages. Older
+ * ones reject it, newer ones still accept most of the above. */
+static const uint8_t ublox_valset[] = {
+    0x00, 0x01, 0x00, 0x00,         /* version 0, RAM layer */
+    /*  key                 | value */
+    0x07, 0x00, 0x91, 0x20, 0x01,   /* CFG-MSGOUT-UBX_NAV_PVT_UART1 */
+    0x48, 0x00, 0x91, 0x20, 0x05,   /* CFG-MSGOUT-UBX_NAV_TIMEGPS_UART1 */
+    0x5C, 0x00, 0x91, 0x20, 0x01,   /* CFG-MSGOUT-UBX_NAV_TIMEUTC_UART1 */
+    0x7E, 0x01, 0x91, 0x20, 0x01,   /* CFG-MSGOUT-UBX_TIM_TP_UART1 */
+    0x98, 0x00, 0x91, 0x20, 0x01,   /* CFG-MSGOUT-UBX_TIM_SVIN_UART1 */
+    0x21, 0x00, 0x11, 0x20, 0x02,   /* CFG-NAVSPG-DYNMODEL: stationary */
+    0x0C, 0x00, 0x05, 0x20, 0x00,   /* CFG-TP-TIMEGRID_TP1: UTC */
+};
+#define VALSET_TIMEGRID     (sizeof(ublox_valset) - 1)
+
+/* CFG-VALSET keys for timing mode */
+#define KEY_TMODE_MODE      0x20030001
+#define KEY_TMODE_POS_TYPE  0x20030002
+#define KEY_TMODE_ECEF_X    0x40030003
+#define KEY_TMODE_ECEF_Y    0x40030004
+#define KEY_TMODE_ECEF_Z    0x40030005
+#define KEY_TMODE_FIXED_ACC 0x4003000F
+#define KEY_TMODE_SVIN_DUR  0x40030010
+#define KEY_TMODE_SVIN_ACC  0x40030011
+
+/* Survey-in defaults: at least an hour, and down to a metre */
+#define SURVEY_TIME_DEFAULT     3600
+#define SURVEY_ACC_DEFAULT      1000
+
+/* Largest payload sent by ublox_send() */
+#define UBX_MAX_PAYLOAD     64
+/* Whether the last NAV-PVT had a complete, valid time */
+static uint8_t pvt_ok;
+
+survey_status_t ublox_survey;
+
+static void ublox_set_tmode(uint8_t mode);
+
 static const uint8_t ublox_cfg5[] = {
     0xB5, 0x62, 0x06, 0x24, 0x24, 0x00, 0x07, 0x00,
     0x02, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -58,122 +86,245 @@ static const uint8_t ublox_cfg5[] = {
 
 
 static void
-set_quant_ubx(uint8_t *qf) {
-    int32_t picoseconds = *(int32_t*)qf;
-    float corr = -picoseconds * (1 / 1e12);
-    vtimer_set_correction(corr, LEADING);
+ublox_tim_tp(const tim_tp_t *msg) {
+    /* TIM-TP describes the next pulse. If its time base is the one we serve,
+     * tell vtimer which second that pulse is, otherwise just pass on the
+     * quantization error. */
+    float corr = 0.0f;
+    uint8_t match;
+    if (!(msg->flags & TIMTP_QERR_INVALID)) {
+        corr = -msg->qErr * (1 / 1e12);
+    }
+    if (cfg.flags & FLAG_TIMESCALE_GPS) {
+        /* GNSS time base, and that GNSS is GPS */
+        match = !(msg->flags & TIMTP_TIMEBASE_UTC)
+            && (msg->refInfo & 0x0F) == 0;
+    } else {
+        match = (msg->flags & TIMTP_TIMEBASE_UTC)
+            && (msg->flags & TIMTP_UTC);
+    }
+    if (match && pvt_ok && msg->towMS % 1000 == 0) {
+        vtimer_set_next_pps(msg->week, msg->towMS / 1000, corr);
+    } else {
+        vtimer_set_correction(corr, LEADING);
+    }
 }
 
 
-uint8_t
-ublox_feed(uint8_t val) {
-    static uint8_t rx_count, rx_ck1, rx_ck2;
-    static uint16_t rx_pktlen;
-    static uint64_t last_hui;
+static void
+ublox_tim_svin(const tim_svin_t *msg) {
+    /* Track the survey, and keep the position once it's done. The receiver
+     * switches itself to fixed mode at that point. */
+    surveypos_t pos;
+    float acc;
+    if (ublox_survey.state == SURVEY_OFF) {
+        return;
+    }
+    acc = sqrtf((float)msg->meanV);
+    ublox_survey.dur = msg->dur;
+    ublox_survey.obs = msg->obs;
+    ublox_survey.acc = (uint32_t)acc;
+    if (msg->active || !msg->valid || ublox_survey.state != SURVEY_RUNNING) {
+        return;
+    }
+    pos.x = msg->meanX;
+    pos.y = msg->meanY;
+    pos.z = msg->meanZ;
+    pos.acc = acc < 1 ? 1 : (acc > UINT16_MAX ? UINT16_MAX : (uint16_t)acc);
+    ublox_survey.state = SURVEY_FIXED;
+    if (eeprom_update_cfg(offsetof(cfgv2_t, survey_pos), &pos, sizeof(pos))
+            == EERR_OK) {
+        cfg.survey_pos = pos;
+        log_write(LOG_NOTICE, "gps", "Survey complete after %u s, accuracy %u mm",
+                (unsigned)msg->dur, (unsigned)pos.acc);
+    } else {
+        log_write(LOG_ERR, "gps", "Survey complete but could not be saved");
+    }
+}
+
 
-    switch (ustate) {
-    case WAITING:
-        if (val == 0xB5) {
-            ustate = SYNC;
-            return FEED_CONTINUE;
-        }
-        break;
-    case SYNC:
-        if (val == 0x62) {
-            rx_count = 0;
-            rx_ck1 = 0;
-            rx_ck2 = 0;
-            ustate = HEADER;
-            return FEED_CONTINUE;
-        }
-        break;
-    case HEADER:
-        pbuf[rx_count++] = val;
-        rx_ck1 += (uint8_t)val;
-        rx_ck2 += rx_ck1;
-        if (rx_count >= 4) {
-            rx_pktlen = ((pbuf[3] << 8) | pbuf[2]) + 4;
-            if (rx_count >= rx_pktlen) {
-                ustate = CHECKSUM1;
-            } else {
-                ustate = COPYING;
-            }
-        }
-        return FEED_CONTINUE;
-    case COPYING:
-        if (rx_count >= sizeof(pbuf)) {
-            break;
-        }
-        pbuf[rx_count++] = val;
-        rx_ck1 += (uint8_t)val;
-        rx_ck2 += rx_ck1;
-        if (rx_count >= rx_pktlen) {
-            ustate = CHECKSUM1;
-        }
-        return FEED_CONTINUE;
-    case CHECKSUM1:
-        if (rx_ck1 != val) {
-            break;
-        }
-        ustate = CHECKSUM2;
-        return FEED_CONTINUE;
-    case CHECKSUM2:
-        if (rx_ck2 != val) {
-            break;
+void
+ublox_decode(uint8_t *frame, uint16_t len) {
+    /* frame is the class, ID, length and payload of a packet whose checksum
+     * was good */
+    if (frame[0] == 0x01 && frame[1] == 0x06 && len >= 4+52) {
+        /* NAV-SOL */
+        gps_fix_svs = frame[4+47];
+    } else if (frame[0] == 0x01 && frame[1] == 0x07 && len >= 4+92) {
+        /* NAV-PVT */
+        nav_pvt_t *msg = (nav_pvt_t *)frame;
+        gps_fix_svs = msg->numSV;
+        pvt_ok = (msg->flags & PVT_GNSSFIXOK)
+            && (msg->valid & PVT_VALIDDATE)
+            && (msg->valid & PVT_VALIDTIME)
+            && (msg->valid & PVT_FULLYRESOLVED);
+    } else if (frame[0] == 0x01 && frame[1] == 0x20 && len >= 4+16) {
+        /* NAV-TIMEGPS */
+        nav_timegps_t *msg = (nav_timegps_t *)frame;
+        if ((cfg.flags & FLAG_TIMESCALE_GPS)
+                && (msg->valid & TIMEUTC_VALIDWKN)
+                && (msg->valid & TIMEUTC_VALIDTOW)) {
+            vtimer_set_gps(msg->week, msg->iTOW / 1000);
         }
-        ustate = WAITING;
-        if (pbuf[0] == 0x01 && pbuf[1] == 0x06 && rx_count >= 4+52) {
-            /* NAV-SOL */
-            gps_fix_svs = pbuf[4+47];
-        } else if (pbuf[0] == 0x01 && pbuf[1] == 0x20 && rx_count >= 4+16) {
-            /* NAV-TIMEGPS */
-            nav_timegps_t *msg = (nav_timegps_t *)pbuf;
-            if ((cfg.flags & FLAG_TIMESCALE_GPS)
-                    && (msg->valid & TIMEUTC_VALIDWKN)
-                    && (msg->valid & TIMEUTC_VALIDTOW)) {
-                vtimer_set_gps(msg->week, msg->iTOW / 1000);
-            }
-        } else if (pbuf[0] == 0x01 && pbuf[1] == 0x21 && rx_count >= 4+20) {
-            /* NAV-TIMEUTC */
-            nav_timeutc_t *msg = (nav_timeutc_t *)pbuf;
-            if (!(cfg.flags & FLAG_TIMESCALE_GPS)
-                    && (msg->valid & TIMEUTC_VALIDUTC)) {
-                /* FIXME: leap second */
-                vtimer_set_utc(msg->year, msg->month, msg->day, msg->hour,
-                        msg->min, msg->sec);
-            }
-        } else if (pbuf[0] == 0x0B && pbuf[1] == 0x02 && rx_count >= 4+72) {
-            /* AID-HUI */
-        } else if (pbuf[0] == 0x0D && pbuf[1] == 0x01 && rx_count >= 4+16) {
-            /* TIM-TP */
-            set_quant_ubx(&pbuf[4+8]);
+    } else if (frame[0] == 0x01 && frame[1] == 0x21 && len >= 4+20) {
+        /* NAV-TIMEUTC */
+        nav_timeutc_t *msg = (nav_timeutc_t *)frame;
+        if (!(cfg.flags & FLAG_TIMESCALE_GPS)
+                && (msg->valid & TIMEUTC_VALIDUTC)) {
+            /* FIXME: leap second */
+            vtimer_set_utc(msg->year, msg->month, msg->day, msg->hour,
+                    msg->min, msg->sec);
         }
-        return FEED_COMPLETE;
+    } else if (frame[0] == 0x0B && frame[1] == 0x02 && len >= 4+72) {
+        /* AID-HUI */
+    } else if (frame[0] == 0x0D && frame[1] == 0x01 && len >= 4+16) {
+        /* TIM-TP */
+        ublox_tim_tp((tim_tp_t *)frame);
+    } else if (frame[0] == 0x0D && frame[1] == 0x04 && len >= 4+28) {
+        /* TIM-SVIN */
+        ublox_tim_svin((tim_svin_t *)frame);
+    }
+}
+
+
+static void
+ublox_send(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload,
+        uint16_t len) {
+    uint8_t buf[8 + UBX_MAX_PAYLOAD], ck1, ck2;
+    uint16_t i;
+    ASSERT(len <= UBX_MAX_PAYLOAD);
+    buf[0] = 0xB5;
+    buf[1] = 0x62;
+    buf[2] = msg_class;
+    buf[3] = msg_id;
+    buf[4] = len & 0xFF;
+    buf[5] = len >> 8;
+    memcpy(&buf[6], payload, len);
+    ck1 = ck2 = 0;
+    for (i = 2; i < 6 + len; i++) {
+        ck1 += buf[i];
+        ck2 += ck1;
     }
-    ustate = WAITING;
-    return FEED_UNKNOWN;
+    buf[6 + len] = ck1;
+    buf[7 + len] = ck2;
+    serial_write(gps_serial, (const char *)buf, 8 + len);
 }
 
 
 void
 ublox_configure(void) {
-    static const uint8_t ublox_template[] = { 0xB5, 0x62, 0x06, 0x01, 0x08, 0x00 };
     const uint8_t *x;
-    uint8_t buf[16], ck1, ck2, i;
-    memset(buf, 0, 14);
-    memcpy(buf, ublox_template, 6);
+    uint8_t buf[UBX_MAX_PAYLOAD];
+    memset(buf, 0, 8);
     for (x = ublox_cfg; x < ublox_cfg + sizeof(ublox_cfg); x += 3) {
-        buf[6] = x[0];
-        buf[7] = x[1];
-        buf[9] = x[2];
-        ck1 = ck2 = 0;
-        for (i = 2; i < 14; i++) {
-            ck1 += buf[i];
-            ck2 += ck1;
-        }
-        buf[14] = ck1;
-        buf[15] = ck2;
-        serial_write(gps_serial, (const char *)buf, 16);
+        /* CFG-MSG */
+        buf[0] = x[0];
+        buf[1] = x[1];
+        buf[3] = x[2];
+        ublox_send(0x06, 0x01, buf, 8);
     }
     serial_write(gps_serial, (const char *)ublox_cfg5, sizeof(ublox_cfg5));
+
+    /* CFG-VALSET. Put the time pulse on the grid of the timescale we serve
+     * so TIM-TP can label it. */
+    memcpy(buf, ublox_valset, sizeof(ublox_valset));
+    buf[VALSET_TIMEGRID] = (cfg.flags & FLAG_TIMESCALE_GPS) ? 1 : 0;
+    ublox_send(0x06, 0x8A, buf, sizeof(ublox_valset));
+
+    if (!(cfg.flags & FLAG_GPS_SURVEY)) {
+        /* Undo anything left over from before a reset */
+        ublox_survey.state = SURVEY_OFF;
+        ublox_set_tmode(TMODE_DISABLED);
+    } else if (cfg.survey_pos.acc != 0) {
+        ublox_survey.state = SURVEY_FIXED;
+        ublox_survey.acc = cfg.survey_pos.acc;
+        ublox_set_tmode(TMODE_FIXED);
+    } else {
+        ublox_survey.state = SURVEY_RUNNING;
+        ublox_set_tmode(TMODE_SURVEY_IN);
+    }
+}
+
+
+static uint8_t *
+valset_put(uint8_t *ptr, uint32_t key, uint32_t value) {
+    /* Value size is in bits 28-30 of the key: 2 for one byte, 4 for four */
+    uint8_t size = ((key >> 28) & 7) == 4 ? 4 : 1;
+    memcpy(ptr, &key, 4);
+    memcpy(ptr + 4, &value, size);
+    return ptr + 4 + size;
+}
+
+
+static void
+ublox_set_tmode(uint8_t mode) {
+    /* Send the timing mode in all three forms. Each receiver rejects the ones
+     * it doesn't know: TMODE2 is for the 6T, TMODE3 for the M8T and VALSET
+     * for the F9T. */
+    uint8_t buf[UBX_MAX_PAYLOAD], *ptr;
+    cfg_tmode2_t *tm2 = (cfg_tmode2_t *)buf;
+    cfg_tmode3_t *tm3 = (cfg_tmode3_t *)buf;
+    uint32_t dur, limit;
+    const surveypos_t *pos = &cfg.survey_pos;
+    dur = cfg.survey_time ? cfg.survey_time : SURVEY_TIME_DEFAULT;
+    limit = cfg.survey_accuracy ? cfg.survey_accuracy : SURVEY_ACC_DEFAULT;
+
+    memset(buf, 0, sizeof(*tm2));
+    tm2->timeMode = mode;
+    tm2->svinMinDur = dur;
+    tm2->svinAccLimit = limit;
+    if (mode == TMODE_FIXED) {
+        tm2->ecefX = pos->x;
+        tm2->ecefY = pos->y;
+        tm2->ecefZ = pos->z;
+        tm2->fixedPosAcc = pos->acc;
+    }
+    ublox_send(0x06, 0x3D, buf, sizeof(*tm2));
+
+    memset(buf, 0, sizeof(*tm3));
+    tm3->flags = mode;
+    tm3->svinMinDur = dur;
+    tm3->svinAccLimit = limit * 10;
+    if (mode == TMODE_FIXED) {
+        tm3->ecefX = pos->x;
+        tm3->ecefY = pos->y;
+        tm3->ecefZ = pos->z;
+        tm3->fixedPosAcc = pos->acc * 10;
+    }
+    ublox_send(0x06, 0x71, buf, sizeof(*tm3));
+
+    buf[0] = 0;     /* version */
+    buf[1] = 0x01;  /* RAM layer */
+    buf[2] = buf[3] = 0;
+    ptr = &buf[4];
+    ptr = valset_put(ptr, KEY_TMODE_MODE, mode);
+    ptr = valset_put(ptr, KEY_TMODE_POS_TYPE, 0);
+    if (mode == TMODE_FIXED) {
+        ptr = valset_put(ptr, KEY_TMODE_ECEF_X, pos->x);
+        ptr = valset_put(ptr, KEY_TMODE_ECEF_Y, pos->y);
+        ptr = valset_put(ptr, KEY_TMODE_ECEF_Z, pos->z);
+        ptr = valset_put(ptr, KEY_TMODE_FIXED_ACC, pos->acc * 10);
+    } else {
+        ptr = valset_put(ptr, KEY_TMODE_SVIN_DUR, dur);
+        ptr = valset_put(ptr, KEY_TMODE_SVIN_ACC, limit * 10);
+    }
+    ublox_send(0x06, 0x8A, buf, ptr - buf);
+}
+
+
+void
+ublox_survey_restart(void) {
+    /* Forget the saved position and survey again */
+    surveypos_t pos;
+    int16_t rc;
+    memset(&pos, 0, sizeof(pos));
+    rc = eeprom_update_cfg(offsetof(cfgv2_t, survey_pos), &pos, sizeof(pos));
+    if (rc == EERR_OK) {
+        cfg.survey_pos = pos;
+    }
+    memset(&ublox_survey, 0, sizeof(ublox_survey));
+    ublox_survey.state = SURVEY_RUNNING;
+    /* Drop out of fixed mode first, or the receiver ignores the new survey */
+    ublox_set_tmode(TMODE_DISABLED);
+    ublox_set_tmode(TMODE_SURVEY_IN);
 }
@@ -11,14 +11,40 @@
 
 #include "stm32/serial.h"
 
-uint8_t ublox_feed(uint8_t data);
+void ublox_decode(uint8_t *frame, uint16_t len);
 void ublox_configure(void);
+void ublox_survey_restart(void);
+
+/* Survey-in progress, for the CLI and SNMP */
+#define SURVEY_OFF              0
+#define SURVEY_RUNNING          1
+#define SURVEY_FIXED            2
+
+typedef struct {
+    uint8_t state;
+    /* Seconds and observations so far, and current accuracy in mm */
+    uint32_t dur, obs, acc;
+} survey_status_t;
+extern survey_status_t ublox_survey;
 
 /* applicable to both NAV-TIMEUTC and NAV-TIMEGPS */
 #define TIMEUTC_VALIDTOW        0x01
 #define TIMEUTC_VALIDWKN        0x02
 #define TIMEUTC_VALIDUTC        0x04
 
+#define TIMTP_TIMEBASE_UTC      0x01
+#define TIMTP_UTC               0x02
+#define TIMTP_QERR_INVALID      0x10
+
+#define PVT_VALIDDATE           0x01
+#define PVT_VALIDTIME           0x02
+#define PVT_FULLYRESOLVED       0x04
+#define PVT_GNSSFIXOK           0x01
+
+#define TMODE_DISABLED          0
+#define TMODE_SURVEY_IN         1
+#define TMODE_FIXED             2
+
 #pragma pack(push,1)
 
 typedef struct {
@@ -42,6 +68,53 @@ typedef struct {
     uint8_t valid;
 } nav_timeutc_t;
 
+typedef struct {
+    uint16_t msgid, length;
+    uint32_t iTOW;
+    uint16_t year;
+    uint8_t month, day;
+    uint8_t hour, min, sec;
+    uint8_t valid;
+    uint32_t tAcc;
+    int32_t nano;
+    uint8_t fixType, flags, flags2, numSV;
+} nav_pvt_t;
+
+typedef struct {
+    uint16_t msgid, length;
+    uint32_t towMS, towSubMS;
+    int32_t qErr;
+    uint16_t week;
+    uint8_t flags, refInfo;
+} tim_tp_t;
+
+typedef struct {
+    uint16_t msgid, length;
+    uint32_t dur;
+    int32_t meanX, meanY, meanZ;
+    uint32_t meanV, obs;
+    uint8_t valid, active;
+} tim_svin_t;
+
+/* CFG-TMODE2 (6T), accuracies in mm */
+typedef struct {
+    uint8_t timeMode, reserved1;
+    uint16_t flags;
+    int32_t ecefX, ecefY, ecefZ;
+    uint32_t fixedPosAcc, svinMinDur, svinAccLimit;
+} cfg_tmode2_t;
+
+/* CFG-TMODE3 (M8T), accuracies in 0.1mm */
+typedef struct {
+    uint8_t version, reserved1;
+    uint16_t flags;
+    int32_t ecefX, ecefY, ecefZ;
+    int8_t ecefXHP, ecefYHP, ecefZHP;
+    uint8_t reserved2;
+    uint32_t fixedPosAcc, svinMinDur, svinAccLimit;
+    uint8_t reserved3[8];
+} cfg_tmode3_t;
+
 #pragma pack(pop)
 
 #endif
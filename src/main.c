@@ -11,6 +11,7 @@
 
 #include "cmdline.h"
 #include "eeprom.h"
+#include "freertos_plat.h"
 #include "gps/parser.h"
 #include "gps/ublox.h"
 #include "info_table.h"
@@ -50,6 +51,7 @@ const info_entry_t app_table[] = {
 static void
 load_eeprom(void) {
     int16_t rc;
+    eeprom_start();
     rc = eeprom_read_cfg();
     if (rc != EERR_OK) {
         memset(&cfg, 0, sizeof(cfg));
@@ -79,6 +81,28 @@ log_startup(void) {
 }
 
 
+static void
+gps_receive(void) {
+    static uint32_t overruns;
+    const uint8_t *data;
+    uint16_t len;
+    TickType_t idle;
+    /* Take everything that has arrived, a contiguous chunk at a time. Each
+     * chunk is within one burst, so gaps between packets aren't missed. */
+    while ((len = serial_rx_span(gps_serial, &data, &idle)) != 0) {
+        if (gps_serial->rx_overruns != overruns) {
+            overruns = gps_serial->rx_overruns;
+            gps_rx_lost();
+        }
+        gps_bytes_received(data, len, idle);
+        if (cfg.flags & FLAG_GPSOUT) {
+            serial_write(&Serial5, (const char *)data, len);
+        }
+        serial_rx_consume(gps_serial, len);
+    }
+}
+
+
 static void
 main_thread(void *pdata) {
     QueueSetHandle_t qs;
@@ -124,20 +148,15 @@ main_thread(void *pdata) {
             int16_t val = serial_get(cli_serial, TIMEOUT_NOBLOCK);
             ASSERT(val >= 0);
             cli_feed(val);
-        } else if (active == gps_serial->rx_q) {
-            int16_t val = serial_get(gps_serial, TIMEOUT_NOBLOCK);
-            ASSERT(val >= 0);
-            gps_byte_received(val);
-            if (cfg.flags & FLAG_GPSOUT) {
-                char tmp = val;
-                serial_write(&Serial5, &tmp, 1);
-            }
+        } else if (active == serial_rx_handle(gps_serial)) {
+            gps_receive();
 #if 0
         } else if (active == Serial5.rx_q) {
             char tmp = serial_get(&Serial5, TIMEOUT_NOBLOCK);
             serial_write(&Serial4, &tmp, 1);
 #endif
         }
+        vtimer_save_deferred();
     }
 }
 
@@ -150,6 +169,7 @@ main(void) {
     setup_clocks((int)info_get(boot_table, INFO_HSE_FREQ));
     iwdg_start(4, 0xFFF);
     watchdog_main = watchdog_net = 5;
+    cpu_load_start();
     ASSERT(xTaskCreate(main_thread, "main", MAIN_STACK_SIZE, NULL,
                 THREAD_PRIO_MAIN, &thread_main));
     vTaskStartScheduler();
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _MONOTONIC_H
+#define _MONOTONIC_H
+
+/* The parts of the monotonic clock and PPS capture that don't touch the
+ * hardware, so that they can be tested on a host. See ppscapture.c. */
+
+#include <stdint.h>
+#include "misc_macros.h"
+
+/* Period of the low half */
+#define MONO_PERIOD 65536
+/* Period of the whole hardware count */
+#define MONO_WRAP   (1ULL << 32)
+/* Ticks after the low half wraps before the high half is sure to follow */
+#define MONO_SLAVE_LAG 8
+/* PPS captures kept for the PLL thread, must be a power of 2 */
+#define PPS_RING 8
+/* PPS output compares are set up this long before the edge */
+#define PPSGEN_LEAD (MONO_PERIOD / 2)
+/* Ticks needed between deciding to arm an output compare and its match */
+#define PPSGEN_MARGIN 64
+
+typedef struct {
+    /* Monotonic time of the edge */
+    uint64_t mono;
+    /* Counts every edge, starting from 1 */
+    uint32_t seq;
+    /* Monotonic ticks since the previous edge, UINT32_MAX if unknown */
+    uint32_t interval;
+    /* Timer channel it was captured on */
+    uint8_t channel;
+} pps_capture_t;
+
+/* PPS captures, written by the interrupt and read by the PLL thread. head is
+ * the sequence number of the newest one, and entries are stored at
+ * (seq % PPS_RING). */
+struct pps_ring {
+    pps_capture_t slot[PPS_RING];
+    volatile uint32_t head;
+    uint32_t tail;
+    uint64_t last;
+};
+
+
+#ifdef MONO_HI
+/* The includer defines how to get at the hardware:
+ *   MONO_HI()          high half count
+ *   MONO_LO()          low half count
+ *   MONO_UIF()         nonzero if the high half rolled over
+ *   MONO_UIF_CLEAR()   acknowledge that
+ */
+static inline uint64_t
+mono_read_hw(volatile uint64_t *epoch, uint16_t *lo) {
+    /* Read the whole monotonic clock, with interrupts masked or from one of
+     * the timer interrupts. Also returns the low half that was read. */
+    uint16_t hi1, hi2, tmr;
+    while (1) {
+        if (MONO_UIF()) {
+            /* High half rolled over, process the update event now */
+            MONO_UIF_CLEAR();
+            *epoch += MONO_WRAP;
+        }
+        hi1 = MONO_HI();
+        tmr = MONO_LO();
+        hi2 = MONO_HI();
+        /* The high half ticks a couple of cycles after the low half wraps.
+         * Reading it on both sides catches a wrap in between, and a low half
+         * that only just wrapped is read again once the high half caught
+         * up. */
+        if (hi1 == hi2 && tmr >= MONO_SLAVE_LAG && !MONO_UIF()) {
+            break;
+        }
+    }
+    *lo = tmr;
+    return *epoch + (((uint32_t)hi1 << 16) | tmr);
+}
+#endif
+
+
+static inline uint64_t
+mono_from_capture(uint64_t now, uint16_t lo, uint16_t ccr) {
+    /* Only the low half is captured. Count back from the present, which is
+     * less than one low period later. */
+    return now - (uint16_t)(lo - ccr);
+}
+
+
+static inline int
+ppsgen_in_time(uint64_t now, uint64_t when) {
+    /* Nonzero if an output compare armed now will match on the edge at the
+     * given time. Too late and it would match a low period after it, too
+     * early and a low period before. */
+    return when >= now + PPSGEN_MARGIN && when - now < MONO_PERIOD;
+}
+
+
+static inline void
+pps_ring_put(struct pps_ring *ring, uint64_t mono, uint8_t channel) {
+    /* Add a capture. Called from the interrupt only. */
+    uint32_t seq = ring->head + 1;
+    pps_capture_t *cap = &ring->slot[seq % PPS_RING];
+    cap->mono = mono;
+    cap->seq = seq;
+    cap->channel = channel;
+    if (ring->last == 0 || mono - ring->last > UINT32_MAX) {
+        cap->interval = UINT32_MAX;
+    } else {
+        cap->interval = mono - ring->last;
+    }
+    ring->last = mono;
+    BARRIER();
+    ring->head = seq;
+}
+
+
+static inline int
+pps_ring_get(struct pps_ring *ring, pps_capture_t *cap, uint32_t *dropped) {
+    /* Get the oldest capture not yet seen, returns 0 if there are none.
+     * Captures that were overwritten before they could be read are added to
+     * dropped. Only one task may call this. */
+    uint32_t head, seq;
+    while (1) {
+        head = ring->head;
+        if (ring->tail == head) {
+            return 0;
+        }
+        if (head - ring->tail > PPS_RING) {
+            *dropped += head - ring->tail - PPS_RING;
+            ring->tail = head - PPS_RING;
+        }
+        seq = ring->tail + 1;
+        BARRIER();
+        *cap = ring->slot[seq % PPS_RING];
+        BARRIER();
+        if (ring->head - seq < PPS_RING) {
+            /* Not overwritten while copying */
+            ring->tail = seq;
+            return 1;
+        }
+    }
+}
+
+#endif
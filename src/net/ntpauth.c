@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include "eeprom.h"
+#include "net/ntpauth.h"
+#include <string.h>
+
+
+/* Legacy single key, accepted with any key ID */
+static struct ntp_key_state legacy_key;
+/* Per-ID keys from cfg.ntp_key_ids. If any are configured then only these IDs
+ * are accepted. */
+static struct ntp_key_state id_keys[NTP_KEYS];
+static uint8_t num_id_keys;
+
+
+void
+ntp_key_init(struct ntp_key_state *key, const uint8_t *secret, int is_sha1) {
+    if (is_sha1) {
+        SHA1_Init(&key->ctx.sha);
+        SHA1_Update(&key->ctx.sha, secret, 20);
+        key->digest_len = 20;
+    } else {
+        MD5_Init(&key->ctx.md5);
+        MD5_Update(&key->ctx.md5, secret, 20);
+        key->digest_len = 16;
+    }
+}
+
+
+void
+ntp_key_derive(uint32_t key_id, uint8_t *secret) {
+    /* Secrets for the key ID table are derived from the master ntp_key and the
+     * key ID as sent on the wire, so that the table fits in the EEPROM */
+    SHA_CTX sha;
+    uint8_t id_bytes[4];
+    id_bytes[0] = key_id >> 24;
+    id_bytes[1] = key_id >> 16;
+    id_bytes[2] = key_id >> 8;
+    id_bytes[3] = key_id;
+    SHA1_Init(&sha);
+    SHA1_Update(&sha, &cfg.ntp_key, 20);
+    SHA1_Update(&sha, id_bytes, 4);
+    SHA1_Final(secret, &sha);
+}
+
+
+void
+ntp_auth_init(void) {
+    uint8_t secret[20];
+    int i;
+    legacy_key.digest_len = 0;
+    if (cfg.flags & FLAG_NTPKEY_SHA1) {
+        ntp_key_init(&legacy_key, cfg.ntp_key, 1);
+    } else if (cfg.flags & FLAG_NTPKEY_MD5) {
+        ntp_key_init(&legacy_key, cfg.ntp_key, 0);
+    }
+    num_id_keys = 0;
+    for (i = 0; i < NTP_KEYS; i++) {
+        struct ntp_key_state *key = &id_keys[num_id_keys];
+        if (cfg.ntp_key_ids[i] == 0) {
+            continue;
+        }
+        ntp_key_derive(cfg.ntp_key_ids[i], secret);
+        ntp_key_init(key, secret,
+                cfg.flags & FLAG_NTPKEYn_SHA1(i));
+        key->key_id = cfg.ntp_key_ids[i];
+        num_id_keys++;
+    }
+    memset(secret, 0, sizeof(secret));
+}
+
+
+const struct ntp_key_state *
+ntp_auth_lookup(uint32_t key_id) {
+    /* With no key ID table the single ntp_key answers to any ID, as it did
+     * before there was a table (see doc/config.rst). The table is at most
+     * NTP_KEYS entries, so it is just scanned. */
+    int i;
+    if (num_id_keys == 0) {
+        return legacy_key.digest_len ? &legacy_key : NULL;
+    }
+    for (i = 0; i < num_id_keys; i++) {
+        if (id_keys[i].key_id == key_id) {
+            return &id_keys[i];
+        }
+    }
+    return NULL;
+}
+
+
+void
+ntp_auth_digest(const struct ntp_key_state *key, const void *msg,
+        uint8_t *md) {
+    /* Compute the digest of the 48-byte header using the precomputed key
+     * state */
+    if (key->digest_len == 20) {
+        SHA_CTX sha = key->ctx.sha;
+        SHA1_Update(&sha, msg, NTP_HEADER_SIZE);
+        SHA1_Final(md, &sha);
+    } else {
+        MD5_CTX md5 = key->ctx.md5;
+        MD5_Update(&md5, msg, NTP_HEADER_SIZE);
+        MD5_Final(md, &md5);
+    }
+}
+
+
+uint16_t
+ntp_auth_check(const uint8_t *msg, uint16_t len,
+        const struct ntp_key_state **key) {
+    /* Check the MAC on a request and decide how big the reply will be: the
+     * bare header if there is no MAC or no key at all, a crypto-NAK if the key
+     * ID is unknown or the MAC doesn't check out, or the same size as the
+     * request if it is to be authenticated with *key. */
+    const struct ntp_key_state *found;
+    const uint8_t *p = msg + NTP_HEADER_SIZE;
+    uint8_t md[20];
+    *key = NULL;
+    if (len < NTP_HEADER_SIZE + NTP_KEYID_SIZE) {
+        return NTP_HEADER_SIZE;
+    }
+    found = ntp_auth_lookup(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+            | ((uint32_t)p[2] << 8) | p[3]);
+    if (found == NULL) {
+        /* Unknown key ID gets a crypto-NAK, unless there are no keys */
+        return num_id_keys ? NTP_NAK_SIZE : NTP_HEADER_SIZE;
+    }
+    if (len == NTP_NAK_SIZE + found->digest_len) {
+        ntp_auth_digest(found, msg, md);
+        if (!memcmp(md, p + NTP_KEYID_SIZE, found->digest_len)) {
+            *key = found;
+            return len;
+        }
+    }
+    /* Known key but the MAC is wrong or the wrong size */
+    return NTP_NAK_SIZE;
+}
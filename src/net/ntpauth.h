@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _NTPAUTH_H
+#define _NTPAUTH_H
+
+#include <stdint.h>
+#include "crypto/md5.h"
+#include "crypto/sha.h"
+
+/* Part of an NTP message covered by the MAC, and the key ID that follows */
+#define NTP_HEADER_SIZE     48
+#define NTP_KEYID_SIZE      4
+/* Reply size for a crypto-NAK: just the header and a zero key ID */
+#define NTP_NAK_SIZE        (NTP_HEADER_SIZE + NTP_KEYID_SIZE)
+
+/* Hash state after absorbing a key. Cloned for each authenticated packet
+ * instead of re-keying from scratch. */
+struct ntp_key_state {
+    uint32_t key_id;
+    uint8_t digest_len;
+    union {
+        SHA_CTX sha;
+        MD5_CTX md5;
+    } ctx;
+};
+
+void ntp_auth_init(void);
+void ntp_key_init(struct ntp_key_state *key, const uint8_t *secret, int is_sha1);
+void ntp_key_derive(uint32_t key_id, uint8_t *secret);
+const struct ntp_key_state *ntp_auth_lookup(uint32_t key_id);
+void ntp_auth_digest(const struct ntp_key_state *key, const void *msg,
+        uint8_t *md);
+uint16_t ntp_auth_check(const uint8_t *msg, uint16_t len,
+        const struct ntp_key_state **key);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Header checks for the NTP fast path, on the raw frame so that they don't
+ * depend on lwIP and can be tested on the host */
+
+#include "net/ntpfast.h"
+#include "net/ntpserver.h"
+
+#define ETH_HLEN        14
+#define ETH_TYPE_IP     0x0800
+#define ETH_TYPE_IPV6   0x86DD
+#define IP4_HLEN        20
+#define IP6_HLEN        40
+#define IP_PROTO_UDP    17
+#define UDP_HLEN        8
+#define NTP_MIN_LEN     48
+
+#define GET16(p)        (((uint16_t)(p)[0] << 8) | (p)[1])
+
+
+static uint32_t
+csum_add(uint32_t sum, const uint8_t *p, uint16_t len) {
+    /* One's complement sum of big-endian 16-bit words, unfolded */
+    while (len > 1) {
+        sum += GET16(p);
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += (uint16_t)p[0] << 8;
+    }
+    return sum;
+}
+
+
+static uint16_t
+csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+
+int
+ntp_fast_parse(const uint8_t *frame, uint16_t len, int checked,
+        struct ntp_fast_frame *ff) {
+    /* Pick out an unfragmented UDP datagram for the NTP port with no IP
+     * options or extension headers. Unless the MAC already checked them
+     * (checked is nonzero), the IPv4 header checksum and the UDP checksum are
+     * verified here. Returns 0 if the frame is anything else, in which case
+     * it should go to lwIP. */
+    const uint8_t *ip = frame + ETH_HLEN, *udp;
+    uint16_t ip_len, udp_len, udp_sum;
+    uint32_t sum;
+
+    if (len < ETH_HLEN + IP4_HLEN + UDP_HLEN + NTP_MIN_LEN) {
+        return 0;
+    }
+    switch (GET16(frame + 12)) {
+    case ETH_TYPE_IP:
+        if (ip[0] != 0x45
+                || (GET16(ip + 6) & 0x3FFF) /* MF or fragment offset */
+                || ip[9] != IP_PROTO_UDP) {
+            return 0;
+        }
+        ip_len = GET16(ip + 2);
+        if (ip_len < IP4_HLEN || ETH_HLEN + ip_len > len) {
+            return 0;
+        }
+        if (!checked && csum_fold(csum_add(0, ip, IP4_HLEN)) != 0xFFFF) {
+            return 0;
+        }
+        ff->is_ipv6 = 0;
+        ff->hlen = ETH_HLEN + IP4_HLEN;
+        ff->src = ip + 12;
+        ff->dst = ip + 16;
+        /* Pseudo-header: addresses, protocol and UDP length */
+        sum = csum_add(0, ip + 12, 8) + IP_PROTO_UDP;
+        break;
+    case ETH_TYPE_IPV6:
+        if (len < ETH_HLEN + IP6_HLEN + UDP_HLEN + NTP_MIN_LEN
+                || (ip[0] >> 4) != 6
+                || ip[6] != IP_PROTO_UDP) {
+            return 0;
+        }
+        ip_len = IP6_HLEN + GET16(ip + 4);
+        if (ETH_HLEN + ip_len > len) {
+            return 0;
+        }
+        ff->is_ipv6 = 1;
+        ff->hlen = ETH_HLEN + IP6_HLEN;
+        ff->src = ip + 8;
+        ff->dst = ip + 24;
+        sum = csum_add(0, ip + 8, 32) + IP_PROTO_UDP;
+        break;
+    default:
+        return 0;
+    }
+
+    udp = frame + ff->hlen;
+    udp_len = GET16(udp + 4);
+    /* lwIP takes the UDP datagram to be the rest of the IP packet, so leave
+     * the odd ones where they differ to it */
+    if (GET16(udp + 2) != NTP_PORT
+            || udp_len < UDP_HLEN + NTP_MIN_LEN
+            || ff->hlen - ETH_HLEN + udp_len != ip_len) {
+        return 0;
+    }
+    udp_sum = GET16(udp + 6);
+    if (!checked && (udp_sum != 0 || ff->is_ipv6)) {
+        /* Zero means no checksum, which IPv6 doesn't allow */
+        sum = csum_add(sum + udp_len, udp, udp_len);
+        if (csum_fold(sum) != 0xFFFF) {
+            return 0;
+        }
+    }
+    ff->udp_len = udp_len;
+    return 1;
+}
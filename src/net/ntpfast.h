@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _NTPFAST_H
+#define _NTPFAST_H
+
+#include <stdint.h>
+
+/* Headers of a UDP datagram picked out of an Ethernet frame */
+struct ntp_fast_frame {
+    uint8_t is_ipv6;
+    /* Ethernet and IP headers */
+    uint16_t hlen;
+    /* UDP header and payload */
+    uint16_t udp_len;
+    /* Addresses in the IP header */
+    const uint8_t *src;
+    const uint8_t *dst;
+};
+
+int ntp_fast_parse(const uint8_t *frame, uint16_t len, int checked,
+        struct ntp_fast_frame *ff);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include "net/ntprate.h"
+
+/* Per-client rate limiting. Each client earns one millisecond of credit per
+ * millisecond and spends RATE_INTERVAL on each request, up to a burst of
+ * RATE_BURST requests. Refused requests are charged too, so a client only
+ * gets served again once it has backed off. The first refusal gets a KoD
+ * RATE reply and the rest are dropped until the client is served again.
+ *
+ * Instead of credit each entry keeps the time its credit will be full again,
+ * so an entry in the past has nothing to remember. The table is
+ * RATE_WAYS-way set-associative, and a new client takes over the entry in
+ * its set with the most credit, along with that entry's debt and KoD state.
+ * A client that collides with busy entries is charged for them, so sources
+ * beyond what the table holds are limited as a group rather than let
+ * through. The table takes 2.3KB, a lot out of 32KB of RAM but still only
+ * room for a few hundred clients. */
+#define RATE_INTERVAL   2000
+#define RATE_BURST      8
+#define RATE_CREDIT_MAX (RATE_INTERVAL * RATE_BURST)
+struct ntp_rate {
+    uint32_t addr;      /* Source address */
+    uint32_t full;      /* Time the credit is full again, ms */
+};
+static struct ntp_rate_set {
+    struct ntp_rate ways[RATE_WAYS];
+    uint8_t kod_sent;   /* One bit per way */
+} rates[RATE_SETS];
+
+const uint32_t ntp_rate_table_size = sizeof(rates);
+uint32_t ntp_rate_kods, ntp_rate_drops;
+
+
+static uint32_t
+rate_debt(const struct ntp_rate *rate, uint32_t now) {
+    /* Credit short of full, ms. Entries idle for weeks look like they are in
+     * the future once the clock wraps, and are taken as full too. */
+    int32_t debt = (int32_t)(rate->full - now);
+    if (debt < 0 || debt > RATE_CREDIT_MAX) {
+        return 0;
+    }
+    return debt;
+}
+
+
+int
+ntp_rate_check(uint32_t addr, uint32_t now) {
+    /* Charge a request from addr at time now (in ms) */
+    struct ntp_rate_set *set = &rates[RATE_SET(addr)];
+    struct ntp_rate *rate;
+    uint32_t debt;
+    uint8_t way = 0, i, hit = 0;
+    for (i = 0; i < RATE_WAYS; i++) {
+        if (set->ways[i].addr == addr) {
+            way = i;
+            hit = 1;
+            break;
+        }
+        if (rate_debt(&set->ways[i], now) < rate_debt(&set->ways[way], now)) {
+            way = i;
+        }
+    }
+    rate = &set->ways[way];
+    rate->addr = addr;
+    debt = rate_debt(rate, now);
+    if (debt <= RATE_CREDIT_MAX - RATE_INTERVAL) {
+        rate->full = now + debt + RATE_INTERVAL;
+        set->kod_sent &= ~(1 << way);
+        return RATE_OK;
+    }
+    if (hit) {
+        /* Only a client's own refusals put off when it is served next.
+         * Otherwise a set overrun by more clients than it holds would never
+         * serve anyone. */
+        debt += RATE_INTERVAL;
+        if (debt > RATE_CREDIT_MAX) {
+            debt = RATE_CREDIT_MAX;
+        }
+        rate->full = now + debt;
+    }
+    if (set->kod_sent & (1 << way)) {
+        ntp_rate_drops++;
+        return RATE_DROP;
+    }
+    set->kod_sent |= 1 << way;
+    ntp_rate_kods++;
+    return RATE_KOD;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _NTPRATE_H
+#define _NTPRATE_H
+
+#include <stdint.h>
+
+#define RATE_OK         0
+#define RATE_KOD        1
+#define RATE_DROP       2
+
+/* Clients are tracked in a RATE_WAYS-way set-associative table */
+#define RATE_SETS       64
+#define RATE_WAYS       4
+#define RATE_SET(addr)  ((((addr) * 2654435761U) >> 16) % RATE_SETS)
+
+/* Requests refused by the rate limiter */
+extern uint32_t ntp_rate_kods, ntp_rate_drops;
+/* Bytes of RAM the client table takes */
+extern const uint32_t ntp_rate_table_size;
+
+int ntp_rate_check(uint32_t addr, uint32_t now);
+
+#endif
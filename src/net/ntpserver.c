@@ -7,15 +7,20 @@
  */
 
 #include "common.h"
-#include "crypto/md5.h"
-#include "crypto/sha.h"
 #include "eeprom.h"
+#include "lwip/ip.h"
+#include "lwip/snmp.h"
+#include "lwip/sys.h"
 #include "lwip/udp.h"
-#include "status.h"
+#include "netif/etharp.h"
 #include "vtimer.h"
+#include "net/ntpauth.h"
+#include "net/ntpfast.h"
+#include "net/ntprate.h"
 #include "net/ntpserver.h"
 #include "net/tcpip.h"
 #include "net/udp_reply.h"
+#include "stm32/eth_mac.h"
 #include <string.h>
 
 #pragma pack(push, 1)
@@ -38,95 +43,309 @@ struct ntp_msg {
 #pragma pack(pop)
 
 
+/* The first 24 bytes of every reply, from the mode through the reference
+ * timestamp, published by the PLL thread once per second. Readers retry if
+ * template_seq changed while they were copying. */
+#define TEMPLATE_SIZE   24
+static uint32_t reply_template[TEMPLATE_SIZE / 4] = {
+    PP_HTONL(((LEAP_UNKNOWN << 6 | VN_4 | MODE_SERVER) << 24)
+            | (16 << 16) | (uint8_t)-24),
+    0,
+    0,
+    PP_HTONL(0x47505300), /* GPS */
+    0,
+    0,
+};
+static volatile uint32_t template_seq;
+
+
+/* Per-client state for interleaved mode. Clients are hashed by source address
+ * into a small set-associative table, and the least recently used entry of a
+ * set is evicted to make room. */
+#define CLIENT_SETS     8
+#define CLIENT_WAYS     4
+#define CLIENT_TOTAL    (CLIENT_SETS * CLIENT_WAYS)
+
+struct ntp_client {
+    uint32_t addr;      /* Folded source address */
+    uint32_t used;      /* LRU stamp, 0 if the entry is free */
+    uint32_t rx_ts[2];  /* Receive timestamp sent in the last reply */
+    uint64_t tx_time;   /* Actual transmit time of the last reply, or 0 */
+    uint32_t gen;       /* Bumped each time the entry changes hands */
+};
+static struct ntp_client clients[CLIENT_SETS][CLIENT_WAYS];
+static uint32_t client_clock;
+
+uint32_t ntp_requests;
+
+
+static uint32_t
+ntp_fold_addr(int is_ipv6, const uint32_t *addr) {
+    if (is_ipv6) {
+        return addr[0] ^ addr[1] ^ addr[2] ^ addr[3];
+    }
+    return addr[0];
+}
+
+
+static struct ntp_client *
+ntp_client_lookup(uint32_t addr) {
+    /* Find the entry for a client, replacing the least recently used entry
+     * of its set if it isn't there */
+    struct ntp_client *set, *victim;
+    int i;
+    set = clients[((addr * 2654435761U) >> 16) % CLIENT_SETS];
+    victim = &set[0];
+    for (i = 0; i < CLIENT_WAYS; i++) {
+        if (set[i].used && set[i].addr == addr) {
+            set[i].used = ++client_clock;
+            return &set[i];
+        }
+        if (set[i].used < victim->used) {
+            victim = &set[i];
+        }
+    }
+    victim->addr = addr;
+    victim->used = ++client_clock;
+    victim->gen++;
+    victim->rx_ts[0] = victim->rx_ts[1] = 0;
+    victim->tx_time = 0;
+    return victim;
+}
+
+
+/* The transmit callback can run after the client's entry has been evicted and
+ * given to someone else, so it gets the entry's index and generation instead
+ * of a pointer */
+#define CLIENT_TAG(c)       ((void*)(((uintptr_t)(c)->gen << 8) \
+            | (uintptr_t)((c) - &clients[0][0])))
+#define CLIENT_TAG_INDEX(t) ((uintptr_t)(t) & 0xFF)
+#define CLIENT_TAG_GEN(t)   ((uintptr_t)(t) >> 8)
+#define CLIENT_GEN_MASK     (UINTPTR_MAX >> 8)
+
+
 static void
-ntp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t port) {
+ntp_tx_done(void *arg, uint64_t timestamp) {
+    /* Record when the reply to a client actually went out */
+    struct ntp_client *client;
+    if (timestamp == 0 || CLIENT_TAG_INDEX(arg) >= CLIENT_TOTAL) {
+        return;
+    }
+    client = &clients[0][0] + CLIENT_TAG_INDEX(arg);
+    if ((client->gen & CLIENT_GEN_MASK) != CLIENT_TAG_GEN(arg)) {
+        /* Evicted while the reply was queued */
+        return;
+    }
+    client->tx_time = vtimer_from_mono(timestamp);
+}
+
+
+static void
+ntp_send_kod(struct udp_pcb *pcb, struct pbuf *p, uint32_t code) {
+    /* Send an unauthenticated Kiss-o'-Death reply. The client's transmit
+     * timestamp is echoed in every timestamp field. */
+    struct ntp_msg *msg = (struct ntp_msg*)p->payload;
+    if (p->len > 48) {
+        pbuf_realloc(p, 48);
+    }
+    msg->mode = (LEAP_UNKNOWN << 6) | VN_4 | MODE_SERVER;
+    msg->stratum = 0;
+    msg->precision = -24;
+    msg->root_delay = 0;
+    msg->root_dispersion = 0;
+    msg->ref_id = code;
+    msg->ref_ts[0] = msg->ref_ts[1] = 0;
+    msg->origin_ts[0] = msg->rx_ts[0] = msg->tx_ts[0];
+    msg->origin_ts[1] = msg->rx_ts[1] = msg->tx_ts[1];
+    udp_reply(pcb, p, &thisif);
+    pbuf_free(p);
+}
+
+
+static void
+ntp_respond(struct udp_pcb *pcb, struct pbuf *p, uint32_t client_addr) {
+    /* Answer the NTP request in p in place and send it back. p is consumed. */
     struct ntp_msg *msg;
     uint64_t now;
-    uint8_t md[20];
-    int out_size;
+    uint16_t out_size;
+    const struct ntp_key_state *key;
+    struct ntp_client *client;
+    int interleaved;
+    uint32_t seq;
+    uint8_t poll;
 
     msg = (struct ntp_msg*)p->payload;
     if (p->len < 48 || (msg->mode & MODE_MASK) != MODE_CLIENT) {
         pbuf_free(p);
         return;
     }
-    out_size = 48;
-    if (p->len == 72 && (cfg.flags & FLAG_NTPKEY_SHA1)) {
-        SHA_CTX sha;
-        SHA1_Init(&sha);
-        SHA1_Update(&sha, &cfg.ntp_key, 20);
-        SHA1_Update(&sha, msg, 48);
-        SHA1_Final(md, &sha);
-        if (!memcmp(md, msg->digest, 20)) {
-            out_size = 72;
-        }
-    } else if (p->len == 68 && (cfg.flags & FLAG_NTPKEY_MD5)) {
-        MD5_CTX md5;
-        MD5_Init(&md5);
-        MD5_Update(&md5, &cfg.ntp_key, 20);
-        MD5_Update(&md5, msg, 48);
-        MD5_Final(md, &md5);
-        if (!memcmp(md, msg->digest, 16)) {
-            out_size = 68;
-        }
+    ntp_requests++;
+    switch (ntp_rate_check(client_addr, sys_now())) {
+    case RATE_KOD:
+        ntp_send_kod(pcb, p, PP_HTONL(0x52415445)); /* RATE */
+        return;
+    case RATE_DROP:
+        pbuf_free(p);
+        return;
     }
+    out_size = ntp_auth_check(p->payload, p->len, &key);
     if (p->len > out_size) {
         pbuf_realloc(p, out_size);
     }
 
-    /* FIXME: leap seconds */
-    msg->mode = LEAP_NONE | VN_4 | MODE_SERVER;
-    if (~status_flags & STATUS_READY) {
-        /* not synced, advertise as such */
-        msg->stratum = 16;
+    poll = msg->poll < 6 ? 6 : msg->poll;
+    do {
+        seq = template_seq;
+        BARRIER();
+        memcpy(msg, reply_template, TEMPLATE_SIZE);
+        BARRIER();
+    } while (seq != template_seq);
+    msg->poll = poll;
+
+    /* A client asks for interleaved mode by sending back the receive
+     * timestamp of our previous reply as its origin. */
+    client = ntp_client_lookup(client_addr);
+    interleaved = (client->tx_time != 0
+            && msg->origin_ts[0] == client->rx_ts[0]
+            && msg->origin_ts[1] == client->rx_ts[1]);
+    if (interleaved) {
+        /* copy receive to origin */
+        msg->origin_ts[0] = msg->rx_ts[0];
+        msg->origin_ts[1] = msg->rx_ts[1];
     } else {
-        /* operating normally */
-        msg->stratum = 1;
+        /* copy transmit to origin */
+        msg->origin_ts[0] = msg->tx_ts[0];
+        msg->origin_ts[1] = msg->tx_ts[1];
     }
-    if (msg->poll < 6) {
-        msg->poll = 6;
+
+    /* Use the hardware receive timestamp if there is one */
+    if ((now = tcpip_rx_timestamp()) == 0) {
+        now = vtimer_now();
+    }
+    msg->rx_ts[0] = PP_HTONL((now >> 32));
+    msg->rx_ts[1] = PP_HTONL(now);
+    if (interleaved) {
+        /* Actual transmit time of the previous reply */
+        now = client->tx_time;
+    } else {
+        now = vtimer_now();
+        now += 73959; /* emperical */
     }
-    msg->precision = -24; /* 59ns */
-    msg->root_delay = 0;
-    msg->root_dispersion = 0;
-    msg->ref_id = PP_HTONL(0x47505300); /* GPS */
-    /* copy transmit to origin */
-    msg->origin_ts[0] = msg->tx_ts[0];
-    msg->origin_ts[1] = msg->tx_ts[1];
-
-    now = vtimer_now();
-    msg->ref_ts[0] = msg->rx_ts[0] = PP_HTONL((now >> 32));
-    msg->ref_ts[1] = msg->rx_ts[1] = PP_HTONL(now);
-    now += 73959; /* emperical */
     msg->tx_ts[0] = PP_HTONL((now >> 32));
     msg->tx_ts[1] = PP_HTONL(now);
+    client->rx_ts[0] = msg->rx_ts[0];
+    client->rx_ts[1] = msg->rx_ts[1];
+    client->tx_time = 0;
 
-    if (out_size == 72) {
-        SHA_CTX sha;
-        SHA1_Init(&sha);
-        SHA1_Update(&sha, &cfg.ntp_key, 20);
-        SHA1_Update(&sha, msg, 48);
-        SHA1_Final(msg->digest, &sha);
-    } else if (out_size == 68) {
-        MD5_CTX md5;
-        MD5_Init(&md5);
-        MD5_Update(&md5, &cfg.ntp_key, 20);
-        MD5_Update(&md5, msg, 48);
-        MD5_Final(msg->digest, &md5);
+    if (out_size == NTP_NAK_SIZE) {
+        msg->key_id = 0;
+    } else if (out_size > NTP_NAK_SIZE) {
+        ntp_auth_digest(key, msg, msg->digest);
     }
 
+    mac_set_tx_callback(ntp_tx_done, CLIENT_TAG(client));
     udp_reply(pcb, p, &thisif);
+    mac_set_tx_callback(NULL, NULL);
     pbuf_free(p);
 }
 
 
+static void
+ntp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t port) {
+    ntp_respond(pcb, p, ntp_fold_addr(PCB_ISIPV6(pcb), (const uint32_t*)addr));
+}
+
+
+void
+ntp_server_update(uint8_t leap, uint8_t stratum, int8_t precision,
+        uint32_t root_dispersion, uint64_t ref_time) {
+    /* Publish new reply header fields. Called only from the PLL thread. */
+    uint32_t tmp[TEMPLATE_SIZE / 4];
+    tmp[0] = htonl((((leap << 6) | VN_4 | MODE_SERVER) << 24)
+            | (stratum << 16) | (uint8_t)precision);
+    tmp[1] = 0; /* root delay */
+    tmp[2] = htonl(root_dispersion);
+    tmp[3] = PP_HTONL(0x47505300); /* GPS */
+    tmp[4] = htonl(ref_time >> 32);
+    tmp[5] = htonl(ref_time);
+    template_seq++;
+    BARRIER();
+    memcpy(reply_template, tmp, TEMPLATE_SIZE);
+    BARRIER();
+    template_seq++;
+}
+
+
 struct udp_pcb *ntp_pcb;
 #if LWIP_IPV6
 struct udp_pcb *ntp6_pcb;
+
+
+static int
+ntp_is_local_ip6(const ip6_addr_p_t *addr) {
+    int i;
+    for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+        if (ip6_addr_isvalid(netif_ip6_addr_state(&thisif, i))
+                && ip6_addr_cmp(addr, netif_ip6_addr(&thisif, i))) {
+            return 1;
+        }
+    }
+    return 0;
+}
 #endif
 
+
+int
+ntp_fast_input(struct pbuf *p, int checked) {
+    /* Answer unicast NTP requests straight out of the receive buffer without
+     * going through lwIP. checked is nonzero if the MAC verified the
+     * checksums. Returns 1 if the frame was consumed, or 0 if it should be
+     * passed to lwIP as usual. */
+    struct ntp_fast_frame ff;
+    struct udp_pcb *pcb;
+    uint32_t src[4];
+    uint16_t hlen;
+
+    if (p->len != p->tot_len || p->len < ETH_PAD_SIZE
+            || !ntp_fast_parse((const uint8_t*)p->payload + ETH_PAD_SIZE,
+                p->len - ETH_PAD_SIZE, checked, &ff)) {
+        return 0;
+    }
+    if (!ff.is_ipv6) {
+        if (ip_addr_isany(&thisif.ip_addr)
+                || memcmp(ff.dst, &thisif.ip_addr, 4)) {
+            return 0;
+        }
+        pcb = ntp_pcb;
+        memcpy(src, ff.src, 4);
+#if LWIP_IPV6
+    } else {
+        if (!ntp_is_local_ip6((const ip6_addr_p_t*)ff.dst)) {
+            return 0;
+        }
+        pcb = ntp6_pcb;
+        memcpy(src, ff.src, 16);
+#else
+    } else {
+        return 0;
+#endif
+    }
+    if (pcb == NULL) {
+        return 0;
+    }
+    /* Strip the headers and any link padding, leaving just the NTP message
+     * as ntp_recv would see it. udp_reply restores the headers. */
+    hlen = ETH_PAD_SIZE + ff.hlen;
+    pbuf_realloc(p, hlen + ff.udp_len);
+    pbuf_header(p, -(s16_t)(hlen + UDP_HLEN));
+    snmp_inc_udpindatagrams();
+    ntp_respond(pcb, p, ntp_fold_addr(ff.is_ipv6, src));
+    return 1;
+}
+
 void
 ntp_server_start(void) {
+    ntp_auth_init();
     ASSERT((ntp_pcb = udp_new()) != NULL);
     udp_bind(ntp_pcb, IP_ADDR_ANY, NTP_PORT);
     udp_recv(ntp_pcb, ntp_recv, NULL);
@@ -9,6 +9,8 @@
 #ifndef _NTPSERVER_H
 #define _NTPSERVER_H
 
+#include "lwip/pbuf.h"
+
 #define NTP_PORT                123
 
 #define LEAP_MASK               0xC0
@@ -22,6 +24,12 @@
 #define MODE_CLIENT             0x3
 #define MODE_SERVER             0x4
 
+/* Client requests received */
+extern uint32_t ntp_requests;
+
 void ntp_server_start(void);
+void ntp_server_update(uint8_t leap, uint8_t stratum, int8_t precision,
+        uint32_t root_dispersion, uint64_t ref_time);
+int ntp_fast_input(struct pbuf *p, int checked);
 
 #endif
@@ -14,6 +14,7 @@
 #include "net/tcpip.h"
 #include "lwip/tcp.h"
 #include "stm32/serial.h"
+#include <string.h>
 
 static uint8_t rbuf[16];
 static struct tcp_pcb *relay_pcb, *relay_client;
@@ -96,6 +97,25 @@ relay_push(uint8_t val) {
 }
 
 
+void
+relay_write(const uint8_t *data, uint16_t len) {
+    uint16_t n;
+    if (len) {
+        needs_flush = 1;
+    }
+    while (len) {
+        n = MIN(len, sizeof(rbuf) - rbuf_len);
+        memcpy(&rbuf[rbuf_len], data, n);
+        rbuf_len += n;
+        data += n;
+        len -= n;
+        if (rbuf_len == sizeof(rbuf)) {
+            rbuf_flush();
+        }
+    }
+}
+
+
 void
 relay_flush(void) {
     rbuf_flush();
@@ -12,6 +12,7 @@
 void relay_server_start(uint16_t port);
 
 void relay_push(uint8_t value);
+void relay_write(const uint8_t *data, uint16_t len);
 void relay_flush(void);
 
 #endif
@@ -10,6 +10,9 @@
 #include "status.h"
 #include "vtimer.h"
 #include "gps/parser.h"
+#include "gps/ublox.h"
+#include "net/ntprate.h"
+#include "net/ntpserver.h"
 #include "lwip/snmp.h"
 #include "lwip/snmp_asn1.h"
 #include "lwip/snmp_structs.h"
@@ -68,6 +71,9 @@ gps_get_object_def(uint8_t ident_len, int32_t *ident, struct obj_def *od) {
     od->id_inst_ptr = ident;
     switch (ident[0]) {
         case 1: /* numSvInFix */
+        case 2: /* surveyState */
+        case 3: /* surveyDuration */
+        case 4: /* surveyAccuracy */
             od->instance = MIB_OBJECT_TAB;
             od->access = MIB_OBJECT_READ_ONLY;
             od->asn_type = (SNMP_ASN1_UNIV | SNMP_ASN1_PRIMIT | SNMP_ASN1_INTEG);
@@ -88,6 +94,59 @@ gps_get_value(struct obj_def *od, uint16_t len, void *value) {
         case 1: /* numSvInFix */
             *sint_ptr = gps_fix_svs;
             break;
+        case 2: /* surveyState */
+            *sint_ptr = ublox_survey.state;
+            break;
+        case 3: /* surveyDuration */
+            *sint_ptr = ublox_survey.dur;
+            break;
+        case 4: /* surveyAccuracy */
+            *sint_ptr = ublox_survey.acc;
+            break;
+    }
+}
+
+
+static void
+ntpstats_get_object_def(uint8_t ident_len, int32_t *ident, struct obj_def *od) {
+    ident_len++;
+    ident--;
+    if (ident_len != 2) {
+        od->instance = MIB_OBJECT_NONE;
+        return;
+    }
+    od->id_inst_len = ident_len;
+    od->id_inst_ptr = ident;
+    switch (ident[0]) {
+        case 1: /* ntpRequests */
+        case 2: /* ntpRateKoDs */
+        case 3: /* ntpRateDrops */
+            od->instance = MIB_OBJECT_TAB;
+            od->access = MIB_OBJECT_READ_ONLY;
+            od->asn_type = (SNMP_ASN1_APPLIC | SNMP_ASN1_PRIMIT | SNMP_ASN1_COUNTER);
+            od->v_len = sizeof(uint32_t);
+            return;
+        default:
+            od->instance = MIB_OBJECT_NONE;
+            return;
+    }
+}
+
+
+static void
+ntpstats_get_value(struct obj_def *od, uint16_t len, void *value) {
+    uint8_t id = od->id_inst_ptr[0];
+    uint32_t *uint_ptr = (uint32_t*)value;
+    switch (id) {
+        case 1: /* ntpRequests */
+            *uint_ptr = ntp_requests;
+            break;
+        case 2: /* ntpRateKoDs */
+            *uint_ptr = ntp_rate_kods;
+            break;
+        case 3: /* ntpRateDrops */
+            *uint_ptr = ntp_rate_drops;
+            break;
     }
 }
 
@@ -154,8 +213,11 @@ static const mib_scalar_node mib_gps_scalar = {
     MIB_NODE_SC,
     0
 };
-static const s32_t mib_gps_ids[1] = { 1 };
-static struct mib_node* const mib_gps_nodes[1] = {
+static const s32_t mib_gps_ids[4] = { 1, 2, 3, 4 };
+static struct mib_node* const mib_gps_nodes[4] = {
+    (struct mib_node*)&mib_gps_scalar,
+    (struct mib_node*)&mib_gps_scalar,
+    (struct mib_node*)&mib_gps_scalar,
     (struct mib_node*)&mib_gps_scalar,
     };
 static const struct mib_array_node mib_gps = {
@@ -164,11 +226,37 @@ static const struct mib_array_node mib_gps = {
     &noleafs_set_test,
     &noleafs_set_value,
     MIB_NODE_AR,
-    1,
+    4,
     mib_gps_ids,
     mib_gps_nodes
 };
 
+/* ntpStats .1.3.6.1.4.1.x.1.4 */
+static const mib_scalar_node mib_ntpstats_scalar = {
+    &ntpstats_get_object_def,
+    &ntpstats_get_value,
+    &noleafs_set_test,
+    &noleafs_set_value,
+    MIB_NODE_SC,
+    0
+};
+static const s32_t mib_ntpstats_ids[3] = { 1, 2, 3 };
+static struct mib_node* const mib_ntpstats_nodes[3] = {
+    (struct mib_node*)&mib_ntpstats_scalar,
+    (struct mib_node*)&mib_ntpstats_scalar,
+    (struct mib_node*)&mib_ntpstats_scalar,
+    };
+static const struct mib_array_node mib_ntpstats = {
+    &noleafs_get_object_def,
+    &noleafs_get_value,
+    &noleafs_set_test,
+    &noleafs_set_value,
+    MIB_NODE_AR,
+    3,
+    mib_ntpstats_ids,
+    mib_ntpstats_nodes
+};
+
 /* ntpServer .1.3.6.1.4.1.x.1 */
 static const mib_scalar_node mib_ntpserver_scalar = {
     &serverstate_get_object_def,
@@ -178,11 +266,12 @@ static const mib_scalar_node mib_ntpserver_scalar = {
     MIB_NODE_SC,
     0
 };
-static const s32_t mib_ntpserver_ids[3] = { 1, 2, 3 };
-static struct mib_node* const mib_ntpserver_nodes[3] = {
+static const s32_t mib_ntpserver_ids[4] = { 1, 2, 3, 4 };
+static struct mib_node* const mib_ntpserver_nodes[4] = {
     (struct mib_node*)&mib_ntpserver_scalar,
     (struct mib_node*)&mib_loopstats,
     (struct mib_node*)&mib_gps,
+    (struct mib_node*)&mib_ntpstats,
     };
 static const struct mib_array_node mib_ntpserver = {
     &noleafs_get_object_def,
@@ -190,7 +279,7 @@ static const struct mib_array_node mib_ntpserver = {
     &noleafs_set_test,
     &noleafs_set_value,
     MIB_NODE_AR,
-    3,
+    4,
     mib_ntpserver_ids,
     mib_ntpserver_nodes
 };
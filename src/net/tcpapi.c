@@ -76,6 +76,7 @@ api_call(tcpapi_msg_t *msg, api_func func) {
     xSemaphoreGive(api_mutex);
     /* Post message to tcpip thread */
     xQueueSend(tcpip_queue, &msg, portMAX_DELAY);
+    xSemaphoreGive(tcpip_wake);
     /* Sleep until result is ready */
     xSemaphoreTake(msg->sem, portMAX_DELAY);
     return msg->ret;
@@ -14,6 +14,7 @@
 #include "eeprom.h"
 #include "logging.h"
 #include "main.h"
+#include "vtimer.h"
 #include "stm32/eth_mac.h"
 #include "net/ntpclient.h"
 #include "net/ntpserver.h"
@@ -38,8 +39,11 @@ TaskHandle_t thread_tcpip;
 
 struct netif thisif;
 QueueHandle_t tcpip_queue;
+SemaphoreHandle_t tcpip_wake;
 
 static int did_startup;
+/* Monotonic receive time of the frame being processed, or 0 if unknown */
+static uint64_t rx_timestamp;
 
 static void tcpip_thread(void *p);
 static void link_changed(void);
@@ -53,11 +57,20 @@ static const uint8_t sysdescr_len = sizeof(BOARD_NAME) - 1;
 
 /* milliseconds */
 #define TCPIP_CHECKS_TMR_INTERVAL 1000
+/* How often the tcpip thread runs sys_check_timeouts(). The lwIP in the lwip
+ * submodule predates sys_timeouts_sleeptime() and keeps the time of its next
+ * timeout to itself (lwip/timers.h, not timeouts.h), so the thread can't sleep
+ * exactly that long. This is the period of lwIP's fastest cyclic timers,
+ * IGMP_TMR_INTERVAL and MLD6_TMR_INTERVAL, so those stay on schedule. One-shot
+ * timeouts, like api_udp_recv()'s, fire up to this much late. Frames and API
+ * calls wake the thread right away either way. */
+#define TCPIP_TIMEOUT_INTERVAL 100
 
 
 void
 tcpip_start(void) {
     ASSERT((tcpip_queue = xQueueCreate(8, sizeof(void*))));
+    ASSERT((tcpip_wake = xSemaphoreCreateBinary()));
     lwip_init();
     snmp_set_sysdescr((const u8_t*)BOARD_NAME, &sysdescr_len);
     api_start();
@@ -130,7 +143,7 @@ tcpip_checks(void *arg) {
 static void
 tcpip_thread(void *p) {
     void *msg;
-    int frame_received = 0;
+    uint32_t now, next_check;
     api_set_main_thread(xTaskGetCurrentTaskHandle());
     if (cfg.ip_addr.addr == 0 || cfg.ip_netmask.addr == 0) {
         dhcp_start(&thisif);
@@ -138,20 +151,28 @@ tcpip_thread(void *p) {
         netif_set_up(&thisif);
     }
     sys_timeout(TCPIP_CHECKS_TMR_INTERVAL, tcpip_checks, NULL);
+    next_check = sys_now();
     while (1) {
-        /* If a frame was received last cycle then check for another one
-         * immediately, but still peek in the queue first. If no frame was
-         * received then sleep between events.
-         */
-        if (xQueueReceive(tcpip_queue, &msg,
-                    frame_received ? 0 : pdMS_TO_TICKS(20))) {
-            if (msg != NULL) {
-                /* API call */
-                api_accept(msg);
-            }
+        while (xQueueReceive(tcpip_queue, &msg, 0)) {
+            /* API call */
+            api_accept(msg);
+        }
+        now = sys_now();
+        if ((int32_t)(now - next_check) >= 0) {
+            sys_check_timeouts();
+            next_check = now + TCPIP_TIMEOUT_INTERVAL;
+        }
+        /* Process every frame that is ready, collecting transmit timestamps
+         * and finished pbufs along the way */
+        do {
+            maczero_housekeeping();
+        } while (ethernetif_input(&thisif));
+        /* Sleep until a frame or API call arrives, or lwIP's timers are due.
+         * Wakeups that arrived while busy are remembered by the semaphore. */
+        now = sys_now();
+        if ((int32_t)(next_check - now) > 0) {
+            xSemaphoreTake(tcpip_wake, pdMS_TO_TICKS(next_check - now));
         }
-        sys_check_timeouts();
-        frame_received = ethernetif_input(&thisif);
     }
 }
 
@@ -255,30 +276,51 @@ ethernetif_input(struct netif *netif) {
     struct pbuf *p, *q;
     uint16_t len;
     mac_desc_t *rdesc;
+    int checked;
 
     (void)netif;
     if ((rdesc = mac_get_rx_descriptor()) == NULL) {
         return 0;
     }
-    len = rdesc->size + ETH_PAD_SIZE;
-    if ((p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL)) == NULL) {
+    rx_timestamp = rdesc->timestamp;
+    checked = rdesc->checked;
+    if ((p = mac_lend_rx_descriptor(rdesc)) == NULL) {
+        /* All the spare DMA buffers are in use, so copy the frame out */
+        len = rdesc->size + ETH_PAD_SIZE;
+        if ((p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL)) == NULL) {
+            mac_release_rx_descriptor(rdesc);
+            rx_timestamp = 0;
+            LINK_STATS_INC(link.memerr);
+            LINK_STATS_INC(link.drop);
+            snmp_inc_ifindiscards(netif);
+            return 1;
+        }
+        pbuf_header(p, -ETH_PAD_SIZE);
+        for (q = p; q != NULL; q = q->next) {
+            mac_read_rx_descriptor(rdesc, q->payload, q->len);
+        }
         mac_release_rx_descriptor(rdesc);
-        LINK_STATS_INC(link.memerr);
-        LINK_STATS_INC(link.drop);
-        snmp_inc_ifindiscards(netif);
-        return 1;
-    }
-    pbuf_header(p, -ETH_PAD_SIZE);
-    for (q = p; q != NULL; q = q->next) {
-        mac_read_rx_descriptor(rdesc, q->payload, q->len);
+        pbuf_header(p, ETH_PAD_SIZE);
     }
-    mac_release_rx_descriptor(rdesc);
-    pbuf_header(p, ETH_PAD_SIZE);
     LINK_STATS_INC(link.recv);
     snmp_inc_ifinucastpkts(netif);
     snmp_add_ifinoctets(netif, p->tot_len);
-    if (netif->input(p, netif) != ERR_OK) {
+    if (ntp_fast_input(p, checked)) {
+        /* Already answered */
+    } else if (netif->input(p, netif) != ERR_OK) {
         pbuf_free(p);
     }
+    rx_timestamp = 0;
     return 1;
 }
+
+
+uint64_t
+tcpip_rx_timestamp(void) {
+    /* Get the vtimer time at which the frame currently being processed was
+     * received by the MAC, or 0 if it is not known */
+    if (rx_timestamp == 0) {
+        return 0;
+    }
+    return vtimer_from_mono(rx_timestamp);
+}
@@ -17,5 +17,6 @@ extern struct netif thisif;
 extern QueueHandle_t tcpip_queue;
 
 void tcpip_start(void);
+uint64_t tcpip_rx_timestamp(void);
 
 #endif
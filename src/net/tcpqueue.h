@@ -10,7 +10,11 @@
 #define _TCPIP_QUEUE_H
 
 #include "queue.h"
+#include "semphr.h"
 
 extern QueueHandle_t tcpip_queue;
+/* Given to wake the tcpip thread after posting to tcpip_queue or when a frame
+ * is received */
+extern SemaphoreHandle_t tcpip_wake;
 
 #endif
@@ -59,6 +59,8 @@ extern struct pll_state pll_state;
 double pll_math(double y);
 double pll_poll(void);
 void pll_reset(void);
+void pll_seed(double b, int tightened);
+int pll_learned(double *b, int *tightened);
 
 /* ----- */
 /* pll.c */
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/*
+ * Integer version of the PLL in pllmath.c, for parts without an FPU. The
+ * states, thresholds and default parameters are the same, but everything is
+ * kept in fixed point:
+ *
+ *   phase (y, my, sdy, say, a ...)     int64, 2^-48 seconds
+ *   ratios (wa, wamin, wamax)          uint32, 2^-32
+ *   wa^2 and wa^4                      uint64, 2^-64
+ *   2nd order correction (b)           int64, 2^-72
+ *   3rd order correction (c)           int64, 2^-96
+ *   averaging limit (mj)               uint32, 2^-8
+ *
+ * The exponents are fixed at 2 and 4 so the powers of wa are just products,
+ * recomputed whenever wa changes. Only the input phase and the returned
+ * correction are converted to and from double.
+ *
+ * Selected at build time with USE_PLL_FIXED. It ships disabled: test_pllfixed
+ * shows it tracking pllmath.c on simulated PPS, but it has not yet run
+ * against a real receiver, and pllmath.c has. The PLL runs once a second, so
+ * the soft-float time it saves is not worth that risk until it has.
+ */
+
+/* No RTOS or hardware headers, so that this and pllmath.c can also be built
+ * on a host for offline simulation */
+#include "app_config.h"
+#include "ntpns.h"
+#include "pll.h"
+#include <stdint.h>
+
+#if USE_PLL_FIXED && !USE_PLL_KALMAN
+
+#define Q32(x)          ((int64_t)((x) * 4294967296.0))
+#define Q48(x)          ((int64_t)((x) * 281474976710656.0))
+#define FROM_Q48(x)     ((double)(x) * (1.0 / 281474976710656.0))
+#define FROM_Q72(x)     ((double)(x) * (1.0 / 4722366482869645213696.0))
+
+/* Defaults, as in pllmath.c */
+#define FX_mj0          8
+#define FX_dl0          10
+#define FX_wa0          Q32(.1)
+#define FX_go3          Q32(.001)
+#define FX_t3           10
+#define FX_wamin        0
+#define FX_wamax        FX_wa0
+
+/* 128PPM, the largest plausible frequency offset */
+#define FX_b_max        ((int64_t)(128e-6 * 4722366482869645213696.0))
+#define FX_f_max_q64    ((uint64_t)(128e-6 * 18446744073709551616.0))
+/* .9 in 2^-32 */
+#define FX_tighten      3865470566U
+
+struct pll_fixed {
+    int64_t y, ly, my, lmy, dy, ddy, sdy, ay, say, a;
+    int64_t b;
+    int64_t c;
+    uint32_t wa, wamin, wamax;
+    uint64_t wa2, wa4;
+    uint32_t mj;
+    int j, dl, zc, st;
+};
+
+/* Report-only copy of the interesting values, for vtimer and loopstats */
+struct pll_state pll_state;
+
+static struct pll_fixed fx;
+/* Warm start, see pll_seed() */
+static int64_t seed_b;
+static int seed_tn, tn;
+
+
+static uint64_t
+umul_shr(uint64_t a, uint64_t b, unsigned shift) {
+    /* (a * b) >> shift, keeping the whole 128-bit product */
+    uint64_t ll = (uint64_t)(uint32_t)a * (uint32_t)b;
+    uint64_t lh = (uint64_t)(uint32_t)a * (uint32_t)(b >> 32);
+    uint64_t hl = (uint64_t)(uint32_t)(a >> 32) * (uint32_t)b;
+    uint64_t hh = (uint64_t)(uint32_t)(a >> 32) * (uint32_t)(b >> 32);
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    uint64_t lo = (mid << 32) | (uint32_t)ll;
+    uint64_t hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    if (shift == 0) {
+        return lo;
+    } else if (shift < 64) {
+        return (hi << (64 - shift)) | (lo >> shift);
+    } else {
+        return hi >> (shift - 64);
+    }
+}
+
+
+static int64_t
+smul_shr(int64_t a, uint64_t b, unsigned shift) {
+    uint64_t r;
+    if (a < 0) {
+        r = umul_shr(-(uint64_t)a, b, shift);
+        return -(int64_t)r;
+    }
+    r = umul_shr(a, b, shift);
+    return (int64_t)r;
+}
+
+
+static int64_t
+fx_abs(int64_t x) {
+    return x < 0 ? -x : x;
+}
+
+
+static void
+fx_set_wa(uint32_t wa) {
+    fx.wa = wa;
+    fx.wa2 = (uint64_t)wa * wa;
+    fx.wa4 = umul_shr(fx.wa2, fx.wa2, 64);
+}
+
+
+void
+pll_reset(void) {
+    fx.st = 0;
+    pll_state.st = 0;
+    sys_able |= ABLE_PLL_UNLOCKED;
+}
+
+
+double
+pll_poll(void) {
+    if (fx.st >= 5) {
+        fx.b += fx.c >> 24;
+    }
+    return FROM_Q72(fx.b);
+}
+
+
+static void
+pll_step(void) {
+    /* Sanity checks. */
+    if (fx_abs(fx.b) > FX_b_max) {
+        fx.st = 0;
+    }
+
+    /* If the state is zero, we need to initialize everything */
+    if (fx.st == 0) {
+        fx.mj = FX_mj0 << 8;
+        fx.dl = FX_dl0;
+        fx_set_wa(FX_wa0);
+        fx.j = 0;
+        fx.b = seed_b;
+        fx.c = 0;
+        fx.my = 0;
+        fx.ly = 0;
+        fx.lmy = 0;
+        fx.dy = 0;
+        fx.say = 0;
+        fx.sdy = 0;
+        fx.zc = 0;
+        tn = 0;
+        fx.st = 1;
+        sys_able |= ABLE_PLL_UNLOCKED;
+    }
+
+    /* Count the timer down */
+    fx.dl--;
+
+    /* Adjust the averaging factor */
+    if (((uint32_t)fx.j << 8) < fx.mj) {
+        fx.j++;
+    }
+
+    /* Update exponential estimate of y */
+    fx.my += (fx.y - fx.my) / fx.j;
+
+    /* Update zero-cross timer */
+    if ((fx.lmy < 0 && fx.my > 0) || (fx.lmy > 0 && fx.my < 0)) {
+        fx.zc = 0;
+    } else {
+        fx.zc++;
+    }
+    fx.lmy = fx.my;
+
+    /* Calculate slope estimates */
+    fx.ddy = fx.dy;
+    fx.dy = fx.y - fx.ly;
+    fx.sdy += (fx_abs(fx.dy) - fx.sdy) / fx.j;
+
+    /* Allan variance estimate (tau=1sec) */
+    fx.ay = fx_abs(fx.dy - fx.ddy);
+    fx.say += (fx.ay - fx.say) / fx.j;
+
+    fx.ly = fx.y;
+
+    /* Ring up our corrections */
+    fx.a = smul_shr(fx.y, fx.wa, 32);
+    if (fx.st >= 3) {
+        fx.b += smul_shr(fx.y, fx.wa2, 40);
+    }
+    if (fx.st >= 5) {
+        fx.b += fx.c >> 24;
+        fx.c += smul_shr(fx.y, fx.wa4, 16);
+    }
+
+    /* No zero-crossings for a long time (zc > 200 / wa), or a rapid
+     * excursion. Loosen the screw and start over. */
+    if (fx.st >= 4 &&
+            (((uint64_t)fx.zc * fx.wa > (200ULL << 32))
+             || (fx_abs(fx.my) > 20 * fx.sdy))) {
+        if (fx.wamin + fx.wamin / 4 < fx.wamax) {
+            fx.wamin = fx.wa + fx.wa / 4;
+        }
+        fx.st = 0;
+        sys_able |= ABLE_PLL_UNLOCKED;
+        return;
+    }
+
+    /* Running average is more than 20% of sdy, rearm the timer */
+    if (fx.st >= 4 && 5 * fx_abs(fx.my) > fx.sdy) {
+        fx.dl = fx.mj >> 8;
+    }
+
+    /* Wait for our timer to expire before we fiddle the PLL. */
+    if (fx.dl >= 0) {
+        return;
+    }
+
+    /* State 1: wait for |y| < sdy + 128PPM / wa */
+    if (fx.st == 1 && umul_shr(fx_abs(fx.y), fx.wa, 16)
+            < umul_shr(fx.sdy, fx.wa, 16) + FX_f_max_q64) {
+        fx.st = 2;
+        fx.dl = fx.mj >> 8;
+        return;
+    }
+
+    if (fx.st == 2) {
+        fx.st = 3;
+        fx.dl = fx.mj >> 8;
+        sys_able &= ~ABLE_PLL_UNLOCKED;
+        return;
+    }
+
+    /* State 3: wait for |my| < say * .5 and a zero crossing */
+    if (fx.st == 3 && 2 * fx_abs(fx.my) < fx.say && fx.zc < 10) {
+        fx.st = 4;
+        fx.dl = fx.mj >> 8;
+        return;
+    }
+
+    if (fx.st == 4 && fx.wa < FX_go3) {
+        fx.st = 5;
+    }
+
+    /* States 4 and 5: tighten the screw when |my| < say * .1 */
+    if (fx.st >= 4 && 10 * fx_abs(fx.my) < fx.say && fx.zc < 10) {
+        /* After a warm start, go straight back to the saved tightening */
+        do {
+            if (fx.wa > fx.wamin) {
+                fx_set_wa(((uint64_t)fx.wa * FX_tighten) >> 32);
+                fx.mj += fx.mj / 4;
+                tn++;
+            }
+        } while (tn < seed_tn && fx.wa > fx.wamin);
+        seed_b = 0;
+        seed_tn = 0;
+        fx.dl = fx.mj >> 8;
+        if (fx.st >= 5) {
+            fx.dl *= FX_t3;
+        }
+    }
+}
+
+
+double
+pll_math(double y) {
+    fx.y = Q48(-y);
+    pll_step();
+
+    pll_state.st = fx.st;
+    pll_state.j = fx.j;
+    pll_state.my = FROM_Q48(fx.my);
+    pll_state.dy = FROM_Q48(fx.dy);
+    pll_state.sdy = FROM_Q48(fx.sdy);
+    pll_state.say = FROM_Q48(fx.say);
+
+    /* Total correction */
+    return FROM_Q48(fx.a) + FROM_Q72(fx.b);
+}
+
+
+void
+pll_seed(double b, int tightened) {
+    /* Preset the frequency and tightening used when the PLL next starts over */
+    if (b > 128e-6 || b < -128e-6) {
+        return;
+    }
+    seed_b = (int64_t)(b * 4722366482869645213696.0);
+    if (tightened >= 0) {
+        seed_tn = tightened;
+    }
+    if (fx.st == 0) {
+        /* Also use it for holdover until the first PPS arrives */
+        fx.b = seed_b;
+    }
+}
+
+
+int
+pll_learned(double *b, int *tightened) {
+    if (fx.st < 4) {
+        return 0;
+    }
+    *b = FROM_Q72(fx.b);
+    *tightened = tn;
+    return 1;
+}
+
+
+void
+init_pllmath(void) {
+    fx.wamin = FX_wamin;
+    fx.wamax = FX_wamax;
+}
+
+#endif
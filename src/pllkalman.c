@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/*
+ * Kalman filter clock model, as an alternative to the PLL in pllmath.c. It
+ * has the same interface, so vtimer doesn't know which one it is driving.
+ *
+ * The state is the phase of the vtimer against PPS (seconds), the frequency
+ * error of the oscillator and its drift (per second). Every second the model
+ * is advanced by the correction we applied, then updated with the measured
+ * phase if there is one. The correction is the estimated frequency and drift
+ * cancelled out, plus a fraction of the estimated phase.
+ *
+ * Measurement noise comes from the same two sample Allan estimate (say) that
+ * the PLL uses. Frequency noise is learned from the Allan variance of the
+ * free running oscillator, that is the measured phase with our own
+ * corrections taken back out, at a longer interval. For white phase noise R
+ * and frequency random walk q_f:
+ *
+ *   AVAR(tau) = 3 R / tau^2 + q_f tau / 3
+ *
+ * so with R known, q_f is solved for from AVAR at KF_TAU1. Drift noise is
+ * too small to tell apart from that in the few hours the history covers, so
+ * it is left at its default. Until there is enough data, or if the fit comes
+ * out below it, the default for an ordinary crystal is used.
+ *
+ * Outliers are rejected by their innovation, and when the PPS has really
+ * moved the phase uncertainty is opened up instead of starting over.
+ *
+ * Selected at build time with USE_PLL_KALMAN.
+ */
+
+/* No RTOS or hardware headers, so that this can also be built on a host for
+ * offline simulation */
+#include "app_config.h"
+#include "ntpns.h"
+#include "pll.h"
+#include <math.h>
+#include <stdint.h>
+
+#if USE_PLL_KALMAN
+
+/* Frequency random walk, (s/s)^2 per second, until learned, and the least
+ * that will be learned */
+#define KF_Q_FREQ       (1e-11 * 1e-11)
+#define KF_Q_FREQ_MIN   (1e-13 * 1e-13)
+/* Drift random walk, (s/s^2)^2 per second */
+#define KF_Q_DRIFT      (1e-17 * 1e-17)
+/* Allan variance interval for the fit, long enough that the PPS noise
+ * doesn't swamp the oscillator. The free running phase is sampled every
+ * KF_TAU0 seconds, and KF_TAU1 is a whole number of those. */
+#define KF_TAU0         128
+#define KF_TAU1         2048
+#define KF_HIST         (2 * KF_TAU1 / KF_TAU0 + 1)
+/* Allan variance averaging limit, in samples, and how many before the fit is
+ * used */
+#define KF_AV_MJ        128
+#define KF_AV_MIN       16
+/* Initial uncertainty: phase (anything short of a step), unseeded frequency,
+ * frequency seeded by the FLL or a saved value, and drift */
+#define KF_P_PHASE      (20e-3 * 20e-3)
+#define KF_P_FREQ       (128e-6 * 128e-6)
+#define KF_P_SEEDED     (1e-7 * 1e-7)
+#define KF_P_DRIFT      (1e-12 * 1e-12)
+/* Measurement noise never assumed to be lower than this */
+#define KF_R_MIN        (1e-9 * 1e-9)
+/* Mean |second difference| of white phase noise is this times its sigma */
+#define KF_AVAR_SIGMA   1.95
+/* Fraction of the estimated phase steered out each second while pulling in,
+ * and the least once locked */
+#define KF_STEER_MAX    (1.0 / 8)
+#define KF_STEER_MIN    (1.0 / 1024)
+/* Reject innovations beyond this many sigma... */
+#define KF_GATE         5.0
+/* ...unless it keeps happening, then believe them */
+#define KF_GATE_MAX     10
+/* Noise estimate averaging limit */
+#define KF_MJ           64
+/* State 3 (locked) once phase is known to this, 4 once frequency is */
+#define KF_LOCK_PHASE   1e-6
+#define KF_LOCK_FREQ    5e-9
+
+struct pll_kalman {
+    double x[3];
+    double P[3][3];
+    double u;
+    /* Frequency gain of the last update, for the steering */
+    double k_freq;
+    double ly, ddy, say;
+    int gated, n;
+    /* Process noise in use */
+    double q_freq, q_drift;
+    /* Sum of the corrections applied, to recover the free running phase */
+    double u_sum;
+    /* Free running phase every KF_TAU0 seconds, and its Allan variance */
+    double hist[KF_HIST];
+    double av1;
+    int secs, hist_n, av_n;
+};
+
+struct pll_state pll_state;
+
+static struct pll_kalman kf;
+/* Warm start, see pll_seed() */
+static double seed_b;
+static int seeded;
+
+
+static void
+kf_predict(void) {
+    /* Advance the model by one second, including the correction applied over
+     * that second */
+    static const double F[3][3] = {{1, 1, .5}, {0, 1, 1}, {0, 0, 1}};
+    double FP[3][3];
+    int i, j, m;
+    kf.x[0] += kf.x[1] + kf.x[2] / 2 + kf.u;
+    kf.x[1] += kf.x[2];
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            FP[i][j] = 0;
+            for (m = 0; m < 3; m++) {
+                FP[i][j] += F[i][m] * kf.P[m][j];
+            }
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            kf.P[i][j] = 0;
+            for (m = 0; m < 3; m++) {
+                kf.P[i][j] += FP[i][m] * F[j][m];
+            }
+        }
+    }
+    /* Process noise for tau = 1 */
+    kf.P[0][0] += kf.q_freq / 3 + kf.q_drift / 20;
+    kf.P[0][1] += kf.q_freq / 2 + kf.q_drift / 8;
+    kf.P[1][0] += kf.q_freq / 2 + kf.q_drift / 8;
+    kf.P[0][2] += kf.q_drift / 6;
+    kf.P[2][0] += kf.q_drift / 6;
+    kf.P[1][1] += kf.q_freq + kf.q_drift / 3;
+    kf.P[1][2] += kf.q_drift / 2;
+    kf.P[2][1] += kf.q_drift / 2;
+    kf.P[2][2] += kf.q_drift;
+    kf.u_sum += kf.u;
+    kf.secs++;
+}
+
+
+static double
+kf_avar(int tau) {
+    /* Allan variance at tau seconds from the newest three samples that far
+     * apart */
+    int k = tau / KF_TAU0;
+    double d = kf.hist[0] - 2 * kf.hist[k] + kf.hist[2 * k];
+    return d * d / (2.0 * tau * tau);
+}
+
+
+static void
+kf_learn(double z, double R) {
+    /* Sample the free running phase every KF_TAU0 seconds, and once there is
+     * enough history fit the frequency noise to its Allan variance */
+    int i;
+    if (kf.secs % KF_TAU0 != 0) {
+        return;
+    }
+    for (i = KF_HIST - 1; i > 0; i--) {
+        kf.hist[i] = kf.hist[i - 1];
+    }
+    kf.hist[0] = z - kf.u_sum;
+    if (kf.hist_n < KF_HIST) {
+        kf.hist_n++;
+        return;
+    }
+    if (kf.av_n < KF_AV_MJ) {
+        kf.av_n++;
+    }
+    kf.av1 += (kf_avar(KF_TAU1) - kf.av1) / kf.av_n;
+    if (kf.av_n < KF_AV_MIN) {
+        return;
+    }
+    /* Take out the white phase noise and the rest is the random walk */
+    kf.q_freq = 3 * (kf.av1 - 3 * R / ((double)KF_TAU1 * KF_TAU1)) / KF_TAU1;
+    if (kf.q_freq < KF_Q_FREQ_MIN) {
+        kf.q_freq = KF_Q_FREQ_MIN;
+    }
+}
+
+
+static void
+kf_forget(void) {
+    /* The phase history is no good across a gap or a step */
+    kf.hist_n = 0;
+    kf.secs = 0;
+}
+
+
+static int
+kf_update(double z, double R) {
+    double S, K[3], inn, P0[3];
+    int i, j;
+    inn = z - kf.x[0];
+    S = kf.P[0][0] + R;
+    if (pll_state.st >= 3 && inn * inn > KF_GATE * KF_GATE * S) {
+        if (++kf.gated < KF_GATE_MAX) {
+            return 0;
+        }
+        /* The PPS really moved, or the oscillator did. Open up the phase and
+         * the frequency by as much as that would take, and take it. */
+        kf.P[0][0] += inn * inn;
+        kf.P[1][1] += inn * inn / (KF_GATE_MAX * KF_GATE_MAX);
+        S = kf.P[0][0] + R;
+        kf_forget();
+    }
+    kf.gated = 0;
+    for (i = 0; i < 3; i++) {
+        K[i] = kf.P[i][0] / S;
+        P0[i] = kf.P[0][i];
+    }
+    kf.k_freq = K[1];
+    for (i = 0; i < 3; i++) {
+        kf.x[i] += K[i] * inn;
+        for (j = 0; j < 3; j++) {
+            kf.P[i][j] -= K[i] * P0[j];
+        }
+    }
+    /* Keep it symmetric */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < i; j++) {
+            kf.P[i][j] = kf.P[j][i] = (kf.P[i][j] + kf.P[j][i]) / 2;
+        }
+    }
+    return 1;
+}
+
+
+static void
+kf_init(double z) {
+    int i, j;
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            kf.P[i][j] = 0;
+        }
+    }
+    kf.x[0] = z;
+    kf.x[1] = -seed_b;
+    kf.x[2] = 0;
+    kf.P[0][0] = KF_P_PHASE;
+    kf.P[1][1] = seeded ? KF_P_SEEDED : KF_P_FREQ;
+    kf.P[2][2] = KF_P_DRIFT;
+    kf.ly = z;
+    kf.ddy = 0;
+    kf.say = 0;
+    kf.gated = 0;
+    kf.k_freq = 0;
+    kf.n = 0;
+    kf.q_freq = KF_Q_FREQ;
+    kf.q_drift = KF_Q_DRIFT;
+    kf.u_sum = 0;
+    kf.av1 = 0;
+    kf.av_n = 0;
+    kf_forget();
+    pll_state.dy = 0;
+    pll_state.sdy = 0;
+    pll_state.st = 1;
+    sys_able |= ABLE_PLL_UNLOCKED;
+}
+
+
+static double
+kf_correction(void) {
+    /* Cancel the frequency and drift, and steer out the phase. Once locked,
+     * the steering and the frequency updates make a second order loop, and
+     * the steering is set from the frequency gain to damp it critically.
+     * Steering any harder only follows the noise in the phase estimate. */
+    double g = KF_STEER_MAX;
+    if (pll_state.st >= 3) {
+        g = 2 * sqrt(kf.k_freq) - kf.k_freq;
+        if (g > KF_STEER_MAX) {
+            g = KF_STEER_MAX;
+        } else if (!(g > KF_STEER_MIN)) {
+            g = KF_STEER_MIN;
+        }
+    }
+    kf.u = -(kf.x[1] + kf.x[2] / 2) - g * kf.x[0];
+    return kf.u;
+}
+
+
+void
+pll_reset(void) {
+    pll_state.st = 0;
+    sys_able |= ABLE_PLL_UNLOCKED;
+}
+
+
+double
+pll_poll(void) {
+    /* No measurement, coast on the model */
+    if (pll_state.st == 0) {
+        return seed_b;
+    }
+    /* Only carry on a drift that stands out from its uncertainty. Over an
+     * hour of holdover a drift that is only noise costs more than one that
+     * is left out. */
+    if (kf.x[2] * kf.x[2] < 4 * kf.P[2][2]) {
+        kf.x[2] = 0;
+    }
+    kf_predict();
+    kf_forget();
+    return kf_correction();
+}
+
+
+double
+pll_math(double y) {
+    double dy, R;
+    int j;
+    /* Same sign as vtimer's delta: positive when the vtimer is ahead */
+    if (pll_state.st == 0) {
+        kf_init(y);
+        return kf_correction();
+    }
+    kf_predict();
+
+    /* Measurement noise from the Allan estimate */
+    if (kf.n < KF_MJ) {
+        kf.n++;
+    }
+    dy = y - kf.ly;
+    kf.say += (fabs(dy - kf.ddy) - kf.say) / kf.n;
+    pll_state.sdy += (fabs(dy) - pll_state.sdy) / kf.n;
+    kf.ddy = dy;
+    kf.ly = y;
+    R = kf.say / KF_AVAR_SIGMA;
+    R *= R;
+    if (R < KF_R_MIN) {
+        R = KF_R_MIN;
+    }
+
+    if (kf_update(y, R)) {
+        kf_learn(y, R);
+    } else {
+        kf_forget();
+    }
+
+    /* Sanity check, as in the PLL */
+    if (fabs(kf.x[1]) > 128e-6) {
+        seeded = 0;
+        seed_b = 0;
+        pll_state.st = 0;
+        sys_able |= ABLE_PLL_UNLOCKED;
+        return 0;
+    }
+
+    if (pll_state.st < 3 && sqrt(kf.P[0][0]) < KF_LOCK_PHASE) {
+        pll_state.st = 3;
+        sys_able &= ~ABLE_PLL_UNLOCKED;
+    }
+    if (pll_state.st == 3 && sqrt(kf.P[1][1]) < KF_LOCK_FREQ) {
+        pll_state.st = 4;
+        /* The seed has been replaced by something better */
+        seeded = 0;
+        seed_b = 0;
+    }
+
+    /* Report in the PLL's terms. The equivalent averaging factor is the
+     * inverse of the phase gain. */
+    j = (int)(1.0 / (kf.P[0][0] / (kf.P[0][0] + R)));
+    pll_state.j = j < 1 ? 1 : (j > 100000 ? 100000 : j);
+    pll_state.my = -kf.x[0];
+    pll_state.dy = -dy;
+    pll_state.say = kf.say;
+    return kf_correction();
+}
+
+
+void
+pll_seed(double b, int tightened) {
+    /* Preset the frequency for the next time the filter starts over. There is
+     * nothing to tighten, so that is ignored. */
+    (void)tightened;
+    if (b > 128e-6 || b < -128e-6) {
+        return;
+    }
+    seed_b = b;
+    seeded = 1;
+}
+
+
+int
+pll_learned(double *b, int *tightened) {
+    if (pll_state.st < 4) {
+        return 0;
+    }
+    *b = -kf.x[1];
+    *tightened = 0;
+    return 1;
+}
+
+
+void
+init_pllmath(void) {
+}
+
+#endif
@@ -19,7 +19,12 @@
 //#include <isc/eventlib.h>
 #include <math.h>
 
+#include "app_config.h"
 #include "ntpns.h"
+
+/* See pllfixed.c for the integer version, and pllkalman.c */
+#if !USE_PLL_FIXED && !USE_PLL_KALMAN
+
 #if 0
 #include "ntpns_cfg.h"
 #include "internal.h"
@@ -33,6 +38,10 @@
 
 struct pll_state pll_state;
 
+/* Warm start, see pll_seed() */
+static double seed_b;
+static int seed_tn, tn;
+
 /*---------------------------------------------------------------------*/
 
 void
@@ -93,7 +102,7 @@ pll_math(double y)
 		ps->dl = ps->dl0;
 		ps->wa = ps->wa0;
 		ps->j = 0;
-		ps->b = 0;
+		ps->b = seed_b;
 		ps->c = 0;
 		ps->my = 0;
 		ps->ly = 0;
@@ -102,6 +111,7 @@ pll_math(double y)
 		ps->say = 0;
 		ps->sdy = 0;
 		ps->zc = 0;
+		tn = 0;
 
 		ps->st = 1;	/* Goto state 1 */
 
@@ -263,13 +273,21 @@ pll_math(double y)
 	 * XXX: 10 is emperical.
 	 */
 	if (ps->st >= 4 && fabs(ps->my) < ps->say * .1 && ps->zc < 10) {
-		if (ps->wa > ps->wamin) {
-			ps->wa *= .9;
-			ps->mj /= .8;
-			ps->dl = ps->mj;
-		} else {
-			ps->dl = ps->mj;
-		}
+		/*
+		 * After a warm start, go straight back to the tightening
+		 * that was reached before.  The seed is only trusted until
+		 * we get here.
+		 */
+		do {
+			if (ps->wa > ps->wamin) {
+				ps->wa *= .9;
+				ps->mj /= .8;
+				tn++;
+			}
+		} while (tn < seed_tn && ps->wa > ps->wamin);
+		seed_b = 0;
+		seed_tn = 0;
+		ps->dl = ps->mj;
 		if (ps->st >= 5)
 			ps->dl *= ps->t3;
 		return (ps->z);
@@ -277,6 +295,41 @@ pll_math(double y)
 	return (ps->z);
 }
 
+/*
+ * Preset the frequency and tightening for the next time the PLL starts
+ * over, e.g. with values saved before a restart.  The 1st order loop
+ * still has to pull the phase in, but the frequency is already close.
+ * A negative tightening leaves the preset one alone.
+ */
+void
+pll_seed(double b, int tightened)
+{
+
+	if (fabs(b) > 128e-6)
+		return;
+	seed_b = b;
+	if (tightened >= 0)
+		seed_tn = tightened;
+	/* Also use it for holdover until the first PPS arrives */
+	if (pll_state.st == 0)
+		pll_state.b = b;
+}
+
+/*
+ * Get the values worth saving for pll_seed(), if the PLL has converged.
+ */
+int
+pll_learned(double *b, int *tightened)
+{
+	struct pll_state *ps = &pll_state;
+
+	if (ps->st < 4)
+		return (0);
+	*b = ps->b;
+	*tightened = tn;
+	return (1);
+}
+
 #if 0
 int
 show_pllmath(CK_ARG)
@@ -394,3 +447,5 @@ init_pllmath(void)
 	ps->wamax = DEF_wamax;
 	//ck_TreeAdd(cft, &config_pllmath);
 }
+
+#endif /* !USE_PLL_FIXED */
@@ -11,75 +11,145 @@
 #include "task.h"
 
 #include "eeprom.h"
+#include "init.h"
+#define MONO_HI()           TIM2->CNT
+#define MONO_LO()           TIM3->CNT
+#define MONO_UIF()          (TIM2->SR & TIM_SR_UIF)
+#define MONO_UIF_CLEAR()    (TIM2->SR = ~TIM_SR_UIF)
 #include "ppscapture.h"
+#include <string.h>
 
 
-/* High-order part of the monotonic timer */
+/* Most tasks that can sleep at once, and most pending wakeups of any kind */
+#define MONO_SLEEPERS 4
+#define MONO_TIMERS 6
+
+/* The monotonic timer is TIM3 (low half, also does the PPS captures) chained
+ * into TIM2 (high half), so the hardware count is 32 bits and only wraps
+ * about once a minute at 72MHz. This adds the rest. */
 static volatile uint64_t mono_epoch;
-/* Last monotonic capture, or 0 if there are no pending captures */
-static uint64_t mono_capture;
-/* Next sleep, or 0 if none */
-static uint64_t sleep_epoch;
-static SemaphoreHandle_t sleep_flag;
+/* PPS captures for the PLL thread */
+static struct pps_ring pps;
+
+/* Pending wakeups, soonest first. Either a sleeping task or a function to be
+ * called from the interrupt. */
+struct mono_timer {
+    uint64_t when;
+    SemaphoreHandle_t flag;
+    void (*func)(void);
+};
+static struct mono_timer timers[MONO_TIMERS];
+static uint8_t num_timers;
+/* Wakeup flags, each borrowed by one sleeper at a time */
+static SemaphoreHandle_t sleep_flags[MONO_SLEEPERS];
+static uint8_t sleep_flags_used;
+/* Next generated PPS pulse, and pulses that couldn't be made in time */
+static uint64_t pps_rise, pps_fall;
+static uint32_t pps_skipped;
 
-/* Reduce this to 1500 to make it easier to hit edge cases to test the input
- * capture code */
-#define MONO_PERIOD 65536
+static uint64_t mono_read(uint16_t *lo);
+static void timer_insert(uint64_t when, SemaphoreHandle_t flag,
+        void (*func)(void));
+static void timer_arm(void);
+static void ppsgen_setup(void);
 
 
 void
 ppscapture_start(void) {
-    ASSERT((sleep_flag = xSemaphoreCreateBinary()));
-    mono_epoch = MONO_PERIOD;
-    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
-    TIM3->CR1 = 0;
+    int i;
+    for (i = 0; i < MONO_SLEEPERS; i++) {
+        ASSERT((sleep_flags[i] = xSemaphoreCreateBinary()));
+    }
+    mono_epoch = MONO_WRAP;
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN | RCC_APB1ENR_TIM3EN;
+    TIM2->CR1 = TIM3->CR1 = 0;
+
+    /* High half counts TIM3 updates (ITR2) */
+    TIM2->PSC = 0;
+    TIM2->ARR = 0xFFFF;
+    TIM2->CNT = 0;
+    TIM2->SMCR = TIM_SMCR_TS_1 | TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1 | TIM_SMCR_SMS_0;
+    /* compare 1 waits for the high half of the next wakeup */
+    TIM2->CCMR1 = 0;
+    TIM2->DIER = TIM_DIER_UIE;
+    TIM2->SR = 0;
+    TIM2->CR1 = TIM_CR1_CEN;
+
+    /* Low half runs from the core clock and drives the high half */
     TIM3->PSC = 0;
     TIM3->ARR = MONO_PERIOD - 1;
-    /* input capture 1 or 3 receives the pulse-per-second */
+    TIM3->CNT = 0;
+    TIM3->CR2 = TIM_CR2_MMS_1;
+    /* input capture 1 or 3 receives the pulse-per-second, compare 2 (no
+     * output) does the low half of the next wakeup */
     TIM3->CCMR1 = TIM_CCMR1_CC1S_0;
     TIM3->CCMR2 = TIM_CCMR2_CC3S_0;
     TIM3->CCER = (cfg.flags & FLAG_GPSEXT) ? TIM_CCER_CC3E : TIM_CCER_CC1E;
-    /* interrupt on update and input capture */
-    TIM3->DIER = TIM_DIER_UIE | TIM_DIER_CC1IE | TIM_DIER_CC3IE;
+    /* interrupt on input capture, compare enabled when needed */
+    TIM3->DIER = TIM_DIER_CC1IE | TIM_DIER_CC3IE;
+    if ((cfg.flags & (FLAG_PPSGEN | FLAG_GPSEXT)) == FLAG_PPSGEN) {
+        ppsgen_setup();
+    }
     TIM3->SR = 0;
 
+    NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_PPSCAPTURE);
     NVIC_SetPriority(TIM3_IRQn, IRQ_PRIO_PPSCAPTURE);
+    NVIC_EnableIRQ(TIM2_IRQn);
     NVIC_EnableIRQ(TIM3_IRQn);
     TIM3->CR1 |= TIM_CR1_CEN;
 }
 
 
+void
+TIM2_IRQHandler(void) {
+    uint16_t sr;
+    /* Flags of disabled events still get set, so ignore those */
+    sr = TIM2->SR & TIM2->DIER;
+    TIM2->SR = ~sr;
+
+    if (sr & TIM_SR_UIF) {
+        mono_epoch += MONO_WRAP;
+    }
+    if (sr & TIM_SR_CC1IF) {
+        /* High half of the next wakeup */
+        timer_arm();
+    }
+}
+
+
 void
 TIM3_IRQHandler(void) {
-    uint16_t sr, ccr;
-    sr = TIM3->SR;
+    uint16_t sr, ccr, lo;
+    uint8_t channel;
+    uint64_t now;
+    /* Flags of disabled events still get set, including compare 3 on every
+     * match while it generates the PPS, so ignore those */
+    sr = TIM3->SR & TIM3->DIER;
     TIM3->SR = ~sr;
 
-    if (sr & TIM_SR_UIF) {
-        mono_epoch += MONO_PERIOD;
-        if (sleep_epoch != 0 && mono_epoch >= sleep_epoch) {
-            BaseType_t wakeup = 0;
-            sleep_epoch = 0;
-            xSemaphoreGiveFromISR(sleep_flag, &wakeup);
-            portEND_SWITCHING_ISR(wakeup);
-        }
+    if (sr & TIM_SR_CC2IF) {
+        timer_arm();
     }
 
     if (sr & TIM_SR_CC1IF) {
         ccr = TIM3->CCR1;
+        channel = 1;
     } else if (sr & TIM_SR_CC3IF) {
         ccr = TIM3->CCR3;
+        channel = 3;
     } else {
         return;
     }
 
-    mono_capture = mono_epoch + ccr;
-    if ((sr & TIM_SR_UIF) && ccr > (MONO_PERIOD / 2)) {
-        /* This capture is from the previous period, but the update has already
-         * been processed above so undo its effect.
-         */
-        mono_capture -= MONO_PERIOD;
-    }
+    now = mono_read(&lo);
+    pps_ring_put(&pps, mono_from_capture(now, lo, ccr), channel);
+}
+
+
+static uint64_t
+mono_read(uint16_t *lo) {
+    /* See monotonic.h */
+    return mono_read_hw(&mono_epoch, lo);
 }
 
 
@@ -87,41 +157,186 @@ uint64_t
 monotonic_now(void) {
     /* Get value of monotonic clock */
     uint64_t ret;
-    uint16_t tmr1, tmr2;
+    uint16_t lo;
     DISABLE_IRQ();
-    while (1) {
-        tmr1 = TIM3->CNT;
-        ret = mono_epoch;
-        tmr2 = TIM3->CNT;
-        if (tmr2 > tmr1) {
-            break;
+    ret = mono_read(&lo);
+    ENABLE_IRQ();
+    return ret;
+}
+
+
+int
+monotonic_get_capture(pps_capture_t *cap, uint32_t *dropped) {
+    /* Get the oldest PPS capture not yet seen, see pps_ring_get() */
+    return pps_ring_get(&pps, cap, dropped);
+}
+
+
+uint32_t
+monotonic_capture_seq(void) {
+    /* Sequence number of the newest PPS capture */
+    return pps.head;
+}
+
+
+static void
+timer_insert(uint64_t when, SemaphoreHandle_t flag, void (*func)(void)) {
+    /* Add a wakeup to the list. Interrupts must be masked. */
+    uint8_t i;
+    ASSERT(num_timers < MONO_TIMERS);
+    for (i = num_timers; i > 0 && timers[i - 1].when > when; i--) {
+        timers[i] = timers[i - 1];
+    }
+    timers[i].when = when;
+    timers[i].flag = flag;
+    timers[i].func = func;
+    num_timers++;
+}
+
+
+static void
+timer_arm(void) {
+    /* Run everything whose time has come, then point the compare channels at
+     * the next deadline. Called with interrupts masked or from the timer
+     * interrupts. */
+    BaseType_t wakeup = 0;
+    struct mono_timer t;
+    uint64_t now, when;
+    uint16_t lo;
+    while (num_timers) {
+        when = timers[0].when;
+        now = mono_read(&lo);
+        if (now >= when) {
+            t = timers[0];
+            num_timers--;
+            memmove(&timers[0], &timers[1], num_timers * sizeof(timers[0]));
+            if (t.flag) {
+                xSemaphoreGiveFromISR(t.flag, &wakeup);
+            } else {
+                t.func();
+            }
+            continue;
+        }
+        if ((when >> 16) == (now >> 16)) {
+            /* Same low period, so compare the low half for the exact tick */
+            TIM2->DIER &= ~TIM_DIER_CC1IE;
+            TIM3->CCR2 = (uint16_t)when;
+            TIM3->SR = ~TIM_SR_CC2IF;
+            TIM3->DIER |= TIM_DIER_CC2IE;
+            /* Check that it didn't go by while arming */
+            if (mono_read(&lo) < when) {
+                break;
+            }
+        } else {
+            /* Wait for the high half first. It might match in an earlier
+             * wrap, which just comes back here. */
+            TIM3->DIER &= ~TIM_DIER_CC2IE;
+            TIM2->CCR1 = (uint16_t)(when >> 16);
+            TIM2->SR = ~TIM_SR_CC1IF;
+            TIM2->DIER |= TIM_DIER_CC1IE;
+            if ((mono_read(&lo) >> 16) < (when >> 16)) {
+                break;
+            }
         }
-        /* Timer rolled over while we were sampling. Process the update event
-         * now */
-        TIM3_IRQHandler();
     }
-    ENABLE_IRQ();
-    return ret + tmr2;
+    if (!num_timers) {
+        TIM2->DIER &= ~TIM_DIER_CC1IE;
+        TIM3->DIER &= ~TIM_DIER_CC2IE;
+    }
+    portEND_SWITCHING_ISR(wakeup);
 }
 
 
-uint64_t
-monotonic_get_capture(void) {
-    /* Get the previous PPS capture */
-    uint64_t ret;
+void
+monotonic_sleep_until(uint64_t mono_when) {
+    /* Block the calling task until the monotonic clock reaches mono_when */
+    SemaphoreHandle_t flag = NULL;
+    uint8_t i;
+    DISABLE_IRQ();
+    for (i = 0; i < MONO_SLEEPERS; i++) {
+        if (!(sleep_flags_used & (1 << i))) {
+            sleep_flags_used |= 1 << i;
+            flag = sleep_flags[i];
+            break;
+        }
+    }
+    ASSERT(flag);
+    timer_insert(mono_when, flag, NULL);
+    timer_arm();
+    ENABLE_IRQ();
+    xSemaphoreTake(flag, portMAX_DELAY);
     DISABLE_IRQ();
-    ret = mono_capture;
-    mono_capture = 0;
+    sleep_flags_used &= ~(1 << i);
     ENABLE_IRQ();
-    return ret;
+}
+
+
+static void
+ppsgen_setup(void) {
+    /* Drive the PPS connector pin (PC8) from compare 3 instead of capturing
+     * from it. It stays low until a pulse is scheduled. */
+    TIM3->DIER &= ~TIM_DIER_CC3IE;
+    TIM3->CCER &= ~TIM_CCER_CC3E;
+    TIM3->CCMR2 = TIM_CCMR2_OC3M_2;
+    TIM3->CCER |= TIM_CCER_CC3E;
+    GPIOC->CRH = (GPIOC->CRH & ~0xF) | GPIO_MODE_50MHZ | GPIO_AFIO_PP;
+}
+
+
+static void
+ppsgen_fall(void) {
+    uint16_t lo;
+    if (!ppsgen_in_time(mono_read(&lo), pps_fall)) {
+        /* Held off past the edge, so end the pulse now rather than a low
+         * period late */
+        TIM3->CCMR2 = TIM_CCMR2_OC3M_2;
+        pps_skipped++;
+        return;
+    }
+    TIM3->CCR3 = (uint16_t)pps_fall;
+    TIM3->CCMR2 = TIM_CCMR2_OC3M_1;
+}
+
+
+static void
+ppsgen_rise(void) {
+    /* Less than one low period before the edge, so the next match of the low
+     * half is the right one and the hardware sets the pin on the exact tick */
+    uint16_t lo;
+    if (!ppsgen_in_time(mono_read(&lo), pps_rise)) {
+        /* Held off past the edge, skip the pulse instead of sending it late */
+        pps_skipped++;
+        return;
+    }
+    TIM3->CCR3 = (uint16_t)pps_rise;
+    TIM3->CCMR2 = TIM_CCMR2_OC3M_0;
+    timer_insert(pps_fall - PPSGEN_LEAD, NULL, ppsgen_fall);
 }
 
 
 void
-monotonic_sleep_until(uint64_t mono_when) {
-    mono_when -= mono_when % MONO_PERIOD;
+ppsgen_pulse(uint64_t mono_rise, uint64_t mono_fall) {
+    /* Output a pulse on the PPS pin between the given monotonic times */
+    uint16_t lo;
+    if ((cfg.flags & (FLAG_PPSGEN | FLAG_GPSEXT)) != FLAG_PPSGEN) {
+        return;
+    }
     DISABLE_IRQ();
-    sleep_epoch = mono_when;
+    if (mono_rise < mono_read(&lo) + PPSGEN_MARGIN) {
+        pps_skipped++;
+    } else {
+        pps_rise = mono_rise;
+        pps_fall = mono_fall;
+        timer_insert(mono_rise - PPSGEN_LEAD, NULL, ppsgen_rise);
+        timer_arm();
+    }
     ENABLE_IRQ();
-    xSemaphoreTake(sleep_flag, portMAX_DELAY);
+}
+
+
+uint32_t
+ppsgen_skipped(void) {
+    /* Generated pulses skipped or cut short because they were scheduled too
+     * late */
+    return pps_skipped;
 }
@@ -9,14 +9,18 @@
 #ifndef _PPSCAPTURE_H
 #define _PPSCAPTURE_H
 
+#include "monotonic.h"
+
 #define QUANT_LAGGING           1
 #define QUANT_LEADING           2
 
 void ppscapture_start(void);
-uint64_t monotonic_getI(void);
 uint64_t monotonic_now(void);
-uint64_t monotonic_get_capture(void);
+int monotonic_get_capture(pps_capture_t *cap, uint32_t *dropped);
+uint32_t monotonic_capture_seq(void);
 void monotonic_sleep_until(uint64_t mono_when);
+void ppsgen_pulse(uint64_t mono_rise, uint64_t mono_fall);
+uint32_t ppsgen_skipped(void);
 
 
 #endif
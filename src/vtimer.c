@@ -11,6 +11,7 @@
 
 #include "eeprom.h"
 #include "epoch.h"
+#include "fll.h"
 #include "init.h"
 #include "logging.h"
 #include "main.h"
@@ -19,41 +20,136 @@
 #include "ppscapture.h"
 #include "status.h"
 #include "vtimer.h"
+#include "vtstate.h"
+#include "net/ntpserver.h"
+#include "lwip/inet_chksum.h"
+#include "stm32/dwt.h"
 #include "stm32/iwdg.h"
 #include <math.h>
+#include <string.h>
 
 unsigned sys_able;
 TaskHandle_t thread_vtimer;
 
-/* (vt_rate / 2^VT_RATE_PREC) NTP fractions per tick of monotonic time */
-static uint64_t vt_rate;
+/* Working copy, only used by the PLL thread */
+static struct vt_state vt;
+/* Copy for everyone else */
+static struct vt_published vt_pub;
 /* Nominal rate for the current nominal system frequency */
 static double vt_rate_nominal;
-/* VT value at the last timer update */
-static uint64_t vt_last;
-/* Monotonic value at the last timer update */
-static uint64_t mono_last;
 /* Saved corrections from GPS */
 static uint32_t utc_next;
-static float quant_corr, quant_corr_deferred;
+/* Quantization corrections from the GPS, by the sequence number of the PPS
+ * edge they belong to. Some receivers also say which second the edge marks. */
+#define QUANT_SLOTS 4
+static struct {
+    uint32_t seq;
+    float corr;
+    uint32_t label;
+} quant[QUANT_SLOTS];
+/* While edges are being labelled, time of day messages are ignored */
+#define LABEL_HOLD  pdMS_TO_TICKS(4000)
+/* PPS edges that were overwritten before being read, and edges that were not
+ * a whole number of seconds after the last good one */
+static uint32_t pps_dropped, pps_glitches;
+/* Last good PPS edge */
+static uint64_t pps_good;
 /* Saved loopstats report for SNMP */
 int32_t loopstats_values[LOOPSTATS_VALUES];
-
-#define VT_RATE_PREC 28
+/* Longest each kind of interrupt-masked section has run, in CPU cycles */
+uint32_t vtimer_masked_max[VT_MASKED_SECTIONS];
+
+/* Clock state as of the last PLL iteration. Not cleared at startup, so after
+ * a software or watchdog reset it is used to resume with the same frequency
+ * while PPS is reacquired. */
+struct vt_checkpoint {
+    uint64_t rate;
+    /* PLL frequency estimate, valid if tightened >= 0 */
+    double freq;
+    uint32_t magic;
+    /* vtimer time of the checkpoint, 0 if the time of day was not valid */
+    uint32_t seconds;
+    uint32_t frac;
+    /* PLL noise estimate for the dispersion */
+    float disp;
+    /* Longest the reset could have come after the checkpoint, in seconds */
+    float late;
+    /* PLL tightening, or -1 if it had not converged */
+    int16_t tightened;
+    uint16_t crc;
+};
+static struct vt_checkpoint __attribute__((section(".uninit"))) checkpoint;
+#define CHECKPOINT_MAGIC 0x7c4f19e2
+/* Dispersion restored from the checkpoint, used until the PLL converges */
+static float disp_restored;
+/* Error in the restored time of day, until the GPS confirms it */
+static float disp_tod;
+/* Last PLL state saved or queued, and the one waiting for the main thread */
+static pllsave_t pllsave_last, pllsave_next;
+static volatile uint8_t pllsave_pending;
+/* Frequency-locked acquisition, see fll.h */
+static struct fll fll;
+/* Nonzero while the PLL runs on a frequency saved before the restart */
+static uint8_t pll_seeded;
+
+/* Frequency tolerance for dispersion growth in holdover, per RFC 5905 */
+#define DISP_PHI 15e-6
+/* Time from a reset to the clock being restored, mostly spent in the
+ * bootloader. Taken as both the estimate and its error. */
+#define RESTORE_BOOT_TIME   0.5f
+/* Only claim the restored time of day if it is at least this good */
+#define RESTORE_MAX_DISP    1.0f
+/* Seconds of lock before the PLL state is first saved, and between saves */
+#define PLLSAVE_FIRST       3600
+#define PLLSAVE_INTERVAL    (6 * 3600)
+/* Don't bother saving unless the frequency moved by at least this much */
+#define PLLSAVE_MIN_DELTA   10e-9
 
 static void pll_thread(void *p);
-static uint64_t vtimer_getI(uint64_t mono_next);
-static void vtimer_updateI(void);
-static double vtimer_get_frac_delta(uint64_t mono_capture);
+static void vtimer_commit(void);
+static void vtimer_update(void);
+static uint64_t vtimer_next_pps(uint32_t *seq);
+static double vtimer_get_frac_delta(uint64_t mono_capture, uint32_t seq,
+        uint32_t *label);
 static void vtimer_step(double dd);
+static int8_t vtimer_measure_precision(void);
+static void vtimer_publish(int8_t precision, uint64_t ref_time,
+        TickType_t since_pps);
+static void vtimer_warm_start(void);
+static void vtimer_restore(void);
+static void vtimer_checkpoint(void);
+static void vtimer_save_pll(void);
+static int vtimer_fll(uint64_t capture);
+static uint64_t vtimer_to_mono(uint64_t vt_when);
+static void vtimer_pulse(uint64_t vt_rise);
+
+
+static inline uint32_t
+masked_enter(void) {
+    DISABLE_IRQ();
+    return DWT_CYCCNT;
+}
+
+
+static inline void
+masked_exit(int which, uint32_t start) {
+    uint32_t cycles = DWT_CYCCNT - start;
+    if (cycles > vtimer_masked_max[which]) {
+        vtimer_masked_max[which] = cycles;
+    }
+    ENABLE_IRQ();
+}
 
 
 void
 vtimer_start(void) {
+    dwt_start();
     init_pllmath();
     pll_reset();
-    quant_corr = quant_corr_deferred = 0.0f;
     vt_rate_nominal = NTP_TO_FLOAT / system_frequency;
+    /* A checkpoint from before a reset is fresher than the saved one */
+    vtimer_warm_start();
+    vtimer_restore();
     ASSERT(xTaskCreate(pll_thread, "vtimer", VTIMER_STACK_SIZE, NULL,
                 THREAD_PRIO_VTIMER, &thread_vtimer));
 }
@@ -61,19 +157,30 @@ vtimer_start(void) {
 
 static void
 pll_thread(void *p) {
-    static TickType_t last_pps;
+    static TickType_t last_pps, last_label;
     static uint64_t tmp, last;
+    static uint32_t seq, last_dropped, last_glitches, last_skipped, label;
     static int64_t tmps;
     static double delta, ppb;
     static uint8_t desync = 0;
     static uint16_t old_status;
     static uint16_t next_report = 0;
+    static uint16_t next_save = PLLSAVE_FIRST;
     static float ojit = 0, fjit = 0, ppb_last = 0, ppb_delta;
+    static uint64_t ref_time;
+    static int8_t precision;
+    uint32_t masked;
+    precision = vtimer_measure_precision();
+    if (disp_restored != 0.0f) {
+        /* Phase is meaningless after a reset, step on the first PPS */
+        desync = 4;
+    }
     while (1) {
-        tmp = monotonic_get_capture();
+        tmp = vtimer_next_pps(&seq);
         old_status = status_flags;
         if (tmp && !(cfg.flags & FLAG_HOLDOVER_TEST)) {
-            delta = vtimer_get_frac_delta(tmp);
+            ref_time = vt_calc(&vt, tmp);
+            delta = vtimer_get_frac_delta(tmp, seq, &label);
             if (status_flags & STATUS_PLL_OK) {
                 if (pll_state.st < 3) {
                     log_write(LOG_WARNING, "vtimer", "PLL is not locked!");
@@ -92,6 +199,8 @@ pll_thread(void *p) {
                     vtimer_step(-delta);
                     init_pllmath();
                     pll_reset();
+                    /* Measure the frequency again before restarting */
+                    fll_restart(&fll);
                     desync = 0;
                     log_write(LOG_NOTICE, "vtimer",
                             "step(PPS) %d us", (int)(-delta * 1e6));
@@ -104,7 +213,11 @@ pll_thread(void *p) {
                 set_status(STATUS_PPS_OK);
             }
             last_pps = xTaskGetTickCount();
-            ppb = pll_math(delta);
+            if (vtimer_fll(tmp)) {
+                ppb = pll_poll();
+            } else {
+                ppb = pll_math(delta);
+            }
         } else {
             if (((xTaskGetTickCount() - last_pps) >= pdMS_TO_TICKS(5000))
                     && (status_flags & STATUS_PPS_OK)) {
@@ -118,7 +231,7 @@ pll_thread(void *p) {
             }
             if (tmp && next_report == 0) {
                 /* Holdover test mode */
-                delta = vtimer_get_frac_delta(tmp);
+                delta = vtimer_get_frac_delta(tmp, seq, NULL);
                 log_write(LOG_WARNING, "vtimer", "HOLDOVER TEST!  current offset: %d ns", (int)(delta*1e9));
             }
             ppb = pll_poll();
@@ -126,21 +239,34 @@ pll_thread(void *p) {
         kern_freq(ppb);
 
         /* Update vtimer */
-        DISABLE_IRQ();
-        vtimer_updateI();
+        vtimer_update();
+        last = vt.vt_last;
         tmps = 0;
-        last = vt_last;
-        if (utc_next != 0) {
-            tmps = (int64_t)utc_next - (int64_t)(last >> 32);
+        masked = masked_enter();
+        if (label != 0) {
+            /* The receiver said which second this edge was, so compare it to
+             * the edge itself rather than to whenever the message came in */
+            tmps = (int64_t)label - (int64_t)((ref_time + NTP_SECOND / 2) >> 32);
+            label = 0;
+            last_label = xTaskGetTickCount() | 1;
             utc_next = 0;
             status_flags |= STATUS_TOD_OK;
+            disp_tod = 0.0f;
+        } else if (utc_next != 0) {
+            if (last_label == 0
+                    || xTaskGetTickCount() - last_label >= LABEL_HOLD) {
+                tmps = (int64_t)utc_next - (int64_t)(last >> 32);
+                status_flags |= STATUS_TOD_OK;
+                disp_tod = 0.0f;
+            }
+            utc_next = 0;
         }
         if (watchdog_main && watchdog_net) {
             iwdg_clear();
             watchdog_main--;
             watchdog_net--;
         }
-        ENABLE_IRQ();
+        masked_exit(VT_MASKED_SECOND, masked);
 
         if (tmps != 0) {
             vtimer_step(tmps);
@@ -150,10 +276,7 @@ pll_thread(void *p) {
             } else {
                 log_write(LOG_NOTICE, "vtimer", "step(UTC) %d sec", (int32_t)tmps);
             }
-            DISABLE_IRQ();
-            vtimer_updateI();
-            last = vt_last;
-            ENABLE_IRQ();
+            last = vt.vt_last;
         }
         if (!(old_status & STATUS_TOD_OK) && (status_flags & STATUS_TOD_OK)) {
             log_write(LOG_NOTICE, "vtimer", "Time of day is correct");
@@ -178,6 +301,8 @@ pll_thread(void *p) {
             loopstats_values[4] = (int)pll_state.j;         /* loopTimeConstant */
             loopstats_values[5] = pll_state.st;             /* pllState */
         }
+        vtimer_publish(precision, ref_time, xTaskGetTickCount() - last_pps);
+        vtimer_checkpoint();
         if (next_report == 0) {
             next_report = cfg.loopstats_interval - 1;
             log_write(LOG_INFO, "loopstats", "off:%dns freq:%dppb jit:%dns fjit:%dppt looptc:%ds state:%d flags:%sPPS,%sToD,%sPLL,%sQUANT",
@@ -189,14 +314,39 @@ pll_thread(void *p) {
                     (status_flags & STATUS_PLL_OK) ? "" : "!",
                     (status_flags & STATUS_USED_QUANT) ? "" : "!");
 
+            if (pps_dropped != last_dropped || pps_glitches != last_glitches) {
+                log_write(LOG_WARNING, "vtimer",
+                        "PPS edges dropped:%u glitches:%u",
+                        (unsigned)pps_dropped, (unsigned)pps_glitches);
+                last_dropped = pps_dropped;
+                last_glitches = pps_glitches;
+            }
+            if (ppsgen_skipped() != last_skipped) {
+                last_skipped = ppsgen_skipped();
+                log_write(LOG_WARNING, "vtimer",
+                        "PPS output pulses skipped:%u", (unsigned)last_skipped);
+            }
         } else {
             next_report--;
         }
 
+        /* Save the learned frequency once it has been stable for a while */
+        if ((status_flags & (STATUS_PLL_OK | STATUS_TOD_OK))
+                != (STATUS_PLL_OK | STATUS_TOD_OK)) {
+            next_save = PLLSAVE_FIRST;
+        } else if (--next_save == 0) {
+            vtimer_save_pll();
+            next_save = PLLSAVE_INTERVAL;
+        }
+
         /* Wait until top of second, blink LED, then run the PLL again 100ms
          * before the next second */
         tmp = last & NTP_MASK_SECONDS;
         tmp += NTP_SECOND; /* top of next second in vtimer time */
+        if (status_flags & STATUS_PLL_OK) {
+            /* Generated PPS, which carries on through holdover */
+            vtimer_pulse(tmp);
+        }
         vtimer_sleep_until(tmp);
         if (~status_flags & STATUS_VALID) {
             GPIO_ON(LED3);
@@ -232,43 +382,330 @@ pll_thread(void *p) {
 }
 
 
-static uint64_t
-vtimer_getI(uint64_t mono_next) {
-    /* Returns the current vtimer time given the current monotonic time */
-    int32_t delta_ticks = mono_next - mono_last;
-    int64_t frac_part = vt_rate * delta_ticks;
-    return vt_last + (frac_part >> VT_RATE_PREC);
+static int8_t
+vtimer_measure_precision(void) {
+    /* Find how long it takes to read the clock, as a power of two seconds */
+    uint64_t first, delta, min_delta = UINT64_MAX;
+    double min_frac;
+    int8_t precision = -32;
+    int i;
+    for (i = 0; i < 8; i++) {
+        first = monotonic_now();
+        (void)vtimer_now();
+        delta = monotonic_now() - first;
+        if (delta < min_delta) {
+            min_delta = delta;
+        }
+    }
+    min_frac = min_delta * vt_rate_nominal;
+    while (precision < 0 && (double)(1ULL << (precision + 32)) < min_frac) {
+        precision++;
+    }
+    return precision;
+}
+
+
+static void
+vtimer_publish(int8_t precision, uint64_t ref_time, TickType_t since_pps) {
+    /* Update the header fields sent to NTP clients. Dispersion is the PLL's
+     * own noise estimate, plus frequency tolerance since the last PPS, plus
+     * the error in a time of day restored after a reset. */
+    double disp;
+    uint8_t leap, stratum;
+    if (status_flags & STATUS_READY) {
+        leap = LEAP_NONE;
+        stratum = 1;
+    } else {
+        /* not synced, advertise as such */
+        leap = LEAP_UNKNOWN;
+        stratum = 16;
+    }
+    disp = pll_state.sdy + pll_state.say;
+    if (pll_state.st >= 4) {
+        disp_restored = 0.0f;
+    } else if (disp < disp_restored) {
+        disp = disp_restored;
+    }
+    disp += disp_tod;
+    disp += DISP_PHI * since_pps / configTICK_RATE_HZ;
+    if (disp > 16.0) {
+        disp = 16.0;
+    }
+    ntp_server_update(leap, stratum, precision,
+            (uint32_t)(disp * 65536.0), ref_time);
+}
+
+
+static void
+vtimer_warm_start(void) {
+    /* Seed the PLL with the frequency saved before the last restart */
+    pllsave_last = cfg.pll_save;
+    if (pllsave_last.saved == 0) {
+        return;
+    }
+    pll_seed(pllsave_last.freq / PLLSAVE_SCALE, pllsave_last.tightened);
+    pll_seeded = 1;
+    log_write(LOG_INFO, "vtimer", "PLL seeded with saved frequency %d ppb",
+            (int)(pllsave_last.freq * 1e9 / PLLSAVE_SCALE));
+}
+
+
+static void
+vtimer_save_pll(void) {
+    /* Queue the converged frequency to be stored in EEPROM. Only rewritten if
+     * it moved, to spare the EEPROM. The write itself is done by the main
+     * thread, see vtimer_save_deferred(). */
+    pllsave_t rec;
+    double freq;
+    int tightened;
+    uint32_t masked;
+    if (!pll_learned(&freq, &tightened)) {
+        return;
+    }
+    if (tightened > UINT8_MAX) {
+        tightened = UINT8_MAX;
+    }
+    if (pllsave_last.saved != 0
+            && pllsave_last.tightened == tightened
+            && fabs(freq - pllsave_last.freq / PLLSAVE_SCALE) < PLLSAVE_MIN_DELTA) {
+        return;
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.freq = (int32_t)(freq * PLLSAVE_SCALE);
+    rec.saved = vt.vt_last >> 48;
+    rec.tightened = tightened;
+    pllsave_last = rec;
+    masked = masked_enter();
+    pllsave_next = rec;
+    pllsave_pending = 1;
+    masked_exit(VT_MASKED_SAVE, masked);
+}
+
+
+void
+vtimer_save_deferred(void) {
+    /* Write out PLL state queued by the PLL thread. Called from the main
+     * thread, so that the PLL thread never waits on the EEPROM. */
+    pllsave_t rec;
+    int16_t rc;
+    uint32_t masked;
+    if (!pllsave_pending) {
+        return;
+    }
+    masked = masked_enter();
+    rec = pllsave_next;
+    pllsave_pending = 0;
+    masked_exit(VT_MASKED_SAVE, masked);
+    rc = eeprom_write_pllsave(&rec);
+    if (rc != EERR_OK) {
+        log_write(LOG_WARNING, "vtimer", "Failed to save PLL state: %d", rc);
+        return;
+    }
+    log_write(LOG_INFO, "vtimer", "Saved PLL frequency %d ppb",
+            (int)(rec.freq * 1e9 / PLLSAVE_SCALE));
+}
+
+
+static int
+vtimer_fll(uint64_t capture) {
+    /* Seed the PLL with the frequency measured by the FLL. Returns nonzero
+     * while still measuring. */
+    double freq;
+    int tightened;
+    if (pll_seeded && pll_learned(&freq, &tightened)) {
+        /* Locked since, so measure again if the clock is stepped */
+        pll_seeded = 0;
+    }
+    if (fll.count < 0) {
+        return 0;
+    }
+    if (pll_seeded) {
+        /* A frequency the PLL converged on before the restart, from the
+         * checkpoint or EEPROM, was averaged over far longer than the FLL's
+         * few seconds. Keep it, including through the step that follows a
+         * restore. */
+        fll.count = -1;
+        return 0;
+    }
+    if (fll_feed(&fll, capture, system_frequency, &freq)) {
+        return 1;
+    }
+    pll_seed(freq, -1);
+    log_write(LOG_INFO, "vtimer", "FLL measured frequency %d ppb",
+            (int)(freq * 1e9));
+    return 0;
+}
+
+
+static void
+vtimer_checkpoint(void) {
+    struct vt_checkpoint cp;
+    double freq;
+    int tightened;
+    memset(&cp, 0, sizeof(cp));
+    cp.rate = vt.rate;
+    if (pll_learned(&freq, &tightened)) {
+        cp.freq = freq;
+        cp.tightened = tightened;
+    } else {
+        cp.tightened = -1;
+    }
+    cp.magic = CHECKPOINT_MAGIC;
+    if ((status_flags & STATUS_TOD_OK) && disp_tod == 0.0f) {
+        cp.seconds = vt.vt_last >> 32;
+        cp.frac = (uint32_t)vt.vt_last;
+    }
+    cp.disp = pll_state.sdy + pll_state.say;
+    /* Taken once a second */
+    cp.late = 1.0f;
+    cp.crc = inet_chksum(&cp, sizeof(cp) - 2);
+    checkpoint = cp;
+}
+
+
+void
+vtimer_checkpoint_reset(void) {
+    /* Stamp the checkpoint with the current time just before a deliberate
+     * reset, so that only the time spent booting is unknown afterwards. Not
+     * in vtimer_masked_max, as nothing runs after it anyway. */
+    uint64_t now;
+    DISABLE_IRQ();
+    if (checkpoint.magic == CHECKPOINT_MAGIC && checkpoint.seconds != 0) {
+        now = vtimer_now();
+        checkpoint.seconds = now >> 32;
+        checkpoint.frac = (uint32_t)now;
+        checkpoint.late = 0.0f;
+        checkpoint.crc = inet_chksum(&checkpoint, sizeof(checkpoint) - 2);
+    }
+    ENABLE_IRQ();
 }
 
+
 static void
-vtimer_updateI(void) {
+vtimer_restore(void) {
+    /* Resume from the checkpoint left by a software or watchdog reset.
+     * Nothing keeps counting through a reset, so the time of day is estimated
+     * from when the checkpoint was taken and how long a reset takes. If that
+     * is good enough the time is served right away, with the estimate's
+     * error added to the dispersion until the GPS confirms it. */
+    struct vt_checkpoint cp = checkpoint;
+    checkpoint.magic = 0;
+    if (cp.magic != CHECKPOINT_MAGIC
+            || inet_chksum(&cp, sizeof(cp) - 2) != cp.crc) {
+        return;
+    }
+    vt.rate = cp.rate;
+    disp_restored = cp.disp > 0.0f ? cp.disp : 1e-6f;
+    if (cp.seconds) {
+        /* Somewhere between 0 and late seconds, then the boot */
+        disp_tod = cp.late / 2 + RESTORE_BOOT_TIME;
+        vt.vt_last = (((uint64_t)cp.seconds << 32) | cp.frac)
+            + (uint64_t)(disp_tod * NTP_SECOND);
+    }
+    vt.mono_last = monotonic_now();
+    vtimer_commit();
+    if (cp.tightened >= 0) {
+        pll_seed(cp.freq, cp.tightened);
+        pll_seeded = 1;
+    }
+    if (cp.seconds && disp_restored + disp_tod <= RESTORE_MAX_DISP) {
+        set_status(STATUS_TOD_OK);
+        log_write(LOG_NOTICE, "vtimer",
+                "Restored clock state from before reset, time of day +/- %d ms",
+                (int)(disp_tod * 1e3f));
+    } else {
+        disp_tod = 0.0f;
+        log_write(LOG_NOTICE, "vtimer", "Restored clock state from before reset");
+    }
+}
+
+
+static void
+vtimer_commit(void) {
+    /* Publish the working copy of the vtimer state */
+    vt_publish(&vt_pub, &vt);
+}
+
+
+static void
+vtimer_update(void) {
     /* Advance the vtimer's "base". Must be called once per second to maintain
      * accuracy. */
     uint64_t mono_next;
     mono_next = monotonic_now();
-    vt_last = vtimer_getI(mono_next);
-    mono_last = mono_next;
+    vt.vt_last = vt_calc(&vt, mono_next);
+    vt.mono_last = mono_next;
+    vtimer_commit();
+}
+
+
+static uint64_t
+vtimer_next_pps(uint32_t *seq) {
+    /* Pick this second's PPS edge out of the captures since the last run,
+     * normally just one. Edges that aren't a whole number of seconds after
+     * the last good one are glitches. Returns 0 if there is none. */
+    static uint8_t bad_runs;
+    pps_capture_t cap;
+    uint64_t ret = 0, bad = 0;
+    double secs, err;
+    while (monotonic_get_capture(&cap, &pps_dropped)) {
+        if (pps_good) {
+            secs = (double)(cap.mono - pps_good) / system_frequency;
+            err = fabs(secs - floor(secs + 0.5));
+            if (secs < 0.5 || err > FLL_MAX_ERR * secs) {
+                pps_glitches++;
+                bad = cap.mono;
+                continue;
+            }
+        }
+        if (ret) {
+            /* Two good-looking edges in one second, keep the first */
+            pps_glitches++;
+            continue;
+        }
+        ret = cap.mono;
+        *seq = cap.seq;
+    }
+    if (ret) {
+        pps_good = ret;
+        bad_runs = 0;
+    } else if (bad && ++bad_runs >= 3) {
+        /* Nothing but "glitches" for a while, so the last good edge was
+         * probably the glitch. Start over from the newest. */
+        pps_good = bad;
+        bad_runs = 0;
+    }
+    return ret;
 }
 
 
 static double
-vtimer_get_frac_delta(uint64_t mono_capture) {
+vtimer_get_frac_delta(uint64_t mono_capture, uint32_t seq, uint32_t *label) {
     /* Convert a PPS capture in monotonic time to vtimer, but only the
-     * fractional second part is kept. */
+     * fractional second part is kept. The edge's second, if known, is
+     * returned in label. */
     uint64_t vt_capture;
     double frac;
-    float corr;
-    DISABLE_IRQ();
-    vt_capture = vtimer_getI(mono_capture);
-    corr = quant_corr;
-    quant_corr= quant_corr_deferred;
-    quant_corr_deferred = 0.0f;
+    float corr = 0.0f;
+    uint32_t masked;
+    vt_capture = vt_calc(&vt, mono_capture);
+    if (label) {
+        *label = 0;
+    }
+    masked = masked_enter();
+    if (quant[seq % QUANT_SLOTS].seq == seq) {
+        corr = quant[seq % QUANT_SLOTS].corr;
+        if (label) {
+            *label = quant[seq % QUANT_SLOTS].label;
+        }
+        quant[seq % QUANT_SLOTS].seq = 0;
+    }
     if (corr != 0.0f) {
         status_flags |= STATUS_USED_QUANT;
     } else {
         status_flags &= ~STATUS_USED_QUANT;
     }
-    ENABLE_IRQ();
+    masked_exit(VT_MASKED_QUANT, masked);
     vt_capture &= NTP_MASK_FRAC;
     frac = (double)(uint32_t)vt_capture / NTP_TO_FLOAT;
     frac += corr;
@@ -287,73 +724,107 @@ kern_freq(double f) {
     } else if (f < -500e-6) {
         f = -500e-6;
     }
-    DISABLE_IRQ();
-    vt_rate = vt_rate_nominal * (1.0 + f) * (1ULL<<VT_RATE_PREC);
-    ENABLE_IRQ();
+    vt.rate = vt_rate_nominal * (1.0 + f) * (1ULL<<VT_RATE_PREC);
+    vtimer_commit();
 }
 
 
 static void
 vtimer_step(double dd) {
     /* Apply a step change to the vtimer */
-    DISABLE_IRQ();
-    vt_last += (int64_t)((double)dd * NTP_TO_FLOAT);
-    vtimer_updateI();
-    ENABLE_IRQ();
+    vt.vt_last += (int64_t)((double)dd * NTP_TO_FLOAT);
+    vtimer_update();
 }
 
 
 uint64_t
 vtimer_now(void) {
-    uint64_t tmp;
-    DISABLE_IRQ();
-    tmp = monotonic_now();
-    tmp = vtimer_getI(tmp);
-    ENABLE_IRQ();
-    return tmp;
+    struct vt_state st;
+    vt_read(&vt_pub, &st);
+    return vt_calc(&st, monotonic_now());
+}
+
+
+uint64_t
+vtimer_from_mono(uint64_t mono) {
+    /* Convert a recent monotonic timestamp to vtimer time */
+    struct vt_state st;
+    vt_read(&vt_pub, &st);
+    return vt_calc(&st, mono);
 }
 
 
 void
 vtimer_set_utc(uint16_t year, uint8_t month, uint8_t day,
         uint8_t hour, uint8_t minute, uint8_t second) {
-    uint32_t ntp_seconds;
+    uint32_t ntp_seconds, masked;
     ntp_seconds = datetime_to_epoch(year, month, day, hour, minute, second);
-    DISABLE_IRQ();
+    masked = masked_enter();
     utc_next = ntp_seconds;
-    ENABLE_IRQ();
+    masked_exit(VT_MASKED_GPS, masked);
 }
 
 
 void
 vtimer_set_gps(uint16_t wkn, uint32_t tow) {
-    uint32_t ntp_seconds = gps_to_epoch(wkn, tow);
-    DISABLE_IRQ();
+    uint32_t ntp_seconds = gps_to_epoch(wkn, tow), masked;
+    masked = masked_enter();
     utc_next = ntp_seconds;
-    ENABLE_IRQ();
+    masked_exit(VT_MASKED_GPS, masked);
 }
 
 
 void
 vtimer_set_correction(float corr, quant_leadlag_t leadlag) {
-    DISABLE_IRQ();
+    /* A leading correction describes the next PPS edge, a lagging one the
+     * edge that was just captured */
+    uint32_t seq = monotonic_capture_seq(), masked;
     if (leadlag == LEADING) {
-        quant_corr_deferred = corr;
-    } else {
-        quant_corr = corr;
-        quant_corr_deferred = 0.0f;
+        seq++;
     }
-    ENABLE_IRQ();
+    masked = masked_enter();
+    quant[seq % QUANT_SLOTS].seq = seq;
+    quant[seq % QUANT_SLOTS].corr = corr;
+    quant[seq % QUANT_SLOTS].label = 0;
+    masked_exit(VT_MASKED_GPS, masked);
+}
+
+
+void
+vtimer_set_next_pps(uint16_t wkn, uint32_t tow, float corr) {
+    /* The receiver has said which second the next PPS edge marks, in its own
+     * week and time of week, along with its quantization error */
+    uint32_t seq = monotonic_capture_seq() + 1;
+    uint32_t label = gps_to_epoch(wkn, tow), masked;
+    masked = masked_enter();
+    quant[seq % QUANT_SLOTS].seq = seq;
+    quant[seq % QUANT_SLOTS].corr = corr;
+    quant[seq % QUANT_SLOTS].label = label;
+    masked_exit(VT_MASKED_GPS, masked);
+}
+
+
+static uint64_t
+vtimer_to_mono(uint64_t vt_when) {
+    /* Convert a nearby vtimer time to monotonic time */
+    struct vt_state st;
+    vt_read(&vt_pub, &st);
+    return vt_to_mono(&st, vt_when);
+}
+
+
+static void
+vtimer_pulse(uint64_t vt_rise) {
+    /* Generate a PPS pulse starting at the given vtimer time, with both edges
+     * from the same state and on the nearest tick */
+    struct vt_state st;
+    vt_read(&vt_pub, &st);
+    ppsgen_pulse(vt_to_mono_round(&st, vt_rise), vt_to_mono_round(&st,
+                vt_rise + (uint64_t)(PPSGEN_WIDTH * NTP_SECOND)));
 }
 
 
 void
 vtimer_sleep_until(uint64_t vt_when) {
-    uint64_t mono_when;
-    int64_t delta_vt;
-    DISABLE_IRQ();
-    delta_vt = (vt_when - vt_last) << VT_RATE_PREC;
-    mono_when = mono_last + (delta_vt / vt_rate);
-    ENABLE_IRQ();
-    monotonic_sleep_until(mono_when);
+    monotonic_sleep_until(vtimer_to_mono(vt_when));
 }
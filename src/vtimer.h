@@ -20,6 +20,8 @@
 
 /* PPS LED is on for this long */
 #define PPS_BLINK_TIME      0.050
+/* Generated PPS output is high for this long */
+#define PPSGEN_WIDTH        0.100
 /* PLL subroutine runs at this offset after the top of the second */
 #define PLL_SUB_TIME        0.900
 
@@ -33,14 +35,29 @@ typedef enum {
 #define LOOPSTATS_VALUES 6
 extern int32_t loopstats_values[LOOPSTATS_VALUES];
 
+/* Interrupt-masked sections in vtimer.c, by what they guard. The longest each
+ * has run, in CPU cycles, is kept in vtimer_masked_max. */
+enum {
+    VT_MASKED_SECOND,   /* PLL thread: time of day, labels and watchdog */
+    VT_MASKED_QUANT,    /* PLL thread: taking the quantization correction */
+    VT_MASKED_GPS,      /* GPS thread: handing over time of day and quant */
+    VT_MASKED_SAVE,     /* Queueing PLL state for the EEPROM */
+    VT_MASKED_SECTIONS
+};
+extern uint32_t vtimer_masked_max[VT_MASKED_SECTIONS];
+
 
 void vtimer_start(void);
 uint64_t vtimer_now(void);
+uint64_t vtimer_from_mono(uint64_t mono);
 void vtimer_set_utc(uint16_t year, uint8_t month, uint8_t day,
         uint8_t hour, uint8_t minute, uint8_t second);
 void vtimer_set_gps(uint16_t wkn, uint32_t tow);
 void vtimer_set_correction(float corr, quant_leadlag_t leadlag);
+void vtimer_set_next_pps(uint16_t wkn, uint32_t tow, float corr);
 void vtimer_sleep_until(uint64_t vt_when);
+void vtimer_save_deferred(void);
+void vtimer_checkpoint_reset(void);
 
 
 #endif
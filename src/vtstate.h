@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _VTSTATE_H
+#define _VTSTATE_H
+
+#include <stdint.h>
+#include "misc_macros.h"
+
+#define VT_RATE_PREC 28
+
+struct vt_state {
+    /* (rate / 2^VT_RATE_PREC) NTP fractions per tick of monotonic time */
+    uint64_t rate;
+    /* VT value at the last timer update */
+    uint64_t vt_last;
+    /* Monotonic value at the last timer update */
+    uint64_t mono_last;
+};
+
+/* Published copies of the state. slot[gen & 1] is the current one, the single
+ * writer fills the other one and then flips. Readers never mask interrupts,
+ * they retry if gen changed while they were copying. The barriers only stop
+ * the compiler reordering, which is enough on a single core. */
+struct vt_published {
+    struct vt_state slot[2];
+    volatile uint32_t gen;
+};
+
+
+static inline void
+vt_read(const struct vt_published *pub, struct vt_state *st) {
+    /* Get a consistent copy of the published state */
+    uint32_t gen;
+    do {
+        gen = pub->gen;
+        BARRIER();
+        *st = pub->slot[gen & 1];
+        BARRIER();
+    } while (gen != pub->gen);
+}
+
+
+static inline void
+vt_publish(struct vt_published *pub, const struct vt_state *st) {
+    /* Publish a new state. Only one thread may call this. */
+    uint32_t gen = pub->gen + 1;
+    pub->slot[gen & 1] = *st;
+    BARRIER();
+    pub->gen = gen;
+}
+
+
+static inline uint64_t
+vt_calc(const struct vt_state *st, uint64_t mono_next) {
+    /* Returns the vtimer time at the given monotonic time, which must be
+     * within about 8 seconds of the last update */
+    int32_t delta_ticks = mono_next - st->mono_last;
+    int64_t frac_part = st->rate * delta_ticks;
+    return st->vt_last + (frac_part >> VT_RATE_PREC);
+}
+
+
+static inline uint64_t
+vt_to_mono(const struct vt_state *st, uint64_t vt_when) {
+    /* Convert a vtimer time within about 8 seconds of the last update to
+     * monotonic time */
+    int64_t delta_vt = (vt_when - st->vt_last) << VT_RATE_PREC;
+    return st->mono_last + (delta_vt / (int64_t)st->rate);
+}
+
+
+static inline uint64_t
+vt_to_mono_round(const struct vt_state *st, uint64_t vt_when) {
+    /* As vt_to_mono(), but to the tick nearest vt_when instead of truncating,
+     * for edges that are output on the exact tick */
+    int64_t delta_vt = (vt_when - st->vt_last) << VT_RATE_PREC;
+    int64_t half = st->rate / 2;
+    delta_vt += delta_vt < 0 ? -half : half;
+    return st->mono_last + (delta_vt / (int64_t)st->rate);
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Throughput of the GPS framer and decoders for each protocol, fed in spans
+ * the size the receive ring hands out. A span of one byte is what a port
+ * without receive DMA gives, and costs what the old byte-at-a-time parser
+ * did per byte. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gps_stream.h"
+#include "gps/parser.h"
+
+#define SECONDS     2000
+#define MIN_BYTES   (32 << 20)
+
+
+static double
+seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void
+run(const char *name, const struct stream *s, size_t span) {
+    double start, elapsed;
+    size_t done, total = 0, n;
+    unsigned passes = 0, utc;
+    gps_events.utc = 0;
+    start = seconds();
+    while (total < MIN_BYTES) {
+        gps_rx_lost();
+        for (done = 0; done < s->len; done += n) {
+            n = s->len - done < span ? s->len - done : span;
+            gps_bytes_received(s->buf + done, n, 0);
+        }
+        total += s->len;
+        passes++;
+    }
+    elapsed = seconds() - start;
+    utc = gps_events.utc / passes;
+    printf("%-8s %6zu %10.1f %10.2f %9u/%u\n", name, span,
+            total / elapsed / 1e6, elapsed / total * 1e9, utc, SECONDS);
+}
+
+
+int
+main(void) {
+    static const char *const names[] = {"ublox", "nmea", "tsip", "oncore",
+        "mixed"};
+    static const size_t spans[] = {1, 16, 256, 4096};
+    struct stream s[5] = {{0}};
+    uint32_t when = 1700000000;
+    int i, k;
+    for (k = 0; k < SECONDS; k++, when++) {
+        stream_ubx_second(&s[0], when);
+        stream_nmea_second(&s[1], when);
+        stream_tsip_second(&s[2], when);
+        stream_oncore_second(&s[3], when);
+        /* A receiver that was switched over, or two on one line */
+        switch (k % 4) {
+        case 0: stream_ubx_second(&s[4], when); break;
+        case 1: stream_nmea_second(&s[4], when); break;
+        case 2: stream_tsip_second(&s[4], when); break;
+        case 3: stream_oncore_second(&s[4], when); break;
+        }
+    }
+    printf("%-8s %6s %10s %10s %12s\n", "stream", "span", "MB/s", "ns/byte",
+            "times");
+    for (i = 0; i < 5; i++) {
+        for (k = 0; k < (int)(sizeof(spans) / sizeof(spans[0])); k++) {
+            run(names[i], &s[i], spans[k]);
+        }
+    }
+    return 0;
+}
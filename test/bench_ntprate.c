@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Memory and per-request cost of the rate limiter, and how clients fare over
+ * ten simulated minutes. Well-behaved clients polling every 64 s and 2 s
+ * share the server with a few abusers polling every 10 ms, then also with a
+ * misconfigured fleet polling every second, with a flood from random spoofed
+ * sources, and with a flood from sources picked to land in one set of the
+ * table.
+ *
+ * The fleet and the spray are many times more sources than the table holds,
+ * so they are limited as a group and the well-behaved clients among them
+ * with it; the point is that they are limited at all. A flood into one set
+ * only costs the clients in that set. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "net/ntprate.h"
+
+#define GOOD_SLOW   1000
+#define GOOD_FAST   20
+#define ABUSERS     10
+#define FLEET       2000
+#define FLOOD_RATE  2  /* per ms */
+#define DURATION    600000
+/* Longer than any poll interval */
+#define WHEEL       65536
+
+enum {
+    SLOW, FAST, ABUSER, FLEET_HOST, FLOOD, CLASSES
+};
+static const char *const class_names[] = {"64 s poll", "2 s poll",
+    "10 ms poll", "1 s fleet", "flood"};
+
+enum {
+    MIXED, WITH_FLEET, SPRAY, ONE_SET, SCENARIOS
+};
+static const char *const scenario_names[] = {"mixed", "fleet", "spray",
+    "one set"};
+
+struct client {
+    uint32_t addr, period;
+    int cls, next;
+};
+static struct client clients[GOOD_SLOW + GOOD_FAST + ABUSERS + FLEET];
+static int wheel[WHEEL];
+static uint32_t counts[CLASSES][3];
+
+
+static double
+seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static uint32_t
+same_set(uint32_t addr) {
+    /* The next address after addr in set 0 */
+    while (RATE_SET(++addr) != 0) {
+    }
+    return addr;
+}
+
+
+static void
+add(int *n, int count, int cls, uint32_t base, uint32_t period) {
+    /* Clients poll at a fixed period from a random phase */
+    struct client *c;
+    uint32_t slot;
+    int i;
+    for (i = 0; i < count; i++, (*n)++) {
+        c = &clients[*n];
+        c->addr = base + i;
+        c->period = period;
+        c->cls = cls;
+        slot = rand() % period;
+        c->next = wheel[slot];
+        wheel[slot] = *n;
+    }
+}
+
+
+static void
+simulate(int scenario, uint32_t start) {
+    struct client *c;
+    uint32_t now, addr = 0x10000000U * (scenario + 1), slot;
+    int i, n = 0, next;
+    for (i = 0; i < WHEEL; i++) {
+        wheel[i] = -1;
+    }
+    /* Addresses differ between runs so nothing carries over */
+    add(&n, GOOD_SLOW, SLOW, addr, 64000);
+    add(&n, GOOD_FAST, FAST, addr + 0x100000, 2000);
+    add(&n, ABUSERS, ABUSER, addr + 0x200000, 10);
+    if (scenario == WITH_FLEET) {
+        add(&n, FLEET, FLEET_HOST, addr + 0x300000, 1000);
+    }
+    addr += 0x400000;
+    for (now = 0; now < DURATION; now++) {
+        slot = now % WHEEL;
+        next = wheel[slot];
+        wheel[slot] = -1;
+        while (next >= 0) {
+            c = &clients[next];
+            i = next;
+            next = c->next;
+            counts[c->cls][ntp_rate_check(c->addr, start + now)]++;
+            slot = (now + c->period) % WHEEL;
+            c->next = wheel[slot];
+            wheel[slot] = i;
+        }
+        for (i = 0; i < FLOOD_RATE; i++) {
+            if (scenario == SPRAY) {
+                addr = rand() * 65537U;
+            } else if (scenario == ONE_SET) {
+                addr = same_set(addr);
+            } else {
+                break;
+            }
+            counts[FLOOD][ntp_rate_check(addr, start + now)]++;
+        }
+    }
+}
+
+
+static void
+time_lookups(const char *name, int spread) {
+    /* Addresses are made up front so only the lookup is timed */
+    static uint32_t addrs[1 << 20];
+    double start, elapsed;
+    uint32_t addr = 0x30000000;
+    int i, n = 10, k;
+    volatile int sink = 0;
+    for (i = 0; i < (int)(sizeof(addrs) / sizeof(addrs[0])); i++) {
+        switch (spread) {
+        case 0: addr = 0x30000000 + i % 256; break;
+        case 1: addr = i * 2654435761U; break;
+        case 2: addr = same_set(addr); break;
+        }
+        addrs[i] = addr;
+    }
+    start = seconds();
+    for (k = 0; k < n; k++) {
+        for (i = 0; i < (int)(sizeof(addrs) / sizeof(addrs[0])); i++) {
+            sink += ntp_rate_check(addrs[i], 0x40000000 + (k << 20) + i);
+        }
+    }
+    elapsed = seconds() - start;
+    printf("lookup, %-22s %6.1f ns per request\n", name,
+            elapsed / n / (sizeof(addrs) / sizeof(addrs[0])) * 1e9);
+}
+
+
+int
+main(void) {
+    int i, j, good, refused;
+    printf("table: %u bytes\n", (unsigned)ntp_rate_table_size);
+    time_lookups("256 clients:", 0);
+    time_lookups("new source each time:", 1);
+    time_lookups("all in one set:", 2);
+
+    srand(1);
+    printf("\n%-8s %-12s %10s %10s %10s\n", "run", "clients", "ok", "kod",
+            "dropped");
+    for (j = 0; j < SCENARIOS; j++) {
+        memset(counts, 0, sizeof(counts));
+        simulate(j, 0x80000000U + j * 0x10000000U);
+        for (i = 0; i < CLASSES; i++) {
+            if (!counts[i][RATE_OK] && !counts[i][RATE_KOD]
+                    && !counts[i][RATE_DROP]) {
+                continue;
+            }
+            printf("%-8s %-12s %10u %10u %10u\n", scenario_names[j],
+                    class_names[i], (unsigned)counts[i][RATE_OK],
+                    (unsigned)counts[i][RATE_KOD],
+                    (unsigned)counts[i][RATE_DROP]);
+        }
+        good = counts[SLOW][RATE_OK] + counts[FAST][RATE_OK];
+        refused = counts[SLOW][RATE_KOD] + counts[SLOW][RATE_DROP]
+            + counts[FAST][RATE_KOD] + counts[FAST][RATE_DROP];
+        printf("%-8s %.2f%% of well-behaved requests refused\n",
+                scenario_names[j], 100.0 * refused / (good + refused));
+    }
+    return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/*
+ * Offline PLL simulator. A modeled oscillator (white, flicker and random walk
+ * FM plus temperature steps) and PPS source (jitter and the receiver's
+ * sawtooth error) drive each PLL variant through the same lock, step and
+ * holdover decisions as pll_thread(). Each scenario injects a phase or
+ * frequency offset partway through, then runs an hour of holdover.
+ *
+ * Reported per scenario and variant:
+ *   lock      seconds until STATUS_PLL_OK would be set
+ *   rms       steady state offset before the injection
+ *   inj       largest offset after the injection
+ *   settle    seconds until back within SETTLED_THRESH for good
+ *   hold      offset at the end of the holdover
+ *   steps     times the phase was stepped
+ *
+ * As in vtimer.c, the FLL measures the oscillator over the first few PPS
+ * edges, and again after each step, and seeds the PLL with it. The hold
+ * column is the RMS over HOLD_RUNS runs with different noise, since any
+ * one run is mostly luck.
+ *
+ * Then the time each variant takes per locked pll_math() step. The host has
+ * an FPU, so this understates what the double PLL costs on the Cortex-M3,
+ * where every operation is a soft-float call; there it is the fixed point
+ * one that is cheap.
+ *
+ * Given a file instead, the variants are run side by side on a recorded PPS
+ * trace: one line per second with the offset in seconds of the PPS edge from
+ * the free running clock (the capture in ticks over the nominal frequency),
+ * or "-" where there was no edge. Reported are lock, the RMS offset after it,
+ * and the worst offset on the first edge back after a gap.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "fll.h"
+#include "pllvariant.h"
+#include "vtimer.h"
+
+PLL_VARIANT(pll_float);
+PLL_VARIANT(pll_fixed);
+PLL_VARIANT(pll_kalman);
+
+unsigned sys_able;
+
+#define RUN_LENGTH      20000
+#define INJECT_AT       8000
+#define HOLD_AT         14000
+#define HOLD_LEN        3600
+#define HOLD_RUNS       16
+/* Receiver clock period, which the PPS edge is quantized to */
+#define SAW_PERIOD      (1 / 48e6)
+/* Oscillator ticks per second, for the FLL */
+#define TICKS           72e6
+/* Steps timed per variant, after settling for the first TIME_SETTLE */
+#define TIME_STEPS      500000
+#define TIME_SETTLE     2000
+#define TIME_NOISE      4096
+
+struct scenario {
+    const char *name;
+    double jitter;      /* PPS white phase noise */
+    int saw;            /* sawtooth: 0 none, 1 raw, 2 corrected to 1 ns */
+    double wfm;         /* white FM, per second */
+    double ffm;         /* flicker FM, per second */
+    double rwfm;        /* random walk FM, per second */
+    double freq_step;   /* frequency step at INJECT_AT */
+    double phase_step;  /* phase step at INJECT_AT */
+};
+
+static const struct scenario scenarios[] = {
+    { "quiet",          20e-9, 0, 1e-11, 0,     1e-12, 0,      0 },
+    { "noisy PPS",     200e-9, 0, 1e-11, 0,     1e-12, 0,      0 },
+    { "raw sawtooth",    5e-9, 1, 1e-11, 0,     1e-12, 0,      0 },
+    { "sawtooth fixed",  5e-9, 2, 1e-11, 0,     1e-12, 0,      0 },
+    { "flicker FM",     20e-9, 0, 1e-11, 1e-10, 1e-12, 0,      0 },
+    { "temp step",      20e-9, 0, 1e-11, 2e-11, 1e-12, 100e-9, 0 },
+    { "phase 1 ms",     20e-9, 0, 1e-11, 0,     1e-12, 0,      1e-3 },
+    { "phase 50 ms",    20e-9, 0, 1e-11, 0,     1e-12, 0,      50e-3 },
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+struct result {
+    int lock, settle, steps;
+    double rms, inj, hold;
+};
+
+static uint32_t rng;
+
+
+static double
+uniform(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng + 1.0) / 4294967297.0;
+}
+
+
+static double
+gauss(void) {
+    double u = uniform(), v = uniform();
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+
+static void
+simulate(const struct pll_variant *pv, const struct scenario *sc,
+        uint32_t seed, struct result *res) {
+    /* theta is the vtimer phase against true time, eps the free running
+     * oscillator frequency error and mono its tick count. Flicker FM is
+     * approximated by three first order processes a decade apart. */
+    static const double ffm_tau[3] = { 10, 100, 1000 };
+    double theta = 0.3, eps = 20e-6, u, delta, saw = 0, ffm[3] = { 0 };
+    double sum2 = 0, mono = 1e9, capture, freq = 0;
+    struct fll fll = { 0 };
+    int t, i, n = 0, locked = 0, desync = 0, inside = 0;
+    rng = seed;
+    res->lock = res->settle = -1;
+    res->steps = 0;
+    res->inj = res->hold = 0;
+    pv->init();
+    pv->reset();
+    u = pv->poll();
+    for (t = 0; t < RUN_LENGTH; t++) {
+        double f = eps;
+        eps += sc->rwfm * gauss();
+        for (i = 0; i < 3; i++) {
+            ffm[i] += (sc->ffm * gauss() - ffm[i]) / ffm_tau[i];
+            f += ffm[i];
+        }
+        if (t == INJECT_AT) {
+            eps += sc->freq_step;
+            theta += sc->phase_step;
+        }
+        f += sc->wfm * gauss();
+        theta += f + u;
+        mono += TICKS * (1 + f);
+
+        if (t >= HOLD_AT && t < HOLD_AT + HOLD_LEN) {
+            u = pv->poll();
+            if (t == HOLD_AT + HOLD_LEN - 1) {
+                res->hold = theta;
+            }
+            continue;
+        }
+
+        delta = sc->jitter * gauss();
+        if (sc->saw) {
+            /* Receiver clock 0.3 ppm off its nominal, sweeping the edge
+             * across one of its periods */
+            saw = fmod(saw + 0.3e-6, SAW_PERIOD);
+            delta += sc->saw == 1 ? saw - SAW_PERIOD / 2 : 1e-9 * gauss();
+        }
+        /* The capture is of the true edge, the offset is against the
+         * vtimer */
+        capture = mono + delta * TICKS;
+        delta += theta;
+
+        /* Same decisions as pll_thread() */
+        if (locked && pv->state->st < 3) {
+            locked = 0;
+        } else if (!locked && pv->state->st >= 3
+                && delta > -SETTLED_THRESH && delta < SETTLED_THRESH) {
+            locked = 1;
+            if (res->lock < 0) {
+                res->lock = t;
+            }
+        }
+        if (delta < -STEP_THRESH || delta > STEP_THRESH) {
+            if (++desync >= 5) {
+                theta -= delta;
+                pv->init();
+                pv->reset();
+                fll_restart(&fll);
+                desync = 0;
+                res->steps++;
+            }
+        } else {
+            desync = 0;
+        }
+        if (fll_feed(&fll, (uint64_t)capture, TICKS, &freq)) {
+            u = pv->poll();
+            continue;
+        } else if (fll.count < 0 && freq != 0) {
+            pv->seed(freq, -1);
+            freq = 0;
+        }
+        u = pv->math(delta);
+
+        if (t >= INJECT_AT / 2 && t < INJECT_AT) {
+            sum2 += theta * theta;
+            n++;
+        } else if (t >= INJECT_AT && t < HOLD_AT) {
+            if (fabs(theta) > res->inj) {
+                res->inj = fabs(theta);
+            }
+            if (fabs(theta) < SETTLED_THRESH) {
+                if (++inside == 60) {
+                    res->settle = t - INJECT_AT - 59;
+                }
+            } else {
+                inside = 0;
+                res->settle = -1;
+            }
+        }
+    }
+    res->rms = sqrt(sum2 / n);
+}
+
+
+static double
+seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void
+time_math(const struct pll_variant *pv) {
+    /* A perfect oscillator and a quiet PPS, so that the loop stays locked.
+     * The noise is made beforehand to keep it out of the timing. */
+    static double noise[TIME_NOISE];
+    double theta = 0, u = 0, start = 0;
+    int t;
+    rng = 2463534242U;
+    for (t = 0; t < TIME_NOISE; t++) {
+        noise[t] = 20e-9 * gauss();
+    }
+    pv->init();
+    pv->reset();
+    for (t = 0; t < TIME_STEPS; t++) {
+        if (t == TIME_SETTLE) {
+            start = seconds();
+        }
+        theta += u;
+        u = pv->math(theta + noise[t % TIME_NOISE]);
+    }
+    printf("%-10s %8.1f %5d\n", pv->name,
+            (seconds() - start) / (TIME_STEPS - TIME_SETTLE) * 1e9,
+            pv->state->st);
+}
+
+
+static void
+replay(const struct pll_variant *pv, const double *trace, int len) {
+    /* The offset seen by the loop is the free running one plus all of the
+     * corrections so far. Holes in the trace are NAN. */
+    double u, corr = 0, delta, sum2 = 0, gap_err = 0;
+    int t, n = 0, lock = -1, gap = 0, gaps = 0;
+    pv->init();
+    pv->reset();
+    u = pv->poll();
+    for (t = 0; t < len; t++) {
+        corr += u;
+        if (isnan(trace[t])) {
+            u = pv->poll();
+            gap++;
+            continue;
+        }
+        delta = trace[t] + corr;
+        if (gap) {
+            if (lock >= 0) {
+                gaps++;
+                if (fabs(delta) > gap_err) {
+                    gap_err = fabs(delta);
+                }
+            }
+            gap = 0;
+        }
+        if (lock < 0 && pv->state->st >= 3
+                && delta > -SETTLED_THRESH && delta < SETTLED_THRESH) {
+            lock = t;
+        }
+        if (delta < -STEP_THRESH || delta > STEP_THRESH) {
+            /* Steps aren't modeled here, the trace should start close */
+            corr -= delta;
+            delta = 0;
+        }
+        u = pv->math(delta);
+        if (lock >= 0) {
+            sum2 += delta * delta;
+            n++;
+        }
+    }
+    printf("%-10s %6d %10.3g %5d %10.3g\n", pv->name, lock,
+            n ? sqrt(sum2 / n) : 0.0, gaps, gap_err);
+}
+
+
+static int
+load_trace(const char *path, double **trace) {
+    /* Read a trace as described at the top. Returns the number of seconds,
+     * or -1. */
+    char line[64];
+    int len = 0, size = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    *trace = NULL;
+    while (fgets(line, sizeof(line), f)) {
+        if (len == size) {
+            size = size ? 2 * size : 4096;
+            *trace = realloc(*trace, size * sizeof(**trace));
+        }
+        (*trace)[len++] = line[0] == '-' ? NAN : strtod(line, NULL);
+    }
+    fclose(f);
+    return len;
+}
+
+
+int
+main(int argc, char **argv) {
+    const struct pll_variant *pvs[3] = { &pll_float, &pll_fixed, &pll_kalman };
+    struct result res;
+    double *trace, hold2;
+    unsigned s;
+    int i, k, len;
+
+    if (argc > 1) {
+        if ((len = load_trace(argv[1], &trace)) < 0) {
+            return 1;
+        }
+        printf("%s: %d s\n", argv[1], len);
+        printf("%-10s %6s %10s %5s %10s\n", "pll", "lock", "rms", "gaps",
+                "gap err");
+        for (i = 0; i < 3; i++) {
+            replay(pvs[i], trace, len);
+        }
+        free(trace);
+        return 0;
+    }
+
+    printf("%-16s %-10s %6s %10s %10s %7s %10s %5s\n", "scenario", "pll",
+            "lock", "rms", "inj", "settle", "hold", "steps");
+    for (s = 0; s < NUM_SCENARIOS; s++) {
+        for (i = 0; i < 3; i++) {
+            hold2 = 0;
+            for (k = HOLD_RUNS - 1; k >= 0; k--) {
+                simulate(pvs[i], &scenarios[s], 2463534242U + k, &res);
+                hold2 += res.hold * res.hold;
+            }
+            res.hold = sqrt(hold2 / HOLD_RUNS);
+            printf("%-16s %-10s %6d %10.3g %10.3g %7d %10.3g %5d\n",
+                    scenarios[s].name, pvs[i]->name, res.lock, res.rms,
+                    res.inj, res.settle, res.hold, res.steps);
+        }
+    }
+
+    printf("\n%-10s %8s %5s\n", "pll", "ns/step", "state");
+    for (i = 0; i < 3; i++) {
+        time_math(pvs[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Arbitrary receiver output, split and timed arbitrarily, must never take the
+ * parser outside pbuf (it is built with the address sanitizer for that), and
+ * after a quiet line good packets of any protocol must decode again.
+ *
+ * Run as a test, main() makes inputs from the generated streams: random
+ * bytes, and good seconds with bytes changed, dropped, repeated and sync
+ * bytes thrown in. Built with clang -fsanitize=fuzzer,address -DLIBFUZZER,
+ * LLVMFuzzerTestOneInput() runs under libFuzzer instead. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gps_stream.h"
+#include "gps/parser.h"
+
+#define ROUNDS      20000
+#define START       1700000000
+#define QUIET       pdMS_TO_TICKS(200)
+
+typedef void (*second_fn)(struct stream *s, uint32_t when);
+static const second_fn seconds[] = {
+    stream_ubx_second,
+    stream_nmea_second,
+    stream_tsip_second,
+    stream_oncore_second,
+};
+#define PROTOS (sizeof(seconds) / sizeof(seconds[0]))
+
+static struct stream good[PROTOS];
+
+
+static void
+check_recovers(void) {
+    /* After a quiet line each protocol is understood again */
+    time_t t = START;
+    struct tm *tm = gmtime(&t);
+    unsigned i;
+    for (i = 0; i < PROTOS; i++) {
+        fake_ticks += QUIET;
+        gps_events.utc = gps_events.second = 0;
+        gps_bytes_received(good[i].buf, good[i].len, QUIET);
+        if (gps_events.utc == 0 || gps_events.second != tm->tm_sec) {
+            printf("protocol %u not decoded after fuzz input\n", i);
+            abort();
+        }
+    }
+}
+
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    /* The first byte seeds how the rest is split into spans, and where the
+     * line went quiet between them */
+    uint32_t seed, n, idle;
+    if (!good[0].len) {
+        for (n = 0; n < PROTOS; n++) {
+            seconds[n](&good[n], START);
+        }
+    }
+    if (size < 1) {
+        return 0;
+    }
+    seed = data[0] * 2654435761U + 1;
+    data++;
+    size--;
+    while (size) {
+        seed = seed * 1103515245 + 12345;
+        n = 1 + (seed >> 16) % 300;
+        if (n > size) {
+            n = size;
+        }
+        idle = seed % 8 ? 0
+            : (seed >> 8) % (2 * pdMS_TO_TICKS(PACKET_TIMEOUT_MS));
+        fake_ticks += idle + (seed >> 24) % 3;
+        gps_bytes_received(data, n, idle);
+        data += n;
+        size -= n;
+    }
+    check_recovers();
+    return 0;
+}
+
+
+#ifndef LIBFUZZER
+static void
+mutate(struct stream *s) {
+    /* A few changes of the kinds a bad line makes */
+    static const uint8_t syncs[] = {0xB5, 0x62, 0x10, 0x03, '@', '$', '*',
+        '\r', '\n'};
+    size_t pos;
+    int k = 1 + rand() % 8;
+    while (k-- && s->len > 2) {
+        pos = 1 + rand() % (s->len - 1);
+        switch (rand() % 5) {
+        case 0:
+            s->buf[pos] ^= 1 << (rand() % 8);
+            break;
+        case 1:
+            s->buf[pos] = syncs[rand() % sizeof(syncs)];
+            break;
+        case 2:
+            /* Dropped */
+            memmove(s->buf + pos, s->buf + pos + 1, s->len - pos - 1);
+            s->len--;
+            break;
+        case 3:
+            /* Repeated */
+            stream_bytes(s, "", 1);
+            memmove(s->buf + pos + 1, s->buf + pos, s->len - pos - 1);
+            break;
+        case 4:
+            /* Cut off */
+            s->len = pos;
+            break;
+        }
+    }
+}
+
+
+int
+main(void) {
+    struct stream s = {0};
+    uint8_t val;
+    int round, k;
+    srand(1);
+    for (round = 0; round < ROUNDS; round++) {
+        s.len = 0;
+        val = rand();
+        stream_bytes(&s, &val, 1);
+        if (round % 4 == 0) {
+            for (k = rand() % 2000; k; k--) {
+                val = rand();
+                stream_bytes(&s, &val, 1);
+            }
+        } else {
+            for (k = 1 + rand() % 4; k; k--) {
+                seconds[rand() % PROTOS](&s, START + rand() % 100000000);
+            }
+            mutate(&s);
+        }
+        LLVMFuzzerTestOneInput(s.buf, s.len);
+    }
+    free(s.buf);
+    printf("fuzz: %d inputs, parser recovered after each\n", ROUNDS);
+    return 0;
+}
+#endif
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Packets as each kind of receiver sends them, and the firmware functions the
+ * GPS code calls, stubbed out. No receiver output could be captured for
+ * these, so the streams are made from the protocol documents; every packet
+ * is one the parser has to accept. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gps_stream.h"
+#include "eeprom.h"
+#include "main.h"
+#include "vtimer.h"
+#include "net/relay.h"
+
+#define DLE     0x10
+#define ETX     0x03
+/* GPS time less Unix time, this side of 2017 */
+#define GPS_EPOCH   (315964800 - 18)
+
+struct gps_events gps_events;
+TickType_t fake_ticks;
+cfgv2_t cfg;
+static serial_t gps_port;
+serial_t *gps_serial = &gps_port;
+
+
+TickType_t
+xTaskGetTickCount(void) {
+    return fake_ticks;
+}
+
+
+void
+vtimer_set_utc(uint16_t year, uint8_t month, uint8_t day,
+        uint8_t hour, uint8_t minute, uint8_t second) {
+    gps_events.utc++;
+    gps_events.year = year;
+    gps_events.month = month;
+    gps_events.day = day;
+    gps_events.hour = hour;
+    gps_events.minute = minute;
+    gps_events.second = second;
+}
+
+
+void
+vtimer_set_gps(uint16_t wkn, uint32_t tow) {
+    (void)wkn;
+    gps_events.gps++;
+    gps_events.tow = tow;
+}
+
+
+void
+vtimer_set_correction(float corr, quant_leadlag_t leadlag) {
+    (void)leadlag;
+    gps_events.correction++;
+    gps_events.corr = corr;
+}
+
+
+void
+vtimer_set_next_pps(uint16_t wkn, uint32_t tow, float corr) {
+    (void)wkn;
+    gps_events.next_pps++;
+    gps_events.tow = tow;
+    gps_events.corr = corr;
+}
+
+
+void
+relay_write(const uint8_t *data, uint16_t len) {
+    (void)data;
+    gps_events.relayed += len;
+}
+
+
+void
+relay_flush(void) {
+}
+
+
+void
+serial_write(serial_t *serial, const char *value, uint16_t size) {
+    (void)serial;
+    (void)value;
+    (void)size;
+}
+
+
+void
+log_write(int priority, const char *appname, const char *format, ...) {
+    (void)priority;
+    (void)appname;
+    (void)format;
+}
+
+
+int16_t
+eeprom_update_cfg(uint8_t offset, const void *data, uint8_t len) {
+    memcpy((uint8_t *)&cfg + offset, data, len);
+    return EERR_OK;
+}
+
+
+void
+stream_bytes(struct stream *s, const void *data, size_t len) {
+    if (s->len + len > s->size) {
+        s->size = (s->len + len) * 2;
+        s->buf = realloc(s->buf, s->size);
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+}
+
+
+static void
+stream_byte(struct stream *s, uint8_t val) {
+    stream_bytes(s, &val, 1);
+}
+
+
+void
+stream_ubx(struct stream *s, uint8_t cls, uint8_t id,
+        const void *payload, uint16_t len) {
+    uint8_t hdr[6] = {0xB5, 0x62, cls, id, len & 0xFF, len >> 8};
+    uint8_t ck1 = 0, ck2 = 0;
+    const uint8_t *p;
+    size_t i;
+    stream_bytes(s, hdr, 6);
+    stream_bytes(s, payload, len);
+    /* Class through payload */
+    p = s->buf + s->len - len - 4;
+    for (i = 0; i < len + 4u; i++) {
+        ck1 += p[i];
+        ck2 += ck1;
+    }
+    stream_byte(s, ck1);
+    stream_byte(s, ck2);
+}
+
+
+void
+stream_nmea(struct stream *s, const char *sentence) {
+    char tail[6];
+    uint8_t ck = 0;
+    const char *p;
+    for (p = sentence; *p; p++) {
+        ck ^= *p;
+    }
+    stream_byte(s, '$');
+    stream_bytes(s, sentence, strlen(sentence));
+    snprintf(tail, sizeof(tail), "*%02X\r\n", ck);
+    stream_bytes(s, tail, 5);
+}
+
+
+void
+stream_tsip(struct stream *s, uint8_t id, const void *data, uint16_t len) {
+    const uint8_t *p = data;
+    stream_byte(s, DLE);
+    stream_byte(s, id);
+    while (len--) {
+        if (*p == DLE) {
+            stream_byte(s, DLE);
+        }
+        stream_byte(s, *p++);
+    }
+    stream_byte(s, DLE);
+    stream_byte(s, ETX);
+}
+
+
+void
+stream_oncore(struct stream *s, const char *cmd, const void *body,
+        uint16_t len) {
+    const uint8_t *p = body;
+    uint8_t ck = cmd[0] ^ cmd[1];
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        ck ^= p[i];
+    }
+    stream_bytes(s, "@@", 2);
+    stream_bytes(s, cmd, 2);
+    stream_bytes(s, body, len);
+    stream_byte(s, ck);
+    stream_bytes(s, "\r\n", 2);
+}
+
+
+static void
+put16(uint8_t *p, uint16_t val) {
+    p[0] = val;
+    p[1] = val >> 8;
+}
+
+
+static void
+put32(uint8_t *p, uint32_t val) {
+    put16(p, val);
+    put16(p + 2, val >> 16);
+}
+
+
+void
+stream_ubx_second(struct stream *s, uint32_t when) {
+    /* NAV-PVT and NAV-TIMEUTC for this second, TIM-TP for the next pulse,
+     * and a NAV-SAT too big for the parser to keep */
+    uint8_t pvt[92] = {0}, utc[20] = {0}, tp[16] = {0}, sat[8 + 12 * 30];
+    uint32_t gps = when - GPS_EPOCH;
+    time_t t = when;
+    struct tm *tm = gmtime(&t);
+    size_t i;
+    put32(pvt, gps % 604800 * 1000);
+    put16(pvt + 4, tm->tm_year + 1900);
+    pvt[6] = tm->tm_mon + 1;
+    pvt[7] = tm->tm_mday;
+    pvt[8] = tm->tm_hour;
+    pvt[9] = tm->tm_min;
+    pvt[10] = tm->tm_sec;
+    pvt[11] = 0x07;
+    pvt[20] = 3;
+    pvt[21] = 0x01;
+    pvt[23] = 9;
+    stream_ubx(s, 0x01, 0x07, pvt, sizeof(pvt));
+    put32(utc, gps % 604800 * 1000);
+    put16(utc + 12, tm->tm_year + 1900);
+    utc[14] = tm->tm_mon + 1;
+    utc[15] = tm->tm_mday;
+    utc[16] = tm->tm_hour;
+    utc[17] = tm->tm_min;
+    utc[18] = tm->tm_sec;
+    utc[19] = 0x07;
+    stream_ubx(s, 0x01, 0x21, utc, sizeof(utc));
+    put32(tp, (gps + 1) % 604800 * 1000);
+    put32(tp + 8, -2500);
+    put16(tp + 12, (gps + 1) / 604800);
+    tp[14] = 0x03;
+    stream_ubx(s, 0x0D, 0x01, tp, sizeof(tp));
+    for (i = 0; i < sizeof(sat); i++) {
+        /* Sync bytes in the payload must not start a packet */
+        sat[i] = i % 7 ? (uint8_t)(i * 37) : 0xB5;
+    }
+    stream_ubx(s, 0x01, 0x35, sat, sizeof(sat));
+}
+
+
+void
+stream_nmea_second(struct stream *s, uint32_t when) {
+    /* RMC, GGA and ZDA, and a set of GSV */
+    time_t t = when;
+    struct tm *tm = gmtime(&t);
+    char buf[100];
+    int i;
+    snprintf(buf, sizeof(buf), "GPRMC,%02d%02d%02d.00,A,4807.038,N,01131.000,"
+            "E,0.0,0.0,%02d%02d%02d,,,A", tm->tm_hour, tm->tm_min, tm->tm_sec,
+            tm->tm_mday, tm->tm_mon + 1, tm->tm_year % 100);
+    stream_nmea(s, buf);
+    snprintf(buf, sizeof(buf), "GPGGA,%02d%02d%02d.00,4807.038,N,01131.000,E,"
+            "1,09,0.9,545.4,M,46.9,M,,", tm->tm_hour, tm->tm_min, tm->tm_sec);
+    stream_nmea(s, buf);
+    for (i = 1; i <= 3; i++) {
+        snprintf(buf, sizeof(buf), "GPGSV,3,%d,11,%02d,03,111,00,%02d,15,270,"
+                "00,%02d,01,010,00,%02d,06,292,00", i, i * 4, i * 4 + 1,
+                i * 4 + 2, i * 4 + 3);
+        stream_nmea(s, buf);
+    }
+    snprintf(buf, sizeof(buf), "GPZDA,%02d%02d%02d.00,%02d,%02d,%04d,00,00",
+            tm->tm_hour, tm->tm_min, tm->tm_sec, tm->tm_mday, tm->tm_mon + 1,
+            tm->tm_year + 1900);
+    stream_nmea(s, buf);
+}
+
+
+void
+stream_tsip_second(struct stream *s, uint32_t when) {
+    /* 8F-AB timing and 8F-AC supplemental timing, with DLE and ETX bytes in
+     * the data */
+    uint8_t ab[17] = {0xAB}, ac[68] = {0xAC};
+    uint32_t gps = when - GPS_EPOCH, tow = gps % 604800;
+    time_t t = when;
+    struct tm *tm = gmtime(&t);
+    float qerr = 2.5f;
+    uint8_t *q = (uint8_t *)&qerr;
+    size_t i;
+    ab[1] = tow >> 24;
+    ab[2] = tow >> 16;
+    ab[3] = tow >> 8;
+    ab[4] = tow;
+    ab[5] = (gps / 604800) >> 8;
+    ab[6] = gps / 604800;
+    ab[7] = 0;
+    ab[8] = DLE;
+    ab[9] = 0x03;
+    ab[10] = tm->tm_sec;
+    ab[11] = tm->tm_min;
+    ab[12] = tm->tm_hour;
+    ab[13] = tm->tm_mday;
+    ab[14] = tm->tm_mon + 1;
+    ab[15] = (tm->tm_year + 1900) >> 8;
+    ab[16] = tm->tm_year + 1900;
+    stream_tsip(s, 0x8F, ab, sizeof(ab));
+    for (i = 1; i < sizeof(ac); i++) {
+        ac[i] = i % 5 ? (uint8_t)i : DLE;
+    }
+    /* Quantization error in ns, big endian */
+    for (i = 0; i < 4; i++) {
+        ac[60 + i] = q[3 - i];
+    }
+    stream_tsip(s, 0x8F, ac, sizeof(ac));
+}
+
+
+void
+stream_oncore_second(struct stream *s, uint32_t when) {
+    /* Position/status/data, the only message decoded */
+    uint8_t ea[69] = {0};
+    time_t t = when;
+    struct tm *tm = gmtime(&t);
+    size_t i;
+    ea[0] = tm->tm_mon + 1;
+    ea[1] = tm->tm_mday;
+    ea[2] = (tm->tm_year + 1900) >> 8;
+    ea[3] = tm->tm_year + 1900;
+    ea[4] = tm->tm_hour;
+    ea[5] = tm->tm_min;
+    ea[6] = tm->tm_sec;
+    for (i = 7; i < sizeof(ea); i++) {
+        /* Including '@' and CR LF, which mean nothing here */
+        ea[i] = "@\r\n\x10"[i % 4];
+    }
+    stream_oncore(s, "Ea", ea, sizeof(ea));
+}
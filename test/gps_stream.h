@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _GPS_STREAM_H
+#define _GPS_STREAM_H
+
+/* Receiver output for the host GPS tests, built packet by packet with correct
+ * framing and checksums, and stubs for what the parsers call that record what
+ * was decoded. See gps_stream.c. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+struct stream {
+    uint8_t *buf;
+    size_t len, size;
+};
+
+/* What reached vtimer and the relay */
+struct gps_events {
+    unsigned utc, gps, next_pps, correction;
+    uint16_t year;
+    uint8_t month, day, hour, minute, second;
+    uint32_t tow;
+    float corr;
+    size_t relayed;
+};
+extern struct gps_events gps_events;
+/* Returned by xTaskGetTickCount() */
+extern TickType_t fake_ticks;
+
+void stream_bytes(struct stream *s, const void *data, size_t len);
+void stream_ubx(struct stream *s, uint8_t cls, uint8_t id,
+        const void *payload, uint16_t len);
+void stream_nmea(struct stream *s, const char *sentence);
+void stream_tsip(struct stream *s, uint8_t id, const void *data, uint16_t len);
+void stream_oncore(struct stream *s, const char *cmd, const void *body,
+        uint16_t len);
+
+/* One second of what a receiver speaking each protocol sends, for the second
+ * starting at the given Unix time. Each gives one time of day. */
+void stream_ubx_second(struct stream *s, uint32_t when);
+void stream_nmea_second(struct stream *s, uint32_t when);
+void stream_tsip_second(struct stream *s, uint32_t when);
+void stream_oncore_second(struct stream *s, uint32_t when);
+
+#endif
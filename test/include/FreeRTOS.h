@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the FreeRTOS headers. Only the types and constants are
+ * here; a test that calls into the kernel provides its own fakes. */
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <stdint.h>
+
+#define configTICK_RATE_HZ      100
+#define portMAX_DELAY           ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)((ms) * configTICK_RATE_HZ / 1000))
+#define pdFALSE                 0
+#define pdTRUE                  1
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define portEND_SWITCHING_ISR(x) (void)(x)
+
+#endif
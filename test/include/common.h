@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for src/common.h, without the board and CPU headers.
+ * Interrupts don't exist on the host, so masking them does nothing. */
+
+#ifndef _COMMON_H
+#define _COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "misc_macros.h"
+#include "app_config.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define TIMEOUT_NOBLOCK     0
+#define TIMEOUT_FOREVER     portMAX_DELAY
+
+#define DISABLE_IRQ()       do {} while (0)
+#define ENABLE_IRQ()        do {} while (0)
+
+#define EERR_OK             0
+#define EERR_TIMEOUT        -1
+#define EERR_FAULT          -2
+#define EERR_INVALID        -3
+#define EERR_NACK           -4
+#define EERR_CRCFAIL        -5
+#define EERR_AGAIN          -6
+
+#define MS2ST(ms)           (((ms) * configTICK_RATE_HZ) / 1000)
+#define S2ST(ms)            ((ms) * configTICK_RATE_HZ)
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header. The host is little-endian, like the
+ * target. */
+
+#ifndef __LWIP_DEF_H__
+#define __LWIP_DEF_H__
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include "lwipopts.h"
+
+typedef uint8_t         u8_t;
+typedef int8_t          s8_t;
+typedef uint16_t        u16_t;
+typedef int16_t         s16_t;
+typedef uint32_t        u32_t;
+typedef int32_t         s32_t;
+
+#define PP_HTONS(x) ((((x) & 0xff) << 8) | (((x) & 0xff00) >> 8))
+#define PP_NTOHS(x) PP_HTONS(x)
+#define PP_HTONL(x) ((((u32_t)(x) & 0xff) << 24) | \
+                     (((u32_t)(x) & 0xff00) << 8) | \
+                     (((u32_t)(x) & 0xff0000) >> 8) | \
+                     (((u32_t)(x) & 0xff000000) >> 24))
+#define PP_NTOHL(x) PP_HTONL(x)
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP IPv4 and IPv6 headers. Every field of these
+ * falls on its natural alignment, so unlike lwIP's they aren't packed. */
+
+#ifndef __LWIP_IP_H__
+#define __LWIP_IP_H__
+
+#include "lwip/def.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+#define IP_PROTO_UDP        17
+#define IP_HLEN             20
+
+struct ip_hdr {
+    u8_t _v_hl;
+    u8_t _tos;
+    u16_t _len;
+    u16_t _id;
+    u16_t _offset;
+    u8_t _ttl;
+    u8_t _proto;
+    u16_t _chksum;
+    ip_addr_p_t src;
+    ip_addr_p_t dest;
+};
+
+#define IPH_VHL_SET(hdr, v, hl) (hdr)->_v_hl = (((v) << 4) | (hl))
+#define IPH_LEN_SET(hdr, len) (hdr)->_len = (len)
+#define IPH_OFFSET_SET(hdr, off) (hdr)->_offset = (off)
+#define IPH_TTL_SET(hdr, ttl) (hdr)->_ttl = (u8_t)(ttl)
+#define IPH_PROTO_SET(hdr, proto) (hdr)->_proto = (u8_t)(proto)
+#define IPH_CHKSUM_SET(hdr, chksum) (hdr)->_chksum = (chksum)
+
+#if LWIP_IPV6
+#define IP6_NEXTH_UDP       17
+#define IP6_HLEN            40
+
+struct ip6_hdr {
+    u32_t _v_tc_fl;
+    u16_t _plen;
+    u8_t _nexth;
+    u8_t _hoplim;
+    ip6_addr_p_t src;
+    ip6_addr_p_t dest;
+};
+
+#define IP6H_TC(hdr) ((ntohl((hdr)->_v_tc_fl) >> 20) & 0xff)
+#define IP6H_VTCFL_SET(hdr, v, tc, fl) \
+    (hdr)->_v_tc_fl = htonl(((v) << 28) | ((tc) << 20) | (fl))
+#define IP6H_PLEN_SET(hdr, plen) (hdr)->_plen = htons(plen)
+#define IP6H_NEXTH_SET(hdr, nexth) (hdr)->_nexth = (nexth)
+#define IP6H_HOPLIM_SET(hdr, hl) (hdr)->_hoplim = (u8_t)(hl)
+
+/* Tests provide this */
+ip6_addr_t *ip6_select_source_address(struct netif *netif, ip6_addr_t *dest);
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header, enough for eeprom.h and the NTP server */
+
+#ifndef __LWIP_IP_ADDR_H__
+#define __LWIP_IP_ADDR_H__
+
+#include <stdint.h>
+#include "lwipopts.h"
+
+typedef struct ip_addr {
+    uint32_t addr;
+} ip_addr_t;
+
+typedef struct ip_addr_packed {
+    uint32_t addr;
+} ip_addr_p_t;
+
+#define IPADDR_ANY          ((uint32_t)0x00000000UL)
+/* The stub sockets take everything anyway */
+#define IP_ADDR_ANY         ((ip_addr_t *)0)
+
+#define ip_addr_copy(dest, src) ((dest).addr = (src).addr)
+#define ip_addr_isany(addr1) ((addr1) == NULL || (addr1)->addr == IPADDR_ANY)
+
+#if LWIP_IPV6
+typedef struct ip6_addr {
+    uint32_t addr[4];
+} ip6_addr_t;
+
+typedef struct ip6_addr_packed {
+    uint32_t addr[4];
+} ip6_addr_p_t;
+
+#define IP6_ADDR_ANY        ((ip6_addr_t *)0)
+
+#define ip6_addr_copy(dest, src) do { \
+    (dest).addr[0] = (src).addr[0]; \
+    (dest).addr[1] = (src).addr[1]; \
+    (dest).addr[2] = (src).addr[2]; \
+    (dest).addr[3] = (src).addr[3]; \
+} while (0)
+#define ip6_addr_cmp(addr1, addr2) (((addr1)->addr[0] == (addr2)->addr[0]) && \
+                                    ((addr1)->addr[1] == (addr2)->addr[1]) && \
+                                    ((addr1)->addr[2] == (addr2)->addr[2]) && \
+                                    ((addr1)->addr[3] == (addr2)->addr[3]))
+
+#define IP6_ADDR_INVALID    0x00
+#define IP6_ADDR_TENTATIVE  0x08
+#define IP6_ADDR_PREFERRED  0x10
+#define IP6_ADDR_DEPRECATED 0x20
+#define IP6_ADDR_VALID      0x30
+#define ip6_addr_isvalid(addr_state) ((addr_state) & IP6_ADDR_VALID)
+#endif
+
+#endif
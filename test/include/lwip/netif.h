@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header. Only the fields the NTP server and
+ * udp_reply() use are here. */
+
+#ifndef __LWIP_NETIF_H__
+#define __LWIP_NETIF_H__
+
+#include "lwip/def.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct netif;
+typedef err_t (*netif_linkoutput_fn)(struct netif *netif, struct pbuf *p);
+
+struct netif {
+    ip_addr_t ip_addr;
+#if LWIP_IPV6
+    ip6_addr_t ip6_addr[LWIP_IPV6_NUM_ADDRESSES];
+    u8_t ip6_addr_state[LWIP_IPV6_NUM_ADDRESSES];
+#endif
+    netif_linkoutput_fn linkoutput;
+    u8_t hwaddr[6];
+};
+
+#if LWIP_IPV6
+#define netif_ip6_addr(netif, i)        (&((netif)->ip6_addr[(i)]))
+#define netif_ip6_addr_state(netif, i)  ((netif)->ip6_addr_state[(i)])
+#endif
+
+#endif
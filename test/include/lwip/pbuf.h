@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP pbuf header, enough for the Ethernet receive
+ * ring and the NTP server. Tests provide the functions they use. */
+
+#ifndef __LWIP_PBUF_H__
+#define __LWIP_PBUF_H__
+
+#include <stdint.h>
+
+#define ETH_PAD_SIZE    2
+
+typedef int8_t err_t;
+#define ERR_OK          0
+#define ERR_MEM         -1
+#define ERR_TIMEOUT     -3
+
+typedef enum {
+    PBUF_TRANSPORT,
+    PBUF_IP,
+    PBUF_LINK,
+    PBUF_RAW
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM,
+    PBUF_ROM,
+    PBUF_REF,
+    PBUF_POOL
+} pbuf_type;
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    uint16_t tot_len;
+    uint16_t len;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t ref;
+};
+
+typedef void (*pbuf_free_custom_fn)(struct pbuf *p);
+
+struct pbuf_custom {
+    struct pbuf pbuf;
+    pbuf_free_custom_fn custom_free_function;
+};
+
+struct pbuf *pbuf_alloced_custom(pbuf_layer l, uint16_t length,
+        pbuf_type type, struct pbuf_custom *p, void *payload_mem,
+        uint16_t payload_mem_len);
+uint8_t pbuf_header(struct pbuf *p, int16_t header_size_increment);
+void pbuf_realloc(struct pbuf *p, uint16_t size);
+uint8_t pbuf_free(struct pbuf *p);
+
+#endif
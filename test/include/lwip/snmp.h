@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header. Nothing is counted. */
+
+#ifndef __LWIP_SNMP_H__
+#define __LWIP_SNMP_H__
+
+#define snmp_inc_udpindatagrams()
+#define snmp_inc_udpoutdatagrams()
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header. Nothing is counted. */
+
+#ifndef __LWIP_STATS_H__
+#define __LWIP_STATS_H__
+
+#define IP_STATS_INC(x)
+#define IP6_STATS_INC(x)
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header. Tests provide the functions. */
+
+#ifndef __LWIP_UDP_H__
+#define __LWIP_UDP_H__
+
+#include "lwip/ip.h"
+
+#define UDP_HLEN            8
+
+struct udp_hdr {
+    u16_t src;
+    u16_t dest;
+    u16_t len;
+    u16_t chksum;
+};
+
+struct udp_pcb;
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+        ip_addr_t *addr, u16_t port);
+
+struct udp_pcb {
+    u8_t isipv6;
+    u8_t ttl;
+    u16_t local_port;
+    udp_recv_fn recv;
+    void *recv_arg;
+};
+
+#define PCB_ISIPV6(pcb)     ((pcb)->isipv6)
+
+struct udp_pcb *udp_new(void);
+err_t udp_bind(struct udp_pcb *pcb, ip_addr_t *ipaddr, u16_t port);
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+#if LWIP_IPV6
+struct udp_pcb *udp_new_ip6(void);
+#define udp_bind_ip6(pcb, ip6addr, port) \
+    udp_bind(pcb, (ip_addr_t *)(ip6addr), port)
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for the lwIP header, enough for udp_reply() */
+
+#ifndef __NETIF_ETHARP_H__
+#define __NETIF_ETHARP_H__
+
+#include "lwip/def.h"
+#include "lwip/ip.h"
+#include <string.h>
+
+#define ETHTYPE_IP          0x0800U
+#define ETHTYPE_IPV6        0x86DDU
+
+struct eth_addr {
+    u8_t addr[6];
+};
+
+struct eth_hdr {
+#if ETH_PAD_SIZE
+    u8_t padding[ETH_PAD_SIZE];
+#endif
+    struct eth_addr dest;
+    struct eth_addr src;
+    u16_t type;
+};
+
+#define SIZEOF_ETH_HDR      (14 + ETH_PAD_SIZE)
+
+#define ETHADDR16_COPY(dst, src)  memcpy(dst, src, 6)
+#define ETHADDR32_COPY(dst, src)  memcpy(dst, src, 6)
+
+#endif
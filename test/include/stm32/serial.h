@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Host stand-in for lib/stm32/serial.h. There are no ports, just the type and
+ * the calls the GPS code makes; the test provides them. */
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include "common.h"
+
+typedef struct {
+    int                 speed;
+} serial_t;
+
+void serial_write(serial_t *serial, const char *value, uint16_t size);
+
+#endif
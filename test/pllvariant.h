@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _PLLVARIANT_H
+#define _PLLVARIANT_H
+
+/* pllmath.c, pllfixed.c and pllkalman.c all export the same names, so the
+ * host build compiles each one with its symbols prefixed (see PllObject in
+ * SConscript) and the tests drive them side by side through this table. */
+
+#include "ntpns.h"
+#include "pll.h"
+
+struct pll_variant {
+    const char *name;
+    struct pll_state *state;
+    void (*init)(void);
+    void (*reset)(void);
+    double (*math)(double y);
+    double (*poll)(void);
+    void (*seed)(double b, int tightened);
+    int (*learned)(double *b, int *tightened);
+};
+
+#define PLL_VARIANT(p) \
+    extern struct pll_state p##_pll_state; \
+    void p##_init_pllmath(void); \
+    void p##_pll_reset(void); \
+    double p##_pll_math(double y); \
+    double p##_pll_poll(void); \
+    void p##_pll_seed(double b, int tightened); \
+    int p##_pll_learned(double *b, int *tightened); \
+    static const struct pll_variant p = { #p, &p##_pll_state, \
+        p##_init_pllmath, p##_pll_reset, p##_pll_math, p##_pll_poll, \
+        p##_pll_seed, p##_pll_learned }
+
+#endif
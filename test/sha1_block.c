@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Portable SHA-1 block function for host builds. The firmware uses the Thumb
+ * assembly version in lib/crypto/sha1_thumb.s instead. */
+
+#include <stdint.h>
+#include "crypto/sha.h"
+
+#define ROL(x, n)   (((x) << (n)) | ((x) >> (32 - (n))))
+
+
+void
+sha1_block_data_order(SHA_CTX *c, const void *p, size_t num) {
+    const uint8_t *data = p;
+    uint32_t w[80], a, b, d, e, f, k, t, cc;
+    int i;
+    while (num--) {
+        for (i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[4*i] << 24) | ((uint32_t)data[4*i+1] << 16)
+                | ((uint32_t)data[4*i+2] << 8) | data[4*i+3];
+        }
+        for (i = 16; i < 80; i++) {
+            w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+        }
+        a = c->h0; b = c->h1; cc = c->h2; d = c->h3; e = c->h4;
+        for (i = 0; i < 80; i++) {
+            if (i < 20) {
+                f = (b & cc) | (~b & d);
+                k = 0x5a827999;
+            } else if (i < 40) {
+                f = b ^ cc ^ d;
+                k = 0x6ed9eba1;
+            } else if (i < 60) {
+                f = (b & cc) | (b & d) | (cc & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ cc ^ d;
+                k = 0xca62c1d6;
+            }
+            t = ROL(a, 5) + f + e + k + w[i];
+            e = d;
+            d = cc;
+            cc = ROL(b, 30);
+            b = a;
+            a = t;
+        }
+        c->h0 += a; c->h1 += b; c->h2 += cc; c->h3 += d; c->h4 += e;
+        data += 64;
+    }
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Drive the Ethernet receive ring against a model of the MAC's DMA: it fills
+ * descriptors it owns in order, writes the PTP timestamp over the buffer
+ * pointers, and suspends when it reaches a descriptor it doesn't own until
+ * mac_rx_resume() is called. Frames must come out in order, and a buffer lent
+ * to the stack must never be written by the DMA while it is out. */
+
+#include "common.h"
+#include "stm32/eth_mac.h"
+#include "unit.h"
+
+#define RX_DESCS    4
+#define RX_BUFS     6
+#define MAX_LENT    (RX_BUFS - RX_DESCS)
+
+static mac_desc_t *ring, *dma_ptr;
+static int dma_suspended;
+static unsigned dma_drops, dma_resumes;
+
+
+void
+mac_rx_resume(void) {
+    if (dma_suspended) {
+        dma_suspended = 0;
+        dma_resumes++;
+    }
+}
+
+
+uint64_t
+mac_ptp_to_mono(uint32_t sec, uint32_t subsec) {
+    return ((uint64_t)sec << 32) | subsec;
+}
+
+
+struct pbuf *
+pbuf_alloced_custom(pbuf_layer l, uint16_t length, pbuf_type type,
+        struct pbuf_custom *p, void *payload_mem, uint16_t payload_mem_len) {
+    ASSERT(length <= payload_mem_len);
+    p->pbuf.next = NULL;
+    p->pbuf.payload = payload_mem;
+    p->pbuf.tot_len = p->pbuf.len = length;
+    p->pbuf.ref = 1;
+    return &p->pbuf;
+}
+
+
+static void
+fill(uint8_t *buf, uint32_t seq, uint16_t len) {
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        buf[i] = seq * 31 + i;
+    }
+}
+
+
+static int
+verify(const uint8_t *buf, uint32_t seq, uint16_t len) {
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        if (buf[i] != (uint8_t)(seq * 31 + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static int
+dma_receive(uint32_t seq, uint16_t len, uint32_t status, int stamp) {
+    /* One frame arrives from the wire. Returns 0 if it was dropped. */
+    mac_desc_t *next;
+    if (dma_suspended || (dma_ptr->des0 & STM32_RDES0_OWN) == 0) {
+        dma_suspended = 1;
+        dma_drops++;
+        return 0;
+    }
+    next = dma_ptr->des_next;
+    fill(dma_ptr->des_buf, seq, len);
+    if (stamp) {
+        dma_ptr->des_buf = (uint8_t*)(uintptr_t)(0x40000000 + seq);
+        dma_ptr->des_next = (mac_desc_t*)(uintptr_t)7;
+    }
+    dma_ptr->des0 = status | STM32_RDES0_FS | STM32_RDES0_LS
+        | ((uint32_t)(len + 4) << 16);
+    dma_ptr = next;
+    return 1;
+}
+
+
+static void
+reset(void) {
+    ring = dma_ptr = mac_rx_reset();
+    dma_suspended = 0;
+}
+
+
+static void
+lent_free(struct pbuf *p) {
+    ((struct pbuf_custom*)p)->custom_free_function(p);
+}
+
+
+static void
+test_basic(void) {
+    mac_desc_t *d;
+    struct pbuf *lent[MAX_LENT];
+    uint8_t copy[100];
+    int i;
+
+    reset();
+    CHECK(mac_rx_poll() == NULL);
+    for (i = 0; i < 3; i++) {
+        CHECK(dma_receive(i, 60 + i, 0, i == 1));
+    }
+    for (i = 0; i < 3; i++) {
+        d = mac_rx_poll();
+        CHECK(d != NULL);
+        if (d == NULL) {
+            return;
+        }
+        CHECK_EQ(d->size, 60 + i);
+        CHECK_EQ(d->timestamp, i == 1 ? (7ULL << 32) + 0x40000001 : 0);
+        CHECK(d->des_buf == d->buf && d->des_next == d->next);
+        if (i < MAX_LENT) {
+            /* Lent without copying */
+            lent[i] = mac_lend_rx_descriptor(d);
+            CHECK(lent[i] != NULL);
+            CHECK_EQ(lent[i]->len, 60 + i + ETH_PAD_SIZE);
+            CHECK(verify((uint8_t*)lent[i]->payload + ETH_PAD_SIZE, i, 60 + i));
+        } else {
+            /* Out of spares, so it's copied and handed back */
+            CHECK(mac_lend_rx_descriptor(d) == NULL);
+            CHECK_EQ(mac_read_rx_descriptor(d, copy, sizeof(copy)), 60 + i);
+            CHECK(verify(copy, i, 60 + i));
+            mac_release_rx_descriptor(d);
+        }
+    }
+    CHECK(mac_rx_poll() == NULL);
+    for (i = 0; i < MAX_LENT; i++) {
+        lent_free(lent[i]);
+    }
+}
+
+
+static void
+test_bad_frames(void) {
+    /* A ring full of bad frames must not leave the DMA stopped */
+    mac_desc_t *d;
+    int i;
+    reset();
+    for (i = 0; i < RX_DESCS; i++) {
+        CHECK(dma_receive(i, 60, STM32_RDES0_ES | STM32_RDES0_CE, 0));
+    }
+    CHECK(!dma_receive(99, 60, 0, 0));
+    CHECK(dma_suspended);
+    CHECK(mac_rx_poll() == NULL);
+    CHECK(!dma_suspended);
+    CHECK(dma_receive(100, 70, 0, 0));
+    d = mac_rx_poll();
+    CHECK(d != NULL && d->size == 70 && verify(d->des_buf, 100, 70));
+    if (d == NULL) {
+        return;
+    }
+    mac_release_rx_descriptor(d);
+
+    /* Checksum errors on IP frames are dropped. Frames the MAC didn't check
+     * pass, but aren't marked as checked. */
+    CHECK(dma_receive(101, 60, STM32_RDES0_FT | STM32_RDES0_PCE, 0));
+    CHECK(dma_receive(102, 60, STM32_RDES0_PCE, 0));
+    CHECK(dma_receive(103, 60, STM32_RDES0_FT, 0));
+    d = mac_rx_poll();
+    CHECK(d != NULL && verify(d->des_buf, 102, 60) && !d->checked);
+    mac_release_rx_descriptor(d);
+    d = mac_rx_poll();
+    CHECK(d != NULL && verify(d->des_buf, 103, 60) && d->checked);
+    mac_release_rx_descriptor(d);
+    CHECK(mac_rx_poll() == NULL);
+}
+
+
+static void
+test_soak(void) {
+    /* Random arrivals, polls, lends and frees */
+    struct pbuf *lent[MAX_LENT];
+    uint32_t lent_seq[MAX_LENT], lent_len[MAX_LENT];
+    uint32_t fifo[RX_DESCS], fifo_len[RX_DESCS];
+    uint32_t seq = 1000, errors = 0, received = 0, bad = 0, out_of_order = 0;
+    int num_lent = 0, fifo_n = 0, step, i, j;
+    mac_desc_t *d;
+
+    reset();
+    srand(1);
+    for (step = 0; step < 200000; step++) {
+        int op = rand() % 8;
+        if (op < 3) {
+            uint16_t len = 42 + rand() % (MAC_BUF_SIZE - 46);
+            uint32_t status = (rand() % 10 == 0) ? STM32_RDES0_ES : 0;
+            if (dma_receive(seq, len, status, rand() & 1) && !status) {
+                ASSERT(fifo_n < RX_DESCS);
+                fifo[fifo_n] = seq;
+                fifo_len[fifo_n++] = len;
+            }
+            seq++;
+        } else if (op < 6) {
+            if ((d = mac_rx_poll()) == NULL) {
+                continue;
+            }
+            if (fifo_n == 0 || d->size != fifo_len[0]
+                    || !verify(d->des_buf, fifo[0], d->size)) {
+                out_of_order++;
+            }
+            received++;
+            if (num_lent < MAX_LENT && rand() & 1) {
+                struct pbuf *p = mac_lend_rx_descriptor(d);
+                if (p == NULL) {
+                    errors++;
+                    mac_release_rx_descriptor(d);
+                } else {
+                    lent[num_lent] = p;
+                    lent_seq[num_lent] = fifo[0];
+                    lent_len[num_lent++] = fifo_len[0];
+                }
+            } else {
+                mac_release_rx_descriptor(d);
+            }
+            fifo_n--;
+            memmove(fifo, fifo + 1, fifo_n * sizeof(fifo[0]));
+            memmove(fifo_len, fifo_len + 1, fifo_n * sizeof(fifo_len[0]));
+        } else if (num_lent) {
+            /* Free a random lent buffer; its contents must be intact */
+            i = rand() % num_lent;
+            if (!verify((uint8_t*)lent[i]->payload + ETH_PAD_SIZE,
+                        lent_seq[i], lent_len[i])) {
+                bad++;
+            }
+            lent_free(lent[i]);
+            num_lent--;
+            lent[i] = lent[num_lent];
+            lent_seq[i] = lent_seq[num_lent];
+            lent_len[i] = lent_len[num_lent];
+        }
+        /* Ring and lent buffers are all different */
+        for (i = 0; i < RX_DESCS; i++) {
+            for (j = 0; j < num_lent; j++) {
+                if (ring[i].buf == (uint8_t*)lent[j]->payload + ETH_PAD_SIZE) {
+                    bad++;
+                }
+            }
+        }
+    }
+    CHECK(received > 50000);
+    CHECK_EQ(out_of_order, 0);
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(errors, 0);
+    CHECK(dma_drops > 0 && dma_resumes > 0);
+
+    /* Once everything is back there are exactly the spares to lend again */
+    while ((d = mac_rx_poll()) != NULL) {
+        mac_release_rx_descriptor(d);
+    }
+    for (i = 0; i < num_lent; i++) {
+        lent_free(lent[i]);
+    }
+    mac_rx_resume();
+    for (i = 0; i <= MAX_LENT; i++) {
+        CHECK(dma_receive(seq, 60, 0, 0));
+        d = mac_rx_poll();
+        lent[0] = mac_lend_rx_descriptor(d);
+        CHECK((lent[0] != NULL) == (i < MAX_LENT));
+        if (lent[0] == NULL) {
+            mac_release_rx_descriptor(d);
+        }
+    }
+}
+
+
+int
+main(void) {
+    test_basic();
+    test_bad_frames();
+    test_soak();
+    return unit_done("ethrx");
+}
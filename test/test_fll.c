@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* The FLL must measure the oscillator from FLL_INTERVALS clean PPS intervals,
+ * start over on a missed or extra pulse, and the frequency it hands the PLL
+ * must actually shorten the pull-in. */
+
+#include <math.h>
+#include "fll.h"
+#include "pllvariant.h"
+#include "unit.h"
+
+PLL_VARIANT(pll_float);
+
+unsigned sys_able;
+
+#define TICKS       72e6
+#define BASE        ((1ULL << 32) - 12345)
+
+static uint32_t rng = 1;
+
+
+static int
+jitter(void) {
+    /* +/- 7 ticks, about 100 ns */
+    rng = rng * 1103515245 + 12345;
+    return (int)((rng >> 16) % 15) - 7;
+}
+
+
+static uint64_t
+edge(double k, double eps) {
+    /* Monotonic capture of PPS edge k with the oscillator eps fast */
+    return BASE + (uint64_t)llround(k * TICKS * (1 + eps)) + jitter();
+}
+
+
+static int
+measure(struct fll *fll, double eps, int skip, double glitch, double *freq) {
+    /* Feed edges until the FLL is done, dropping edge 'skip' and adding one
+     * at 'glitch'. Returns the number of edges it took. */
+    int k, n = 0;
+    *freq = 99;
+    for (k = 0; k < 100; k++) {
+        if (k == skip) {
+            continue;
+        }
+        if (glitch > 0 && glitch < k) {
+            n++;
+            CHECK(fll_feed(fll, edge(glitch, eps), TICKS, freq));
+            glitch = 0;
+        }
+        n++;
+        if (!fll_feed(fll, edge(k, eps), TICKS, freq)) {
+            return n;
+        }
+        CHECK_NEAR(*freq, 99, 0);
+    }
+    return -1;
+}
+
+
+static void
+test_measure(void) {
+    static const double eps[] = { 0, 20e-6, -37.5e-6, 450e-6, -450e-6 };
+    struct fll fll;
+    double freq;
+    unsigned i;
+    for (i = 0; i < sizeof(eps) / sizeof(eps[0]); i++) {
+        memset(&fll, 0, sizeof(fll));
+        CHECK_EQ(measure(&fll, eps[i], -1, 0, &freq), FLL_INTERVALS + 1);
+        CHECK_NEAR(freq, 1 / (1 + eps[i]) - 1, 3e-8);
+        CHECK_EQ(fll.count, -1);
+    }
+}
+
+
+static void
+test_restart(void) {
+    struct fll fll;
+    double freq;
+    memset(&fll, 0, sizeof(fll));
+    /* Missed pulse: the measurement starts over from the edge after it */
+    CHECK_EQ(measure(&fll, 20e-6, 5, 0, &freq), 5 + FLL_INTERVALS + 1);
+    CHECK_NEAR(freq, 1 / (1 + 20e-6) - 1, 3e-8);
+    /* Extra pulse in the middle of a second: two bad intervals */
+    memset(&fll, 0, sizeof(fll));
+    CHECK_EQ(measure(&fll, 20e-6, -1, 3.4, &freq), 5 + FLL_INTERVALS + 1);
+    CHECK_NEAR(freq, 1 / (1 + 20e-6) - 1, 3e-8);
+    /* An oscillator too far off never completes */
+    memset(&fll, 0, sizeof(fll));
+    CHECK_EQ(measure(&fll, 600e-6, -1, 0, &freq), -1);
+
+    /* Once done it stays out of the way, until restarted */
+    memset(&fll, 0, sizeof(fll));
+    measure(&fll, 0, -1, 0, &freq);
+    freq = 99;
+    CHECK_EQ(fll_feed(&fll, edge(50, 0), TICKS, &freq), 0);
+    CHECK_NEAR(freq, 99, 0);
+    fll_restart(&fll);
+    CHECK_EQ(fll.count, 0);
+    CHECK_EQ(fll_feed(&fll, edge(51, 0), TICKS, &freq), 1);
+    /* Restarting while measuring doesn't lose progress */
+    fll_restart(&fll);
+    CHECK_EQ(fll.count, 1);
+}
+
+
+static int
+pull_in(double eps, int use_fll) {
+    /* Seconds until the PLL has the phase within 1 us for good, starting
+     * 3 ms off with the oscillator eps fast. The FLL, if used, holds the PLL
+     * off while it measures, like pll_thread() does. */
+    struct fll fll;
+    double theta = 3e-3, u, freq;
+    int t, settled = -1;
+    memset(&fll, 0, sizeof(fll));
+    if (!use_fll) {
+        fll.count = -1;
+    }
+    pll_float.init();
+    pll_float.reset();
+    u = pll_float.poll();
+    for (t = 0; t < 3000; t++) {
+        theta += eps + u;
+        if (fll.count >= 0) {
+            if (!fll_feed(&fll, edge(t, eps), TICKS, &freq)) {
+                pll_float.seed(freq, -1);
+                u = pll_float.math(theta);
+            } else {
+                u = pll_float.poll();
+            }
+        } else {
+            u = pll_float.math(theta);
+        }
+        if (fabs(theta) > 1e-6) {
+            settled = -1;
+        } else if (settled < 0) {
+            settled = t;
+        }
+    }
+    return settled;
+}
+
+
+static void
+test_pull_in(void) {
+    int cold, seeded;
+    cold = pull_in(20e-6, 0);
+    seeded = pull_in(20e-6, 1);
+    printf("20 ppm: within 1 us after %d s cold, %d s with the FLL\n",
+            cold, seeded);
+    CHECK(seeded > 0);
+    CHECK(seeded < cold);
+    /* Cold, the PLL doesn't get there at all in the time */
+    cold = pull_in(100e-6, 0);
+    seeded = pull_in(100e-6, 1);
+    printf("100 ppm: within 1 us after %d s cold, %d s with the FLL\n",
+            cold, seeded);
+    CHECK(seeded > 0);
+    CHECK(cold < 0 || seeded < cold);
+}
+
+
+int
+main(void) {
+    test_measure();
+    test_restart();
+    test_pull_in();
+    return unit_done("fll");
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* The GPS parser must get the same times out of a receiver's output however
+ * it is split into spans, pass every byte on to the relay, start over after a
+ * quiet line instead of gluing a cut-off packet to the next one, and lose no
+ * more than the packet a corrupted byte landed in. */
+
+#include <time.h>
+#include "gps_stream.h"
+#include "gps/parser.h"
+#include "unit.h"
+
+#define SECONDS     600
+#define START       1700000000
+/* Quiet time between each second's burst, as a receiver leaves it */
+#define QUIET       pdMS_TO_TICKS(200)
+
+typedef void (*second_fn)(struct stream *s, uint32_t when);
+
+static const struct {
+    const char *name;
+    second_fn second;
+} protos[] = {
+    {"ublox", stream_ubx_second},
+    {"nmea", stream_nmea_second},
+    {"tsip", stream_tsip_second},
+    {"oncore", stream_oncore_second},
+};
+#define PROTOS (sizeof(protos) / sizeof(protos[0]))
+
+
+static void
+feed(const uint8_t *data, size_t len, size_t span, uint32_t idle) {
+    /* Feed in spans of the given size, or random ones if 0. idle is the gap
+     * before the first. */
+    size_t n;
+    while (len) {
+        n = span ? span : 1 + rand() % 300;
+        if (n > len) {
+            n = len;
+        }
+        gps_bytes_received(data, n, idle);
+        idle = 0;
+        data += n;
+        len -= n;
+    }
+}
+
+
+static int
+is_time(uint32_t when) {
+    /* Whether the last time of day given to vtimer was this one */
+    time_t t = when;
+    struct tm *tm = gmtime(&t);
+    return gps_events.year == tm->tm_year + 1900
+        && gps_events.month == tm->tm_mon + 1
+        && gps_events.day == tm->tm_mday
+        && gps_events.hour == tm->tm_hour
+        && gps_events.minute == tm->tm_min
+        && gps_events.second == tm->tm_sec;
+}
+
+
+static void
+start_over(void) {
+    /* As if the receiver had been quiet long enough to forget it */
+    fake_ticks += pdMS_TO_TICKS(2 * PARSER_TIMEOUT_MS);
+    gps_rx_lost();
+    memset(&gps_events, 0, sizeof(gps_events));
+}
+
+
+static void
+test_seconds(void) {
+    /* A second at a time, each after a quiet line. The time of day is the
+     * second just sent, right away. */
+    static const size_t spans[] = {1, 7, 64, 256, 0};
+    struct stream s = {0};
+    unsigned i, j, k, wrong, relayed;
+    for (i = 0; i < PROTOS; i++) {
+        for (j = 0; j < sizeof(spans) / sizeof(spans[0]); j++) {
+            start_over();
+            wrong = relayed = 0;
+            for (k = 0; k < SECONDS; k++) {
+                s.len = 0;
+                protos[i].second(&s, START + k);
+                feed(s.buf, s.len, spans[j], QUIET);
+                fake_ticks += QUIET;
+                relayed += s.len;
+                if (!is_time(START + k)) {
+                    wrong++;
+                }
+            }
+            if (wrong) {
+                printf("%s span %u: %u seconds wrong\n", protos[i].name,
+                        (unsigned)spans[j], wrong);
+            }
+            CHECK_EQ(wrong, 0);
+            CHECK_EQ(gps_events.relayed, relayed);
+            /* NMEA gives RMC until it sees ZDA, and then only ZDA */
+            CHECK_EQ(gps_events.utc, SECONDS + (i == 1));
+        }
+    }
+    free(s.buf);
+}
+
+
+static void
+test_values(void) {
+    /* What each protocol passes on besides the time of day */
+    struct stream s = {0};
+    uint32_t gps = START + 1 - (315964800 - 18);
+    start_over();
+    stream_ubx_second(&s, START);
+    feed(s.buf, s.len, 0, QUIET);
+    CHECK_EQ(gps_fix_svs, 9);
+    CHECK_EQ(gps_events.next_pps, 1);
+    CHECK_EQ(gps_events.tow, gps % 604800);
+    CHECK_NEAR(gps_events.corr, 2.5e-9, 1e-15);
+
+    start_over();
+    s.len = 0;
+    stream_tsip_second(&s, START);
+    feed(s.buf, s.len, 0, QUIET);
+    CHECK_EQ(gps_events.correction, 1);
+    CHECK_NEAR(gps_events.corr, -2.5e-9, 1e-15);
+    free(s.buf);
+}
+
+
+static void
+test_spans(void) {
+    /* A whole stream in random spans crossing packets and seconds, and with
+     * no gaps. Also the four protocols one after another on one line. */
+    struct stream s[PROTOS + 1] = {{0}};
+    unsigned i, k;
+    for (k = 0; k < SECONDS; k++) {
+        for (i = 0; i < PROTOS; i++) {
+            protos[i].second(&s[i], START + k);
+        }
+        protos[k % PROTOS].second(&s[PROTOS], START + k);
+    }
+    for (i = 0; i <= PROTOS; i++) {
+        start_over();
+        feed(s[i].buf, s[i].len, 0, QUIET);
+        CHECK(is_time(START + SECONDS - 1));
+        CHECK_EQ(gps_events.utc, SECONDS + (i == 1 || i == PROTOS));
+        CHECK_EQ(gps_events.relayed, s[i].len);
+        free(s[i].buf);
+    }
+}
+
+
+static void
+test_gap(void) {
+    /* A second cut off anywhere by a dropout must not swallow the start of
+     * the next one, as long as the line went quiet in between. Without the
+     * gap the fixed length protocols do lose it. */
+    struct stream s = {0};
+    unsigned i, cut, first, lost, lost_nogap;
+    for (i = 0; i < PROTOS; i++) {
+        s.len = 0;
+        protos[i].second(&s, START);
+        first = s.len;
+        protos[i].second(&s, START + 1);
+        lost = lost_nogap = 0;
+        for (cut = 1; cut < first; cut++) {
+            start_over();
+            feed(s.buf, cut, 0, QUIET);
+            feed(s.buf + first, s.len - first, 0, QUIET);
+            if (!is_time(START + 1)) {
+                lost++;
+            }
+            start_over();
+            feed(s.buf, cut, 0, QUIET);
+            feed(s.buf + first, s.len - first, 0, 0);
+            if (!is_time(START + 1)) {
+                lost_nogap++;
+            }
+        }
+        printf("gap: %s lost %u of %u with a gap, %u without\n",
+                protos[i].name, lost, first - 1, lost_nogap);
+        CHECK_EQ(lost, 0);
+        if (i == 0 || i == 3) {
+            CHECK(lost_nogap > 0);
+        }
+    }
+    free(s.buf);
+}
+
+
+static void
+test_corrupt(void) {
+    /* One byte in every third second is changed. The other seconds must
+     * all be decoded, and where there is a checksum the changed ones must
+     * not give a wrong time. */
+    struct stream s = {0};
+    unsigned i, k, missed, wrong, lost, before;
+    for (i = 0; i < PROTOS; i++) {
+        start_over();
+        missed = wrong = lost = 0;
+        for (k = 0; k < SECONDS; k++) {
+            s.len = 0;
+            protos[i].second(&s, START + k);
+            if (k % 3 == 0) {
+                s.buf[rand() % s.len] ^= 1 + rand() % 255;
+            }
+            before = gps_events.utc;
+            feed(s.buf, s.len, 0, QUIET);
+            fake_ticks += QUIET;
+            if (is_time(START + k)) {
+                continue;
+            } else if (k % 3) {
+                missed++;
+            } else if (gps_events.utc == before) {
+                lost++;
+            } else if (i != 2) {
+                /* TSIP has no checksum */
+                wrong++;
+            }
+        }
+        printf("corrupt: %s lost %u of %u changed seconds\n",
+                protos[i].name, lost, (SECONDS + 2) / 3);
+        CHECK_EQ(missed, 0);
+        CHECK_EQ(wrong, 0);
+    }
+    free(s.buf);
+}
+
+
+int
+main(void) {
+    srand(1);
+    test_seconds();
+    test_values();
+    test_spans();
+    test_gap();
+    test_corrupt();
+    return unit_done("gps");
+}
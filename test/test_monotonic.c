@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* The chained 32-bit counter must read back exactly the tick its low half was
+ * sampled on, across low and high half rollovers and with the high half
+ * lagging the low half. Captures must map back to the tick they were taken
+ * on. The capture ring, filled from a signal handler standing in for the
+ * interrupt, must hand over every edge in order, exactly once or counted as
+ * dropped, and never torn. */
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include "unit.h"
+
+/* Model of TIM3 (low half) chained into TIM2 (high half), read one cycle per
+ * register access. The high half counts each low wrap HW_LAG cycles late, and
+ * its own wrap sets UIF. wraps_seen is how many of those have been
+ * acknowledged. */
+#define HW_LAG 2
+static uint64_t cycle, lo_cycle;
+static uint64_t wraps_seen;
+
+
+static uint16_t model_hi(void);
+static uint16_t model_lo(void);
+static int model_uif(void);
+
+#define MONO_HI()           (cycle++, model_hi())
+#define MONO_LO()           (cycle++, model_lo())
+#define MONO_UIF()          (cycle++, model_uif())
+#define MONO_UIF_CLEAR()    (cycle++, wraps_seen++)
+#include "monotonic.h"
+
+
+static uint64_t
+hi_count(void) {
+    return cycle < HW_LAG ? 0 : (cycle - HW_LAG) / MONO_PERIOD;
+}
+
+
+static uint16_t
+model_hi(void) {
+    return (uint16_t)hi_count();
+}
+
+
+static uint16_t
+model_lo(void) {
+    lo_cycle = cycle;
+    return (uint16_t)cycle;
+}
+
+
+static int
+model_uif(void) {
+    return hi_count() / MONO_PERIOD > wraps_seen;
+}
+
+
+static void
+check_read(uint64_t start, int uif_pending) {
+    /* Read starting at the given cycle. The epoch has counted every high
+     * half wrap so far, except possibly the latest one. */
+    static int failures;
+    volatile uint64_t epoch;
+    uint64_t got;
+    uint16_t lo;
+    cycle = start;
+    wraps_seen = hi_count() / MONO_PERIOD;
+    if (uif_pending && wraps_seen) {
+        wraps_seen--;
+    }
+    epoch = MONO_WRAP * (1 + wraps_seen);
+    got = mono_read_hw(&epoch, &lo);
+    if (got != MONO_WRAP + lo_cycle || lo != (uint16_t)lo_cycle) {
+        if (failures++ < 10) {
+            printf("read from %llu: got %llu want %llu\n",
+                    (unsigned long long)start, (unsigned long long)got,
+                    (unsigned long long)(MONO_WRAP + lo_cycle));
+        }
+        CHECK(0);
+    }
+    /* Doesn't spin for long */
+    CHECK(cycle - start < 30);
+}
+
+
+static void
+test_read(void) {
+    uint64_t base;
+    int k, off;
+    /* Around low half wraps, including the first few high half wraps */
+    for (k = 1; k < 70000; k += (k < 16 ? 1 : 997)) {
+        base = (uint64_t)k * MONO_PERIOD;
+        for (off = -12; off < 16; off++) {
+            check_read(base + off, 0);
+        }
+    }
+    for (k = 1; k < 4; k++) {
+        base = (uint64_t)k * MONO_WRAP;
+        for (off = -12; off < 40; off++) {
+            check_read(base + off, 0);
+            check_read(base + off, 1);
+        }
+    }
+    /* Anywhere else */
+    for (k = 0; k < 100000; k++) {
+        check_read(((uint64_t)rand() << 20) ^ rand(), 0);
+    }
+}
+
+
+static void
+test_capture(void) {
+    /* A capture up to one low period before the read maps back exactly */
+    uint64_t now, edge;
+    int k, ago;
+    for (k = 0; k < 20000; k++) {
+        now = MONO_WRAP + (((uint64_t)rand() << 16) ^ rand());
+        for (ago = 0; ago < MONO_PERIOD; ago += 1 + rand() % 4096) {
+            edge = now - ago;
+            CHECK_EQ(mono_from_capture(now, (uint16_t)now, (uint16_t)edge),
+                    edge);
+        }
+    }
+}
+
+
+/* The ring, with a signal handler as the interrupt. Edge n is at n * STRIDE
+ * ticks, so every field can be checked against the sequence number. */
+#define STRIDE      72000017ULL
+#define EDGES       200000
+static struct pps_ring ring;
+static volatile uint32_t put;
+
+
+static void
+isr(int sig) {
+    (void)sig;
+    if (put < EDGES) {
+        put++;
+        pps_ring_put(&ring, put * STRIDE, put & 1 ? 1 : 3);
+    }
+}
+
+
+static int
+check_cap(const pps_capture_t *cap, uint32_t last_seq) {
+    return cap->seq > last_seq
+        && cap->mono == cap->seq * STRIDE
+        && cap->channel == (cap->seq & 1 ? 1 : 3)
+        && cap->interval == (cap->seq == 1 ? UINT32_MAX : STRIDE);
+}
+
+
+static void
+test_ring(void) {
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    timer_t timer;
+    pps_capture_t cap;
+    uint32_t dropped = 0, was_dropped, got = 0, last = 0, bad = 0, order = 0;
+    int idle;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = isr;
+    sigaction(SIGALRM, &sa, NULL);
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGALRM;
+    CHECK_EQ(timer_create(CLOCK_MONOTONIC, &sev, &timer), 0);
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = 10000;
+    timer_settime(timer, 0, &its, NULL);
+
+    /* Read in bursts, sometimes stalling long enough to overflow the ring */
+    while (put < EDGES) {
+        idle = rand() % 64 ? rand() % 3000 : 30000;
+        for (; idle > 0; idle--) {
+            BARRIER();
+        }
+        while (1) {
+            was_dropped = dropped;
+            if (!pps_ring_get(&ring, &cap, &dropped)) {
+                break;
+            }
+            if (!check_cap(&cap, last)) {
+                bad++;
+            }
+            /* Either the next one, or the ones skipped are counted */
+            if (cap.seq != last + 1 + (dropped - was_dropped)) {
+                order++;
+            }
+            last = cap.seq;
+            got++;
+        }
+    }
+    memset(&its, 0, sizeof(its));
+    timer_settime(timer, 0, &its, NULL);
+    timer_delete(timer);
+    while (pps_ring_get(&ring, &cap, &dropped)) {
+        if (!check_cap(&cap, last)) {
+            bad++;
+        }
+        last = cap.seq;
+        got++;
+    }
+    printf("ring: %u edges, %u read, %u dropped\n", (unsigned)put,
+            (unsigned)got, (unsigned)dropped);
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(order, 0);
+    CHECK_EQ(got + dropped, EDGES);
+    CHECK_EQ(last, EDGES);
+    CHECK(dropped > 0);
+    CHECK(got > PPS_RING);
+}
+
+
+int
+main(void) {
+    srand(1);
+    test_read();
+    test_capture();
+    test_ring();
+    return unit_done("monotonic");
+}
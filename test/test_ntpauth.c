@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* NTP MACs computed from the cloned key state must match a fresh
+ * MD5/SHA1(key || header), and cloning must leave the key state alone. The
+ * expected digests were computed independently with Python's hashlib. */
+
+#include "eeprom.h"
+#include "net/ntpauth.h"
+#include "unit.h"
+
+cfgv2_t cfg;
+
+static uint8_t msg[NTP_HEADER_SIZE + NTP_KEYID_SIZE + 20];
+
+
+static void
+setup(uint32_t flags) {
+    int i;
+    memset(&cfg, 0, sizeof(cfg));
+    for (i = 0; i < 20; i++) {
+        cfg.ntp_key[i] = 0x40 + i;
+    }
+    cfg.flags = flags;
+    for (i = 0; i < NTP_HEADER_SIZE; i++) {
+        msg[i] = i * 7 + 1;
+    }
+}
+
+
+static uint16_t
+sign(uint32_t key_id, const uint8_t *secret, int is_sha1) {
+    /* Append a key ID and MAC computed the slow way */
+    uint8_t *p = msg + NTP_HEADER_SIZE;
+    p[0] = key_id >> 24;
+    p[1] = key_id >> 16;
+    p[2] = key_id >> 8;
+    p[3] = key_id;
+    p += NTP_KEYID_SIZE;
+    if (is_sha1) {
+        SHA_CTX sha;
+        SHA1_Init(&sha);
+        SHA1_Update(&sha, secret, 20);
+        SHA1_Update(&sha, msg, NTP_HEADER_SIZE);
+        SHA1_Final(p, &sha);
+        return NTP_NAK_SIZE + 20;
+    } else {
+        MD5_CTX md5;
+        MD5_Init(&md5);
+        MD5_Update(&md5, secret, 20);
+        MD5_Update(&md5, msg, NTP_HEADER_SIZE);
+        MD5_Final(p, &md5);
+        return NTP_NAK_SIZE + 16;
+    }
+}
+
+
+static void
+test_legacy(void) {
+    const struct ntp_key_state *key;
+    uint8_t md[20], want[20];
+    uint16_t len;
+
+    setup(FLAG_NTPKEY_MD5);
+    ntp_auth_init();
+    key = ntp_auth_lookup(12345);
+    CHECK(key != NULL);
+    CHECK_EQ(key->digest_len, 16);
+    unit_unhex(want, "1289501009c041b8ccb060c020dce7d7");
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 16);
+    /* Again, to show the key state wasn't consumed */
+    memset(md, 0, sizeof(md));
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 16);
+
+    setup(FLAG_NTPKEY_SHA1);
+    ntp_auth_init();
+    key = ntp_auth_lookup(1);
+    CHECK(key != NULL);
+    CHECK_EQ(key->digest_len, 20);
+    unit_unhex(want, "aaeaaa718f49f38e7d8a2abaf3b7f0e953041d79");
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 20);
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 20);
+
+    /* Legacy key takes any ID, and a bad MAC gets a crypto-NAK */
+    len = sign(999, cfg.ntp_key, 1);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), len);
+    CHECK(key == ntp_auth_lookup(0));
+    msg[3] ^= 1;
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_NAK_SIZE);
+    CHECK(key == NULL);
+    /* As does a MAC of the wrong length */
+    len = sign(999, cfg.ntp_key, 0);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_NAK_SIZE);
+
+    /* No key configured at all */
+    setup(0);
+    ntp_auth_init();
+    CHECK(ntp_auth_lookup(1) == NULL);
+    len = sign(1, cfg.ntp_key, 0);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_HEADER_SIZE);
+    CHECK_EQ(ntp_auth_check(msg, NTP_HEADER_SIZE, &key), NTP_HEADER_SIZE);
+}
+
+
+static void
+test_derived(void) {
+    const struct ntp_key_state *key;
+    uint8_t secret[20], want[20], md[20];
+    uint16_t len;
+
+    setup(FLAG_NTPKEYn_SHA1(1));
+    cfg.ntp_key_ids[0] = 1;
+    cfg.ntp_key_ids[1] = 0x1234;
+    cfg.ntp_key_ids[2] = 0xbeef;
+    cfg.flags |= FLAG_NTPKEYn_SHA1(2);
+    ntp_auth_init();
+
+    ntp_key_derive(1, secret);
+    unit_unhex(want, "6397d1c1dbefc476bcaf21ab02161aa67558b1c5");
+    CHECK_MEM(secret, want, 20);
+    key = ntp_auth_lookup(1);
+    CHECK(key != NULL);
+    CHECK_EQ(key->digest_len, 16);
+    unit_unhex(want, "bef95358885615341da560da8fcc3f0d");
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 16);
+
+    ntp_key_derive(0x1234, secret);
+    unit_unhex(want, "6713bfe4ac59eddabc7d512e42d6b96a6bcc859d");
+    CHECK_MEM(secret, want, 20);
+    key = ntp_auth_lookup(0x1234);
+    CHECK(key != NULL);
+    CHECK_EQ(key->digest_len, 20);
+    unit_unhex(want, "7e0b837aaaff063fa04135b680044292a679bf08");
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 20);
+
+    /* IDs are kept to 16 bits, and a wire ID above that never matches one
+     * by its low half */
+    ntp_key_derive(0xbeef, secret);
+    unit_unhex(want, "d6f2e613e1b7443b27ca2d52a8f9e5c952617a56");
+    CHECK_MEM(secret, want, 20);
+    key = ntp_auth_lookup(0xbeef);
+    CHECK(key != NULL);
+    unit_unhex(want, "706ee1c9bfa5ab0a0f68259206810f74d8b738a0");
+    ntp_auth_digest(key, msg, md);
+    CHECK_MEM(md, want, 20);
+    CHECK(ntp_auth_lookup(0xdeadbeef) == NULL);
+    len = sign(0xdeadbeef, secret, 1);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_NAK_SIZE);
+    CHECK(key == NULL);
+
+    /* Good MAC on each ID */
+    ntp_key_derive(0x1234, secret);
+    len = sign(0x1234, secret, 1);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), len);
+    CHECK(key == ntp_auth_lookup(0x1234));
+    ntp_key_derive(1, secret);
+    len = sign(1, secret, 0);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), len);
+    CHECK(key == ntp_auth_lookup(1));
+
+    /* Known ID with a bad MAC gets a crypto-NAK, not a plain reply */
+    msg[NTP_HEADER_SIZE + NTP_KEYID_SIZE] ^= 0x80;
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_NAK_SIZE);
+    CHECK(key == NULL);
+
+    /* Unknown ID gets a crypto-NAK, and the master key is not accepted */
+    len = sign(2, secret, 0);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_NAK_SIZE);
+    CHECK(key == NULL);
+    len = sign(7, cfg.ntp_key, 0);
+    CHECK_EQ(ntp_auth_check(msg, len, &key), NTP_NAK_SIZE);
+    CHECK(ntp_auth_lookup(0) == NULL);
+}
+
+
+int
+main(void) {
+    test_legacy();
+    test_derived();
+    return unit_done("ntpauth");
+}
@@ -0,0 +1,708 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* The NTP fast path must only take frames that lwIP would have delivered to
+ * the NTP socket, with the same source address and payload. lwIP isn't built
+ * on the host, so ref_input() models the checks its ip4_input, ip6_input and
+ * udp_input make, with checksum checking turned on. Well-formed requests and
+ * randomly damaged copies of them are run through both.
+ *
+ * The replies are then compared end to end. ntpserver.c and udp_reply.c are
+ * built against the stand-ins in test/include, and lwip_input() delivers
+ * frames to ntp_recv() the way lwIP's input path would. Every request is
+ * answered once through ntp_fast_input(), falling back to lwIP as
+ * ethernetif_input() does, and once through lwIP alone, and the two replies
+ * must be the same to the byte. */
+
+#include "common.h"
+#include "eeprom.h"
+#include "lwip/udp.h"
+#include "net/ntpauth.h"
+#include "net/ntpfast.h"
+#include "net/ntprate.h"
+#include "net/ntpserver.h"
+#include "net/tcpip.h"
+#include "netif/etharp.h"
+#include "stm32/eth_mac.h"
+#include "vtimer.h"
+#include "unit.h"
+
+#define MAX_FRAME   200
+
+struct ref_result {
+    const uint8_t *src, *dst;
+    const uint8_t *payload;
+    uint16_t payload_len;
+};
+
+
+static uint32_t
+sum16(uint32_t sum, const uint8_t *p, int len) {
+    int i;
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += (p[i] << 8) | p[i + 1];
+    }
+    if (len & 1) {
+        sum += p[len - 1] << 8;
+    }
+    return sum;
+}
+
+
+static uint16_t
+fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return sum;
+}
+
+
+static int
+ref_input(const uint8_t *frame, int len, int check_csum,
+        struct ref_result *res) {
+    /* Returns 1 if lwIP would hand the datagram to the NTP socket as is, 0
+     * if it would drop it or reassemble it first */
+    const uint8_t *ip = frame + 14, *udp;
+    int type, hlen, ip_len, udp_avail;
+    uint32_t sum;
+    if (len < 14) {
+        return 0;
+    }
+    type = (frame[12] << 8) | frame[13];
+    if (type == 0x0800) {
+        if (len < 14 + 20 || (ip[0] >> 4) != 4) {
+            return 0;
+        }
+        hlen = (ip[0] & 15) * 4;
+        ip_len = (ip[2] << 8) | ip[3];
+        if (hlen < 20 || hlen > len - 14 || ip_len > len - 14 || ip_len < hlen) {
+            return 0;
+        }
+        if (check_csum && fold(sum16(0, ip, hlen)) != 0xFFFF) {
+            return 0;
+        }
+        if (((ip[6] << 8) | ip[7]) & 0x3FFF) {
+            return 0;
+        }
+        if (ip[9] != 17) {
+            return 0;
+        }
+        res->src = ip + 12;
+        res->dst = ip + 16;
+        udp = ip + hlen;
+        udp_avail = ip_len - hlen;
+        sum = sum16(0, ip + 12, 8) + 17 + udp_avail;
+    } else if (type == 0x86DD) {
+        if (len < 14 + 40 || (ip[0] >> 4) != 6 || ip[6] != 17) {
+            return 0;
+        }
+        ip_len = 40 + ((ip[4] << 8) | ip[5]);
+        if (ip_len > len - 14) {
+            return 0;
+        }
+        res->src = ip + 8;
+        res->dst = ip + 24;
+        udp = ip + 40;
+        udp_avail = ip_len - 40;
+        sum = sum16(0, ip + 8, 32) + 17 + udp_avail;
+    } else {
+        return 0;
+    }
+    if (udp_avail < 8 || ((udp[2] << 8) | udp[3]) != NTP_PORT) {
+        return 0;
+    }
+    if (check_csum && (type == 0x86DD || udp[6] || udp[7])
+            && fold(sum16(sum, udp, udp_avail)) != 0xFFFF) {
+        return 0;
+    }
+    res->payload = udp + 8;
+    res->payload_len = udp_avail - 8;
+    return 1;
+}
+
+
+static void
+put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+
+static void
+seal(uint8_t *frame) {
+    /* Fill in the IPv4 header and UDP checksums of a frame from build() */
+    uint8_t *ip = frame + 14, *udp;
+    int udp_len;
+    uint32_t sum;
+    if (frame[12] == 0x86) {
+        udp = ip + 40;
+        sum = sum16(0, ip + 8, 32);
+    } else {
+        udp = ip + 20;
+        put16(ip + 10, 0);
+        put16(ip + 10, ~fold(sum16(0, ip, 20)));
+        sum = sum16(0, ip + 12, 8);
+    }
+    udp_len = (udp[4] << 8) | udp[5];
+    put16(udp + 6, 0);
+    sum = fold(sum16(sum + 17 + udp_len, udp, udp_len));
+    put16(udp + 6, ~sum ? ~sum : 0xFFFF);
+}
+
+
+static int
+build(uint8_t *frame, int is_ipv6, int ntp_len, int pad) {
+    /* A well-formed NTP request with random addresses and contents */
+    uint8_t *ip = frame + 14, *udp;
+    int i, hlen = is_ipv6 ? 40 : 20, len;
+    for (i = 0; i < MAX_FRAME; i++) {
+        frame[i] = rand();
+    }
+    put16(frame + 12, is_ipv6 ? 0x86DD : 0x0800);
+    udp = ip + hlen;
+    put16(udp + 2, NTP_PORT);
+    put16(udp + 4, 8 + ntp_len);
+    udp[8] = (udp[8] & ~MODE_MASK) | MODE_CLIENT;
+    if (is_ipv6) {
+        ip[0] = 0x60;
+        put16(ip + 4, 8 + ntp_len);
+        ip[6] = 17;
+    } else {
+        ip[0] = 0x45;
+        put16(ip + 2, hlen + 8 + ntp_len);
+        put16(ip + 6, 0x4000); /* DF */
+        ip[9] = 17;
+    }
+    seal(frame);
+    len = 14 + hlen + 8 + ntp_len + pad;
+    ASSERT(len <= MAX_FRAME);
+    return len;
+}
+
+
+static int
+same(const struct ntp_fast_frame *ff, const uint8_t *frame,
+        const struct ref_result *ref) {
+    int alen = ff->is_ipv6 ? 16 : 4;
+    return ff->src == ref->src && ff->dst == ref->dst
+        && frame + ff->hlen + 8 == ref->payload
+        && ff->udp_len - 8 == ref->payload_len
+        && !memcmp(ff->src, ref->src, alen);
+}
+
+
+static void
+test_good(void) {
+    /* Every well-formed request takes the fast path, checked or not */
+    uint8_t frame[MAX_FRAME];
+    struct ntp_fast_frame ff;
+    struct ref_result ref;
+    int i, len, missed = 0, differ = 0;
+    for (i = 0; i < 10000; i++) {
+        len = build(frame, i & 1, 48 + (i % 3) * 20, (i >> 1) % 3 ? 0 : 6);
+        if (!ref_input(frame, len, 1, &ref)) {
+            missed++;
+            continue;
+        }
+        if (!ntp_fast_parse(frame, len, 0, &ff) || !same(&ff, frame, &ref)) {
+            differ++;
+        }
+        if (!ntp_fast_parse(frame, len, 1, &ff) || !same(&ff, frame, &ref)) {
+            differ++;
+        }
+    }
+    CHECK_EQ(missed, 0);
+    CHECK_EQ(differ, 0);
+}
+
+
+static void
+test_damaged(void) {
+    /* Damage requests at random. Anything the fast path takes, lwIP must
+     * also have taken, and the same way. If the MAC says it checked the
+     * checksums, only the structure has to agree. */
+    uint8_t frame[MAX_FRAME];
+    struct ntp_fast_frame ff;
+    struct ref_result ref;
+    int i, j, len, taken = 0, wrong = 0, csum_wrong = 0, bad_sums = 0;
+    for (i = 0; i < 200000; i++) {
+        len = build(frame, i & 1, 48 + rand() % 40, rand() % 2 ? 0 : 4);
+        switch (rand() % 4) {
+        case 0:
+            /* Flip a bit in the headers */
+            j = rand() % (14 + 40 + 8);
+            frame[j] ^= 1 << (rand() % 8);
+            break;
+        case 1:
+            /* Flip a bit anywhere */
+            j = rand() % len;
+            frame[j] ^= 1 << (rand() % 8);
+            break;
+        case 2:
+            /* Truncate */
+            len = rand() % len;
+            break;
+        case 3:
+            /* Scribble on a length, offset or type field */
+            j = (int[]){12, 16, 18, 20, 22, 23, 38, 40, 58, 60}[rand() % 10];
+            frame[j] = rand();
+            break;
+        }
+        if (ntp_fast_parse(frame, len, 0, &ff)) {
+            taken++;
+            if (!ref_input(frame, len, 1, &ref) || !same(&ff, frame, &ref)) {
+                wrong++;
+            }
+        } else if (ref_input(frame, len, 0, &ref)
+                && !ref_input(frame, len, 1, &ref)) {
+            bad_sums++;
+        }
+        if (ntp_fast_parse(frame, len, 1, &ff)
+                && (!ref_input(frame, len, 0, &ref)
+                    || !same(&ff, frame, &ref))) {
+            csum_wrong++;
+        }
+    }
+    CHECK(taken > 10000);
+    CHECK(bad_sums > 10000);
+    CHECK_EQ(wrong, 0);
+    CHECK_EQ(csum_wrong, 0);
+}
+
+
+static void
+test_checksums(void) {
+    /* Specific cases */
+    uint8_t frame[MAX_FRAME];
+    struct ntp_fast_frame ff;
+    int len;
+
+    /* IPv4 without a UDP checksum is fine */
+    len = build(frame, 0, 48, 0);
+    put16(frame + 14 + 20 + 6, 0);
+    CHECK(ntp_fast_parse(frame, len, 0, &ff));
+    /* but not IPv6 */
+    len = build(frame, 1, 48, 0);
+    put16(frame + 14 + 40 + 6, 0);
+    CHECK(!ntp_fast_parse(frame, len, 0, &ff));
+    /* A bad IPv4 header checksum */
+    len = build(frame, 0, 48, 0);
+    frame[14 + 10] ^= 0x10;
+    CHECK(!ntp_fast_parse(frame, len, 0, &ff));
+    CHECK(ntp_fast_parse(frame, len, 1, &ff));
+    /* A bad payload */
+    len = build(frame, 0, 48, 0);
+    frame[len - 1] ^= 0x80;
+    CHECK(!ntp_fast_parse(frame, len, 0, &ff));
+    /* UDP shorter than the IP packet is left to lwIP */
+    len = build(frame, 0, 48, 0);
+    put16(frame + 14 + 20 + 4, 8 + 48 - 2);
+    CHECK(!ntp_fast_parse(frame, len, 1, &ff));
+}
+
+
+/* Stand-ins for lwIP and the rest of the firmware, for ntpserver.c */
+
+#define KEY_ID      0xbeef
+
+struct test_pbuf {
+    struct pbuf p;
+    uint8_t buf[ETH_PAD_SIZE + MAX_FRAME];
+};
+
+cfgv2_t cfg;
+struct netif thisif;
+static struct udp_pcb pcbs[2];
+static int npcbs, frees, rate_result;
+/* Client address the last request was rate limited under */
+static uint32_t rate_addr;
+static uint8_t reply[ETH_PAD_SIZE + MAX_FRAME];
+static int reply_len;
+
+
+uint8_t
+pbuf_header(struct pbuf *p, int16_t header_size_increment) {
+    struct test_pbuf *tp = (struct test_pbuf*)p;
+    uint8_t *payload = (uint8_t*)p->payload - header_size_increment;
+    if (payload < tp->buf || header_size_increment < -(int)p->len) {
+        return 1;
+    }
+    p->payload = payload;
+    p->len += header_size_increment;
+    p->tot_len += header_size_increment;
+    return 0;
+}
+
+
+void
+pbuf_realloc(struct pbuf *p, uint16_t size) {
+    if (size < p->tot_len) {
+        p->len = p->tot_len = size;
+    }
+}
+
+
+uint8_t
+pbuf_free(struct pbuf *p) {
+    frees++;
+    return 1;
+}
+
+
+struct udp_pcb *
+udp_new(void) {
+    struct udp_pcb *pcb;
+    ASSERT(npcbs < 2);
+    pcb = &pcbs[npcbs++];
+    pcb->ttl = 255;
+    return pcb;
+}
+
+
+struct udp_pcb *
+udp_new_ip6(void) {
+    struct udp_pcb *pcb = udp_new();
+    pcb->isipv6 = 1;
+    return pcb;
+}
+
+
+err_t
+udp_bind(struct udp_pcb *pcb, ip_addr_t *ipaddr, u16_t port) {
+    pcb->local_port = port;
+    return ERR_OK;
+}
+
+
+void
+udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+    pcb->recv = recv;
+    pcb->recv_arg = recv_arg;
+}
+
+
+ip6_addr_t *
+ip6_select_source_address(struct netif *netif, ip6_addr_t *dest) {
+    int i;
+    for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+        if (ip6_addr_isvalid(netif_ip6_addr_state(netif, i))) {
+            return netif_ip6_addr(netif, i);
+        }
+    }
+    HALT();
+}
+
+
+u32_t
+sys_now(void) {
+    return 0;
+}
+
+
+uint64_t
+vtimer_now(void) {
+    return 0xe1234567ULL << 32 | 0x89abcdef;
+}
+
+
+uint64_t
+vtimer_from_mono(uint64_t mono) {
+    return mono;
+}
+
+
+uint64_t
+tcpip_rx_timestamp(void) {
+    return vtimer_now() - 12345;
+}
+
+
+void
+mac_set_tx_callback(mac_tx_func func, void *arg) {
+}
+
+
+int
+ntp_rate_check(uint32_t addr, uint32_t now) {
+    rate_addr = addr;
+    return rate_result;
+}
+
+
+static err_t
+capture(struct netif *netif, struct pbuf *p) {
+    ASSERT(p->len == p->tot_len && p->len <= sizeof(reply));
+    memcpy(reply, p->payload, p->len);
+    reply_len = p->len;
+    return ERR_OK;
+}
+
+
+static void
+server_start(void) {
+    static const uint8_t hwaddr[6] = {0x02, 0x00, 0x00, 0x12, 0x34, 0x56};
+    int i;
+    for (i = 0; i < 20; i++) {
+        cfg.ntp_key[i] = 0x40 + i;
+    }
+    cfg.ntp_key_ids[0] = KEY_ID;
+    cfg.flags = FLAG_NTPKEYn_SHA1(0);
+    thisif.ip_addr.addr = PP_HTONL(0xc0000201); /* 192.0.2.1 */
+    /* 2001:db8::1, behind an address that isn't valid */
+    thisif.ip6_addr[1].addr[0] = PP_HTONL(0x20010db8);
+    thisif.ip6_addr[1].addr[3] = PP_HTONL(1);
+    thisif.ip6_addr_state[1] = IP6_ADDR_PREFERRED;
+    thisif.ip6_addr[0].addr[0] = PP_HTONL(0xfe800000);
+    thisif.ip6_addr_state[0] = IP6_ADDR_TENTATIVE;
+    memcpy(thisif.hwaddr, hwaddr, 6);
+    thisif.linkoutput = capture;
+    ntp_server_start();
+    ntp_server_update(LEAP_NONE, 1, -20, 0x1234, vtimer_now() - NTP_SECOND);
+}
+
+
+static int
+is_local(const struct ref_result *ref, int is_ipv6) {
+    int i;
+    if (!is_ipv6) {
+        return !memcmp(ref->dst, &thisif.ip_addr, 4);
+    }
+    for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+        if (ip6_addr_isvalid(netif_ip6_addr_state(&thisif, i))
+                && !memcmp(ref->dst, netif_ip6_addr(&thisif, i), 16)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static void
+lwip_input(struct pbuf *p) {
+    /* Deliver a frame to the NTP socket as lwIP would. ethernet_input, the IP
+     * input and udp_input each strip their header, and the IP layer trims off
+     * any link padding. Anything that wouldn't reach the socket is dropped. */
+    const uint8_t *frame = (const uint8_t*)p->payload + ETH_PAD_SIZE;
+    struct ref_result ref;
+    struct udp_pcb *pcb;
+    uint32_t src[4];
+    int is_ipv6, hlen;
+    if (!ref_input(frame, p->len - ETH_PAD_SIZE, 1, &ref)) {
+        pbuf_free(p);
+        return;
+    }
+    is_ipv6 = frame[12] == 0x86;
+    pcb = &pcbs[is_ipv6];
+    ASSERT(PCB_ISIPV6(pcb) == is_ipv6 && pcb->local_port == NTP_PORT);
+    if (!is_local(&ref, is_ipv6)) {
+        pbuf_free(p);
+        return;
+    }
+    hlen = ref.payload - frame - 14 - UDP_HLEN;
+    memcpy(src, ref.src, is_ipv6 ? 16 : 4);
+    ASSERT(!pbuf_header(p, -SIZEOF_ETH_HDR));
+    pbuf_realloc(p, hlen + UDP_HLEN + ref.payload_len);
+    ASSERT(!pbuf_header(p, -(hlen + UDP_HLEN)));
+    pcb->recv(pcb->recv_arg, pcb, p, (ip_addr_t*)src,
+            (ref.payload[-8] << 8) | ref.payload[-7]);
+}
+
+
+static void
+load(struct test_pbuf *tp, const uint8_t *frame, int len) {
+    /* As received by the MAC, after the link padding */
+    memset(tp, 0, sizeof(*tp));
+    memcpy(tp->buf + ETH_PAD_SIZE, frame, len);
+    tp->p.payload = tp->buf;
+    tp->p.len = tp->p.tot_len = ETH_PAD_SIZE + len;
+}
+
+
+static int
+answer(const uint8_t *frame, int len, int checked) {
+    /* Answer a frame through lwIP alone, then as the firmware would. Returns 1
+     * if the fast path took it, 0 if it was left to lwIP, or -1 if the
+     * replies or client addresses differ, or the fast path touched a frame it
+     * left for lwIP. */
+    static struct test_pbuf tp;
+    uint8_t want[sizeof(reply)];
+    uint32_t want_addr;
+    int want_len, taken;
+
+    load(&tp, frame, len);
+    reply_len = frees = 0;
+    rate_addr = 0;
+    lwip_input(&tp.p);
+    want_len = reply_len;
+    want_addr = rate_addr;
+    memcpy(want, reply, want_len);
+
+    load(&tp, frame, len);
+    reply_len = frees = 0;
+    rate_addr = 0;
+    taken = ntp_fast_input(&tp.p, checked);
+    if (!taken) {
+        if (frees || tp.p.payload != tp.buf
+                || tp.p.len != ETH_PAD_SIZE + len
+                || memcmp(tp.buf + ETH_PAD_SIZE, frame, len)) {
+            return -1;
+        }
+        lwip_input(&tp.p);
+    }
+    if (frees != 1 || rate_addr != want_addr || reply_len != want_len
+            || memcmp(reply, want, want_len)) {
+        return -1;
+    }
+    return taken;
+}
+
+
+static int
+request(uint8_t *frame, int is_ipv6, int ntp_len, int pad) {
+    /* As build(), but addressed to thisif */
+    int len = build(frame, is_ipv6, ntp_len, pad);
+    if (is_ipv6) {
+        memcpy(frame + 14 + 24, netif_ip6_addr(&thisif, 1), 16);
+    } else {
+        memcpy(frame + 14 + 16, &thisif.ip_addr, 4);
+    }
+    seal(frame);
+    return len;
+}
+
+
+static void
+sign(uint8_t *frame, int is_ipv6) {
+    /* Sign a request of NTP_NAK_SIZE + 20 bytes with the table key */
+    uint8_t *msg = frame + 14 + (is_ipv6 ? 40 : 20) + 8;
+    msg[NTP_HEADER_SIZE + 0] = 0;
+    msg[NTP_HEADER_SIZE + 1] = 0;
+    msg[NTP_HEADER_SIZE + 2] = KEY_ID >> 8;
+    msg[NTP_HEADER_SIZE + 3] = KEY_ID & 0xFF;
+    ntp_auth_digest(ntp_auth_lookup(KEY_ID), msg, msg + NTP_NAK_SIZE);
+    seal(frame);
+}
+
+
+static void
+test_replies(void) {
+    /* Every well-formed request is answered by the fast path, with the reply
+     * lwIP would have sent. That includes signed requests, crypto-NAKs, and
+     * Kiss-o'-Death and dropped requests from the rate limiter. */
+    static const int sizes[] = {48, NTP_NAK_SIZE, NTP_NAK_SIZE + 16,
+        NTP_NAK_SIZE + 20};
+    uint8_t frame[MAX_FRAME];
+    int i, is_ipv6, len, ntp_len, missed = 0, differ = 0, replies = 0;
+    for (i = 0; i < 10000; i++) {
+        is_ipv6 = i & 1;
+        ntp_len = sizes[(i >> 1) % 4];
+        len = request(frame, is_ipv6, ntp_len, (i >> 3) % 3 ? 0 : 6);
+        if (ntp_len == NTP_NAK_SIZE + 20 && (i >> 4) & 1) {
+            sign(frame, is_ipv6);
+        }
+        rate_result = (i % 7 == 0) ? RATE_KOD
+            : (i % 7 == 1) ? RATE_DROP : RATE_OK;
+        switch (answer(frame, len, (i >> 5) & 1)) {
+        case -1:
+            differ++;
+            break;
+        case 0:
+            missed++;
+            break;
+        }
+        replies += reply_len != 0;
+    }
+    rate_result = RATE_OK;
+    CHECK_EQ(missed, 0);
+    CHECK_EQ(differ, 0);
+    CHECK(replies > 8000);
+}
+
+
+static void
+test_reply_damaged(void) {
+    /* Damaged requests the MAC did not check. The fast path answers some and
+     * leaves the rest to lwIP, but the reply, if any, must be the same. */
+    uint8_t frame[MAX_FRAME];
+    int i, j, len, differ = 0, taken = 0, left = 0;
+    for (i = 0; i < 100000; i++) {
+        len = request(frame, i & 1, 48 + rand() % 40, rand() % 2 ? 0 : 4);
+        switch (rand() % 3) {
+        case 0:
+            j = rand() % (14 + 40 + 8 + 8);
+            frame[j] ^= 1 << (rand() % 8);
+            break;
+        case 1:
+            j = rand() % len;
+            frame[j] ^= 1 << (rand() % 8);
+            break;
+        case 2:
+            len = rand() % len;
+            break;
+        }
+        switch (answer(frame, len, 0)) {
+        case -1:
+            differ++;
+            break;
+        case 0:
+            left++;
+            break;
+        case 1:
+            taken++;
+            break;
+        }
+    }
+    CHECK_EQ(differ, 0);
+    CHECK(taken > 1000);
+    CHECK(left > 10000);
+}
+
+
+static void
+test_reply_checksums(void) {
+    /* Bad checksums the MAC did not check are left to lwIP, which drops
+     * them, so neither way replies */
+    uint8_t frame[MAX_FRAME];
+    int len, is_ipv6;
+    for (is_ipv6 = 0; is_ipv6 < 2; is_ipv6++) {
+        /* A bad payload */
+        len = request(frame, is_ipv6, 48, 0);
+        frame[len - 1] ^= 0x80;
+        CHECK_EQ(answer(frame, len, 0), 0);
+        CHECK_EQ(reply_len, 0);
+        /* A bad UDP checksum */
+        len = request(frame, is_ipv6, 48, 0);
+        frame[14 + (is_ipv6 ? 40 : 20) + 7] ^= 0x01;
+        CHECK_EQ(answer(frame, len, 0), 0);
+        CHECK_EQ(reply_len, 0);
+        /* and the same request intact, as a control */
+        frame[14 + (is_ipv6 ? 40 : 20) + 7] ^= 0x01;
+        CHECK_EQ(answer(frame, len, 0), 1);
+        CHECK(reply_len != 0);
+    }
+    /* A bad IPv4 header checksum */
+    len = request(frame, 0, 48, 0);
+    frame[14 + 10] ^= 0x10;
+    CHECK_EQ(answer(frame, len, 0), 0);
+    CHECK_EQ(reply_len, 0);
+}
+
+
+int
+main(void) {
+    srand(1);
+    test_good();
+    test_damaged();
+    test_checksums();
+    server_start();
+    test_replies();
+    test_reply_damaged();
+    test_reply_checksums();
+    return unit_done("ntpfast");
+}
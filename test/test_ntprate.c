@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* NTP client rate limiting: bursts, KoD then silence, recovery only after
+ * backing off, clients that collide in the table and millisecond counter
+ * wraparound */
+
+#include "net/ntprate.h"
+#include "unit.h"
+
+
+static void
+test_burst(void) {
+    /* Right after boot a fast client gets its burst, one KoD, then nothing */
+    uint32_t addr = 0x0A000001, now = 100;
+    int i;
+    for (i = 0; i < 8; i++) {
+        CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+        now += 10;
+    }
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_KOD);
+    CHECK_EQ(ntp_rate_kods, 1);
+    for (i = 0; i < 50; i++) {
+        now += 10;
+        CHECK_EQ(ntp_rate_check(addr, now), RATE_DROP);
+    }
+    CHECK_EQ(ntp_rate_drops, 50);
+    /* Backing off for one interval earns one more request */
+    now += 2000;
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_KOD);
+    /* and after a long rest the full burst is back */
+    now += 60000;
+    for (i = 0; i < 8; i++) {
+        CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+    }
+}
+
+
+static void
+test_steady(void) {
+    /* Polling at the limit is never refused. Polling at twice the limit
+     * spends the burst and is then refused for good, with one KoD, until
+     * the client backs off to the limit. */
+    uint32_t addr = 0x0A000002, now = 1000000, kods = ntp_rate_kods;
+    int i, ok = 0;
+    for (i = 0; i < 1000; i++) {
+        CHECK(ntp_rate_check(addr, now) == RATE_OK);
+        now += 2000;
+    }
+    for (i = 0; i < 1000; i++) {
+        now += 1000;
+        ok += ntp_rate_check(addr, now) == RATE_OK;
+    }
+    CHECK(ok >= 13 && ok <= 16);
+    CHECK_EQ(ntp_rate_kods - kods, 1);
+    /* Backing off not quite far enough keeps it dropped */
+    for (i = 0; i < 100; i++) {
+        now += 1999;
+        CHECK_EQ(ntp_rate_check(addr, now), RATE_DROP);
+    }
+    now += 2000;
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+}
+
+
+static void
+test_collide(void) {
+    /* A flood of new addresses can't push an abuser out or go unlimited
+     * itself, and a client whose set is full of abusers is charged for
+     * them. Clients in other sets don't notice. */
+    uint32_t abuser = 0x0A000003, now = 5000000, addr, others[4];
+    int i, n, limited = 0;
+    for (i = 0; i < 20; i++) {
+        ntp_rate_check(abuser, now);
+    }
+    CHECK_EQ(ntp_rate_check(abuser, now), RATE_DROP);
+    for (addr = 1; addr < 100000; addr++) {
+        limited += ntp_rate_check(0xC0000000 + addr, now) != RATE_OK;
+    }
+    CHECK(limited > 95000);
+    CHECK_EQ(ntp_rate_check(abuser, now + 1), RATE_DROP);
+    /* Once the flood backs off the whole table is free again */
+    now += 17000;
+    for (i = 0; i < 8; i++) {
+        CHECK_EQ(ntp_rate_check(abuser, now), RATE_OK);
+    }
+    /* Fill one set with four busy clients */
+    now += 16000;
+    for (n = 0, addr = 0x0D000000; n < 4; addr++) {
+        if (RATE_SET(addr) == RATE_SET(abuser) && addr != abuser) {
+            others[n++] = addr;
+        }
+    }
+    for (n = 0; n < 4; n++) {
+        for (i = 0; i < 9; i++) {
+            ntp_rate_check(others[n], now);
+        }
+    }
+    while (RATE_SET(addr) != RATE_SET(abuser)) {
+        addr++;
+    }
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_DROP);
+    while (RATE_SET(addr) == RATE_SET(abuser)) {
+        addr++;
+    }
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+}
+
+
+static void
+test_wrap(void) {
+    /* The millisecond counter wrapping doesn't refill or drain credit */
+    uint32_t addr = 0x0A000004, now = 0xFFFFFF00;
+    int i;
+    for (i = 0; i < 8; i++) {
+        CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+        now += 50;
+    }
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_KOD);
+    CHECK(now < 0x1000);
+    now += 2000;
+    CHECK_EQ(ntp_rate_check(addr, now), RATE_OK);
+}
+
+
+int
+main(void) {
+    test_burst();
+    test_steady();
+    test_collide();
+    test_wrap();
+    return unit_done("ntprate");
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* The fixed point PLL must follow the double one: both are run closed loop on
+ * the same simulated oscillator and PPS noise, through a cold start, a warm
+ * start, outliers and a holdover, and the phase each one steers to must stay
+ * within a nanosecond of the other. */
+
+#include <math.h>
+#include <stdint.h>
+#include "pllvariant.h"
+#include "unit.h"
+
+PLL_VARIANT(pll_float);
+PLL_VARIANT(pll_fixed);
+
+unsigned sys_able;
+
+#define STEPS           6000
+#define HOLD_START      3000
+#define HOLD_END        3600
+
+struct run {
+    double theta[STEPS];
+    int st[STEPS];
+    double b;
+    int tn, learned;
+};
+
+static struct run runs[2];
+static uint32_t rng;
+
+
+static double
+uniform(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng + 1.0) / 4294967297.0;
+}
+
+
+static double
+gauss(void) {
+    double u = uniform(), v = uniform();
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+
+static void
+simulate(const struct pll_variant *pv, struct run *r, int seeded) {
+    /* Oscillator 20 ppm off with a random walk in frequency, PPS with 20 ns of
+     * jitter and an occasional 5 us outlier */
+    double eps = 20e-6, theta = 0.003, u;
+    int k;
+    rng = 12345;
+    pv->init();
+    pv->reset();
+    if (seeded) {
+        pv->seed(-eps, 3);
+    }
+    u = pv->poll();
+    for (k = 0; k < STEPS; k++) {
+        eps += 1e-12 + 1e-11 * gauss();
+        theta += eps + u;
+        if (k >= HOLD_START && k < HOLD_END) {
+            u = pv->poll();
+        } else if (k % 50 == 17) {
+            u = pv->math(theta + 5e-6);
+        } else {
+            u = pv->math(theta + 20e-9 * gauss());
+        }
+        r->theta[k] = theta;
+        r->st[k] = pv->state->st;
+    }
+    r->learned = pv->learned(&r->b, &r->tn);
+}
+
+
+static void
+compare(int seeded) {
+    struct run *f = &runs[0], *x = &runs[1];
+    double maxdiff = 0;
+    int k, st_diff = 0;
+    simulate(&pll_float, f, seeded);
+    simulate(&pll_fixed, x, seeded);
+    for (k = 0; k < STEPS; k++) {
+        double d = fabs(f->theta[k] - x->theta[k]);
+        if (d > maxdiff) {
+            maxdiff = d;
+        }
+        if (f->st[k] != x->st[k]) {
+            st_diff++;
+        }
+    }
+    printf("%s start: max phase difference %.3g s, %d steps in a different "
+            "state, final phase %.3g s\n", seeded ? "warm" : "cold",
+            maxdiff, st_diff, x->theta[STEPS - 1]);
+    CHECK(maxdiff < 1e-9);
+    CHECK(st_diff < STEPS / 100);
+    /* Both have locked and tightened up by the end */
+    CHECK(f->st[STEPS - 1] >= 4);
+    CHECK_EQ(x->st[STEPS - 1], f->st[STEPS - 1]);
+    CHECK(fabs(x->theta[STEPS - 1]) < 200e-9);
+    CHECK_EQ(x->learned, 1);
+    CHECK_EQ(f->learned, 1);
+    CHECK_NEAR(x->b, f->b, 1e-12);
+    CHECK_EQ(x->tn, f->tn);
+}
+
+
+static void
+test_seed_limits(void) {
+    /* Out of range seeds are ignored, and the seed is used for holdover before
+     * the first PPS */
+    const struct pll_variant *pvs[2] = { &pll_float, &pll_fixed };
+    double b, held;
+    int i, tn;
+    for (i = 0; i < 2; i++) {
+        const struct pll_variant *pv = pvs[i];
+        pv->init();
+        pv->reset();
+        held = pv->poll();
+        pv->seed(200e-6, 2);
+        CHECK_NEAR(pv->poll(), held, 0);
+        pv->seed(-15e-6, 2);
+        CHECK_NEAR(pv->poll(), -15e-6, 1e-15);
+        CHECK_EQ(pv->learned(&b, &tn), 0);
+    }
+}
+
+
+int
+main(void) {
+    compare(0);
+    compare(1);
+    test_seed_limits();
+    return unit_done("pllfixed");
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* Generated PPS edges must land on the tick nearest the vtimer second they
+ * mark, second after second while the PLL steers the rate, and the pulse must
+ * keep its width. An edge whose compare can't be armed in time must be
+ * refused rather than sent a low period late or early. */
+
+#include <math.h>
+#include "monotonic.h"
+#include "vtstate.h"
+#include "vtimer.h"
+#include "unit.h"
+
+#define TICKS       72e6
+
+
+static double
+uniform(double lo, double hi) {
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+
+static void
+set_rate(struct vt_state *st, double ppm) {
+    st->rate = NTP_SECOND / TICKS * (1 + ppm * 1e-6) * (1 << VT_RATE_PREC);
+}
+
+
+static double
+tick_error(const struct vt_state *st, uint64_t mono, uint64_t vt_when) {
+    /* How far the tick is from the given vtimer time, in ticks */
+    double rate = (double)st->rate / (1 << VT_RATE_PREC);
+    int64_t d = mono - st->mono_last;
+    return d - (double)(int64_t)(vt_when - st->vt_last) / rate;
+}
+
+
+static void
+test_nearest(void) {
+    /* Any time within 7 seconds of the last update goes to the nearest
+     * tick, where truncating is up to a tick off */
+    struct vt_state st;
+    uint64_t vt_when;
+    double err, worst = 0, worst_trunc = 0;
+    int k;
+    for (k = 0; k < 1000000; k++) {
+        set_rate(&st, uniform(-100, 100));
+        st.vt_last = ((uint64_t)rand() << 32) ^ rand();
+        st.mono_last = ((uint64_t)rand() << 24) ^ rand();
+        vt_when = st.vt_last + (int64_t)(uniform(-7, 7) * NTP_SECOND);
+        err = fabs(tick_error(&st, vt_to_mono_round(&st, vt_when), vt_when));
+        if (err > worst) {
+            worst = err;
+        }
+        err = fabs(tick_error(&st, vt_to_mono(&st, vt_when), vt_when));
+        if (err > worst_trunc) {
+            worst_trunc = err;
+        }
+    }
+    printf("nearest: worst %.3f ticks, truncated %.3f\n", worst, worst_trunc);
+    CHECK(worst <= 0.5 + 1e-6);
+    CHECK(worst_trunc > 0.9);
+}
+
+
+static void
+test_schedule(void) {
+    /* A day of pulses the way pll_thread() makes them: each second the
+     * state is updated and the rate steered a little before the top of the
+     * second, then the next one is converted */
+    struct vt_state st;
+    uint64_t vt_second, rise, fall, last_rise = 0, mono_next;
+    double ppm = 20, err, worst = 0;
+    int64_t width, width_min = INT64_MAX, width_max = 0;
+    int k, bad_period = 0;
+    set_rate(&st, ppm);
+    st.vt_last = (uint64_t)3900000000 << 32;
+    st.mono_last = 123456789;
+    rise = st.mono_last;
+    for (k = 0; k < 86400; k++) {
+        mono_next = rise + (uint64_t)(uniform(0.85, 0.95) * TICKS);
+        st.vt_last = vt_calc(&st, mono_next);
+        st.mono_last = mono_next;
+        ppm += uniform(-0.01, 0.01);
+        set_rate(&st, ppm);
+
+        vt_second = (st.vt_last & NTP_MASK_SECONDS) + NTP_SECOND;
+        rise = vt_to_mono_round(&st, vt_second);
+        fall = vt_to_mono_round(&st, vt_second
+                + (uint64_t)(PPSGEN_WIDTH * NTP_SECOND));
+        err = fabs(tick_error(&st, rise, vt_second));
+        if (err > worst) {
+            worst = err;
+        }
+        width = fall - rise;
+        if (width < width_min) {
+            width_min = width;
+        }
+        if (width > width_max) {
+            width_max = width;
+        }
+        /* Every second gets exactly one edge, about a second apart */
+        if (last_rise && fabs((double)(rise - last_rise) - TICKS) > 200e-6 * TICKS) {
+            bad_period++;
+        }
+        last_rise = rise;
+    }
+    printf("schedule: worst %.3f ticks, width %lld..%lld\n", worst,
+            (long long)width_min, (long long)width_max);
+    CHECK(worst <= 0.5 + 1e-6);
+    CHECK_EQ(bad_period, 0);
+    CHECK(fabs(width_min - PPSGEN_WIDTH * TICKS) < 0.0002 * TICKS);
+    CHECK(fabs(width_max - PPSGEN_WIDTH * TICKS) < 0.0002 * TICKS);
+}
+
+
+static void
+test_in_time(void) {
+    /* The compare is armed from a wakeup PPSGEN_LEAD before the edge, late
+     * by however long interrupts were held off */
+    uint64_t when = 1000000007ULL, now;
+    int64_t latency;
+    /* Too early and the low half matches a period before the edge, too late
+     * and a period after */
+    for (latency = -2 * MONO_PERIOD; latency < 2 * MONO_PERIOD; latency++) {
+        now = when - PPSGEN_LEAD + latency;
+        CHECK_EQ(ppsgen_in_time(now, when),
+                latency <= PPSGEN_LEAD - PPSGEN_MARGIN
+                && latency > PPSGEN_LEAD - MONO_PERIOD);
+    }
+}
+
+
+int
+main(void) {
+    srand(1);
+    test_nearest();
+    test_schedule();
+    test_in_time();
+    return unit_done("ppsgen");
+}
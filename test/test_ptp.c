@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* PTP timestamps must map onto the monotonic clock exactly, one tick per HCLK
+ * cycle, including across the subsecond rollover. The PTP clock is modelled
+ * the way the MAC runs it: a 2^31 subsecond accumulator that gains
+ * STM32_PTP_SSINC per cycle and carries into the seconds register. */
+
+#include <stdint.h>
+#include "stm32/eth_ptp.h"
+#include "unit.h"
+
+static uint32_t ptp_sec, ptp_subsec;
+
+
+static void
+ptp_run(uint64_t cycles) {
+    uint64_t units = ((uint64_t)ptp_sec << 31) + ptp_subsec
+        + cycles * STM32_PTP_SSINC;
+    ptp_sec = units >> 31;
+    ptp_subsec = units & 0x7FFFFFFF;
+}
+
+
+static void
+test_mapping(uint64_t start, uint64_t mono0) {
+    /* Sync at 'start' cycles after the PTP clock was zeroed, the same way
+     * mac_ptp_start() does, then convert timestamps taken later on */
+    uint64_t offset, now, prev;
+    uint32_t sec;
+    int i, bad = 0;
+    ptp_sec = ptp_subsec = 0;
+    ptp_run(start);
+    offset = mono0 - ptp_ticks(ptp_sec, ptp_subsec);
+    CHECK_EQ(offset + ptp_ticks(ptp_sec, ptp_subsec), mono0);
+
+    /* Arbitrary strides */
+    now = 0;
+    for (i = 0; i < 100000; i++) {
+        uint64_t step = (i * 2654435761u) % 100000000;
+        ptp_run(step);
+        now += step;
+        if (offset + ptp_ticks(ptp_sec, ptp_subsec) != mono0 + now) {
+            bad++;
+        }
+    }
+    CHECK_EQ(bad, 0);
+
+    /* Single cycles across the next rollover: no repeats and no jumps */
+    sec = ptp_sec;
+    ptp_run((0x7FFFFFFF - ptp_subsec) / STM32_PTP_SSINC - 5);
+    CHECK(ptp_sec == sec);
+    prev = ptp_ticks(ptp_sec, ptp_subsec);
+    bad = 0;
+    for (i = 0; i < 10; i++) {
+        ptp_run(1);
+        if (ptp_ticks(ptp_sec, ptp_subsec) != prev + 1) {
+            bad++;
+        }
+        prev = ptp_ticks(ptp_sec, ptp_subsec);
+    }
+    CHECK_EQ(bad, 0);
+    CHECK(ptp_sec == sec + 1);
+}
+
+
+int
+main(void) {
+    test_mapping(0, 0);
+    test_mapping(12345, 0x123456789ULL);
+    /* A long time after the MAC was started */
+    test_mapping(1ULL << 44, 1ULL << 50);
+    /* Bit 31 of the subsecond register is the sign bit and is ignored */
+    CHECK_EQ(ptp_ticks(5, 0x80000000 | 300), ptp_ticks(5, 300));
+    CHECK_EQ(ptp_ticks(1, 0), (1ULL << 31) / STM32_PTP_SSINC);
+    return unit_done("ptp");
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+/* The published vtimer state must never be seen half-written. A writer
+ * thread publishes states whose fields are all derived from one counter while
+ * reader threads check every copy they get. On the firmware the readers are
+ * interrupt handlers and lower priority threads on a single core; here they
+ * run truly in parallel, which is the harder case on x86, where stores and
+ * loads are not reordered with each other. Also checks the conversions
+ * between monotonic and vtimer time. */
+
+#include <pthread.h>
+#include <math.h>
+#include "vtstate.h"
+#include "unit.h"
+
+#define READERS     3
+#define RATE0       ((uint64_t)1 << 40)
+#define WRITES      20000000
+
+static struct vt_published pub;
+static volatile int done;
+
+
+static void *
+reader(void *arg) {
+    /* Returns the number of inconsistent or out of order copies */
+    struct vt_state st;
+    uint64_t k, last = 0;
+    uintptr_t bad = 0;
+    while (!done) {
+        vt_read(&pub, &st);
+        k = st.rate - RATE0;
+        if (st.vt_last != k * 1000003 || st.mono_last != k * 7 || k < last) {
+            bad++;
+        }
+        last = k;
+    }
+    return (void*)bad;
+}
+
+
+static void
+test_concurrent(void) {
+    pthread_t threads[READERS];
+    struct vt_state st;
+    uintptr_t bad = 0;
+    void *ret;
+    uint64_t k;
+    int i;
+    memset(&st, 0, sizeof(st));
+    st.rate = RATE0;
+    vt_publish(&pub, &st);
+    for (i = 0; i < READERS; i++) {
+        pthread_create(&threads[i], NULL, reader, NULL);
+    }
+    for (k = 1; k <= WRITES; k++) {
+        st.rate = RATE0 + k;
+        st.vt_last = k * 1000003;
+        st.mono_last = k * 7;
+        vt_publish(&pub, &st);
+    }
+    done = 1;
+    for (i = 0; i < READERS; i++) {
+        pthread_join(threads[i], &ret);
+        bad += (uintptr_t)ret;
+    }
+    CHECK_EQ(bad, 0);
+    vt_read(&pub, &st);
+    CHECK_EQ(st.rate, RATE0 + WRITES);
+}
+
+
+static void
+test_calc(void) {
+    /* 72 MHz, a little fast */
+    struct vt_state st;
+    double rate = 4294967296.0 / 72e6 * (1 + 3e-6);
+    int64_t delta;
+    int bad = 0, bad_back = 0;
+    st.rate = rate * (1 << VT_RATE_PREC);
+    st.vt_last = (uint64_t)3900000000 << 32;
+    st.mono_last = 123456789012ULL;
+    /* Up to 7 seconds either side of the last update */
+    for (delta = -504000000LL; delta <= 504000000LL; delta += 99991) {
+        uint64_t vt_when = vt_calc(&st, st.mono_last + delta);
+        double want = (double)delta * st.rate / (1 << VT_RATE_PREC);
+        if (fabs((double)(int64_t)(vt_when - st.vt_last) - want) > 1.0) {
+            bad++;
+        }
+        /* and back, to within a tick */
+        if (llabs((int64_t)(vt_to_mono(&st, vt_when) - st.mono_last - delta))
+                > 1) {
+            bad_back++;
+        }
+    }
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(bad_back, 0);
+}
+
+
+int
+main(void) {
+    test_calc();
+    test_concurrent();
+    return unit_done("vtstate");
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Michael Tharp <gxti@partiallystapled.com>
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _UNIT_H
+#define _UNIT_H
+
+/* Minimal checks for the host-side tests. Each test program includes this
+ * once, runs its checks from main() and returns unit_done(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int unit_checks, unit_failures;
+
+#define CHECK(cond) do { \
+    unit_checks++; \
+    if (!(cond)) { \
+        unit_failures++; \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long _a = (long long)(a), _b = (long long)(b); \
+    unit_checks++; \
+    if (_a != _b) { \
+        unit_failures++; \
+        printf("%s:%d: %s == %s failed: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, _a, _b); \
+    } \
+} while (0)
+
+#define CHECK_NEAR(a, b, tol) do { \
+    double _a = (a), _b = (b); \
+    unit_checks++; \
+    if (!(_a - _b <= (tol) && _b - _a <= (tol))) { \
+        unit_failures++; \
+        printf("%s:%d: %s ~= %s failed: %.12g != %.12g\n", \
+                __FILE__, __LINE__, #a, #b, _a, _b); \
+    } \
+} while (0)
+
+#define CHECK_MEM(a, b, len) do { \
+    unit_checks++; \
+    if (memcmp((a), (b), (len))) { \
+        unit_failures++; \
+        printf("%s:%d: %s and %s differ\n", __FILE__, __LINE__, #a, #b); \
+    } \
+} while (0)
+
+
+static inline int
+unit_done(const char *name) {
+    printf("%s: %d checks, %d failed\n", name, unit_checks, unit_failures);
+    return unit_failures ? 1 : 0;
+}
+
+
+static inline void
+unit_unhex(uint8_t *out, const char *hex) {
+    /* Decode a hex string into bytes, for test vectors */
+    unsigned val;
+    while (hex[0] && hex[1] && sscanf(hex, "%2x", &val) == 1) {
+        *out++ = val;
+        hex += 2;
+    }
+}
+
+#endif